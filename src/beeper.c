@@ -0,0 +1,95 @@
+/* beeper.c */
+#include <math.h>
+#include <string.h>
+
+#include "beeper.h"
+#include "zx_spectrum.h"
+
+// Step size of the speaker, a quarter of full scale
+#define BEEPER_VOLUME 8192.0f
+// High-pass coefficient, a corner of about 7 Hz at 48 kHz
+#define BEEPER_HIGH_PASS (1.0f / 1024)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Impulse for an edge a fraction phase / BEEPER_PHASES of a sample after
+// the start of tap 0: a sinc cut off a little below Nyquist, under a
+// Blackman window, scaled to add up to 1 so every step is the same height
+static void init_kernel(ZX_Beeper* beeper) {
+  const double cutoff = 0.9;
+  for (int phase = 0; phase < BEEPER_PHASES; phase++) {
+    double sum = 0;
+    for (int tap = 0; tap < BEEPER_TAPS; tap++) {
+      double x = tap - (double)phase / BEEPER_PHASES - BEEPER_TAPS / 2 + 1;
+      double n = (x + BEEPER_TAPS / 2) / BEEPER_TAPS;
+      double window = 0.42 - 0.5 * cos(2 * M_PI * n) + 0.08 * cos(4 * M_PI * n);
+      double sinc = x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+      beeper->kernel[phase][tap] = (float)(sinc * window);
+      sum += sinc * window;
+    }
+    for (int tap = 0; tap < BEEPER_TAPS; tap++)
+      beeper->kernel[phase][tap] /= (float)sum;
+  }
+}
+
+void beeper_init(ZX_Beeper* beeper, uint64_t time) {
+  memset(beeper, 0, sizeof(*beeper));
+  init_kernel(beeper);
+  beeper->start = time;
+  beeper_set_rate(beeper, BEEPER_DEFAULT_RATE);
+}
+
+void beeper_set_rate(ZX_Beeper* beeper, double rate) {
+  beeper->samples_per_tstate = rate / ((double)FRAME_TSTATES * FRAMES_PER_SECOND);
+}
+
+void beeper_edge(ZX_Beeper* beeper, uint64_t time, bool level) {
+  if (level == beeper->level)
+    return;
+  beeper->level = level;
+
+  double pos = beeper->offset;
+  if (time > beeper->start)
+    pos += (time - beeper->start) * beeper->samples_per_tstate;
+  if (pos >= BEEPER_BUFFER_SIZE)
+    return;
+  int sample = (int)pos;
+  int phase = (int)((pos - sample) * BEEPER_PHASES);
+  float delta = level ? BEEPER_VOLUME : -BEEPER_VOLUME;
+  const float* kernel = beeper->kernel[phase];
+  float* out = &beeper->deltas[sample];
+  for (int tap = 0; tap < BEEPER_TAPS; tap++)
+    out[tap] += delta * kernel[tap];
+}
+
+int beeper_read(ZX_Beeper* beeper, uint64_t time, int16_t* out, int max) {
+  double end = beeper->offset;
+  if (time > beeper->start)
+    end += (time - beeper->start) * beeper->samples_per_tstate;
+  int count = (int)end;
+  beeper->offset = end - count;
+  beeper->start = time;
+
+  const int size = BEEPER_BUFFER_SIZE + BEEPER_TAPS;
+  for (int i = 0; i < count && i < max; i++) {
+    beeper->sum += i < size ? beeper->deltas[i] : 0;
+    beeper->dc += (beeper->sum - beeper->dc) * BEEPER_HIGH_PASS;
+    float sample = beeper->sum - beeper->dc;
+    if (sample > INT16_MAX)
+      sample = INT16_MAX;
+    else if (sample < INT16_MIN)
+      sample = INT16_MIN;
+    out[i] = (int16_t)sample;
+  }
+  // Samples past max are dropped, but their steps still count
+  for (int i = max; i < count && i < size; i++)
+    beeper->sum += beeper->deltas[i];
+
+  // Keep the tails of the impulses that reach past the last sample read
+  int kept = count < size ? size - count : 0;
+  memmove(beeper->deltas, &beeper->deltas[size - kept], kept * sizeof(float));
+  memset(&beeper->deltas[kept], 0, (size - kept) * sizeof(float));
+  return count;
+}
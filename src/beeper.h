@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Beeper: the speaker follows bit 4 of the last write to the ULA port.
+// output_port hands each change to beeper_edge with the T-state it happened
+// at; beeper_read turns the edges up to a given T-state into samples.
+//
+// Each edge is a step, band-limited by adding a windowed sinc impulse
+// (picked from BEEPER_PHASES sub-sample positions) into a buffer of sample
+// deltas, which beeper_read integrates. Square waves of any frequency come
+// out without aliasing, and the cost is per edge rather than per T-state.
+#define BEEPER_TAPS 16
+#define BEEPER_PHASES 64
+// Pending samples, a few frames at 48 kHz: edges further ahead are dropped
+#define BEEPER_BUFFER_SIZE 4096
+#define BEEPER_DEFAULT_RATE 48000
+
+typedef struct {
+    // Output samples per T-state, and the T-state and sub-sample position
+    // of the first sample not read yet
+    double samples_per_tstate;
+    uint64_t start;
+    double offset;
+    uint8_t level;
+
+    // Sample deltas from start on, and the state of the integrator and of
+    // the high-pass filter that keeps a speaker left on from reading as DC
+    float deltas[BEEPER_BUFFER_SIZE + BEEPER_TAPS];
+    float sum;
+    float dc;
+
+    float kernel[BEEPER_PHASES][BEEPER_TAPS];
+} ZX_Beeper;
+
+// Silence from T-state time on, at BEEPER_DEFAULT_RATE
+void beeper_init(ZX_Beeper* beeper, uint64_t time);
+// Output rate in samples per second. May change between reads: the
+// front end nudges it to keep its audio buffer at a steady level.
+void beeper_set_rate(ZX_Beeper* beeper, double rate);
+void beeper_edge(ZX_Beeper* beeper, uint64_t time, bool level);
+// Samples from the last read up to T-state time. Returns how many there
+// were, of which the first max (at most) are stored in out.
+int beeper_read(ZX_Beeper* beeper, uint64_t time, int16_t* out, int max);
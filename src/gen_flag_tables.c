@@ -0,0 +1,230 @@
+/* gen_flag_tables.c */
+// Build-time generator for the Z80 flag lookup tables used by z80.c.
+//
+// Usage: gen_flag_tables <output header>
+//
+// Before writing anything the tables are checked: the table-driven flag
+// macros in z80.h against the conditional macros they replaced, and the
+// ADD/SUB tables against plain integer arithmetic. Any mismatch fails the
+// build.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "z80.h"
+
+#define ALU_TABLE_SIZE (2 * 256 * 256)
+
+static uint8_t sz_table[256];
+static uint8_t szp_table[256];
+static uint8_t szhv_inc[256];
+static uint8_t szhv_dec[256];
+static uint8_t szhvc_add[ALU_TABLE_SIZE];
+static uint8_t szhvc_sub[ALU_TABLE_SIZE];
+
+// The conditional flag macros as they were before the tables existed
+#define LEGACY_UPDATE_SZ(state, val) do { \
+    CLR_FLAG(state, FLAG_Z | FLAG_S); \
+    if(!(val)) SET_FLAG(state, FLAG_Z); \
+    if((val) & 0x80) SET_FLAG(state, FLAG_S); \
+} while(0)
+
+#define LEGACY_UPDATE_SZP(state, val) do { \
+    LEGACY_UPDATE_SZ(state, val); \
+    CLR_FLAG(state, FLAG_PV); \
+    if(even_parity(val)) SET_FLAG(state, FLAG_PV); \
+} while(0)
+
+#define LEGACY_UPDATE_FLAGS_LOGIC(result) \
+    CLR_FLAG(state, FLAG_Z | FLAG_S | FLAG_H | FLAG_C); \
+    if((result) == 0) SET_FLAG(state, FLAG_Z); \
+    if((result) & 0x80) SET_FLAG(state, FLAG_S);
+
+static int even_parity(uint8_t val) {
+  int bits = 0;
+  for (int i = 0; i < 8; i++)
+    bits += (val >> i) & 1;
+  return (bits & 1) == 0;
+}
+
+static void build_tables(void) {
+  for (int val = 0; val < 256; val++) {
+    sz_table[val] = (val & (FLAG_S | FLAG_5 | FLAG_3)) | (val == 0 ? FLAG_Z : 0);
+    szp_table[val] = sz_table[val] | (even_parity(val) ? FLAG_PV : 0);
+
+    // Indexed by the result of INC/DEC; carry is left to the caller
+    szhv_inc[val] = sz_table[val];
+    if (val == 0x80) szhv_inc[val] |= FLAG_PV;
+    if ((val & 0x0F) == 0x00) szhv_inc[val] |= FLAG_H;
+
+    szhv_dec[val] = sz_table[val] | FLAG_N;
+    if (val == 0x7F) szhv_dec[val] |= FLAG_PV;
+    if ((val & 0x0F) == 0x0F) szhv_dec[val] |= FLAG_H;
+  }
+
+  // Indexed by (carry << 16) | (a << 8) | operand
+  for (int carry = 0; carry < 2; carry++) {
+    for (int a = 0; a < 256; a++) {
+      for (int val = 0; val < 256; val++) {
+        int index = (carry << 16) | (a << 8) | val;
+
+        int res = a + val + carry;
+        uint8_t f = sz_table[res & 0xFF];
+        if (res > 0xFF) f |= FLAG_C;
+        if (((a & 0x0F) + (val & 0x0F) + carry) > 0x0F) f |= FLAG_H;
+        if (~(a ^ val) & (a ^ res) & 0x80) f |= FLAG_PV;
+        szhvc_add[index] = f;
+
+        res = a - val - carry;
+        f = sz_table[res & 0xFF] | FLAG_N;
+        if (res < 0) f |= FLAG_C;
+        if (((a & 0x0F) - (val & 0x0F) - carry) < 0) f |= FLAG_H;
+        if ((a ^ val) & (a ^ res) & 0x80) f |= FLAG_PV;
+        szhvc_sub[index] = f;
+      }
+    }
+  }
+}
+
+static int failures = 0;
+
+static void check(int ok, const char* what, int a, int b, int c) {
+  if (ok)
+    return;
+  if (failures++ < 10)
+    fprintf(stderr, "gen_flag_tables: %s mismatch (%02X, %02X, %d)\n", what, a, b, c);
+}
+
+static void verify_tables(void) {
+  const uint8_t undocumented = FLAG_5 | FLAG_3;
+  const uint8_t documented = (uint8_t)~undocumented;
+  Z80_State legacy_state;
+  Z80_State table_state;
+  Z80_State* state;
+
+  // The SZ/SZP/LOGIC macros must agree with the old ones on every documented
+  // bit, for every incoming F; bits 3 and 5 are new and follow the value
+  for (int f = 0; f < 256; f++) {
+    for (int val = 0; val < 256; val++) {
+      legacy_state.f = table_state.f = f;
+      LEGACY_UPDATE_SZ(&legacy_state, val);
+      UPDATE_SZ(&table_state, val);
+      check(((legacy_state.f ^ table_state.f) & documented) == 0, "UPDATE_SZ", f, val, 0);
+      check((table_state.f & undocumented) == (val & undocumented), "UPDATE_SZ bits 3/5", f, val, 0);
+
+      legacy_state.f = table_state.f = f;
+      LEGACY_UPDATE_SZP(&legacy_state, val);
+      UPDATE_SZP(&table_state, val);
+      check(((legacy_state.f ^ table_state.f) & documented) == 0, "UPDATE_SZP", f, val, 0);
+
+      legacy_state.f = table_state.f = f;
+      state = &legacy_state;
+      LEGACY_UPDATE_FLAGS_LOGIC(val);
+      state = &table_state;
+      UPDATE_FLAGS_LOGIC(val);
+      check(((legacy_state.f ^ table_state.f) & documented) == 0, "UPDATE_FLAGS_LOGIC", f, val, 0);
+    }
+  }
+
+  // ADD/SUB against plain arithmetic; the old ADD/SUB macros derived H and C
+  // from the result instead of A, so only S and Z can be compared with them
+  for (int carry = 0; carry < 2; carry++) {
+    for (int a = 0; a < 256; a++) {
+      for (int val = 0; val < 256; val++) {
+        int index = (carry << 16) | (a << 8) | val;
+
+        int sum = a + val + carry;
+        int signed_sum = (int8_t)a + (int8_t)val + carry;
+        uint8_t f = szhvc_add[index];
+        check(!!(f & FLAG_C) == (sum > 255), "ADD carry", a, val, carry);
+        check(!!(f & FLAG_H) == (((a & 15) + (val & 15) + carry) >= 16), "ADD half carry", a, val, carry);
+        check(!!(f & FLAG_PV) == (signed_sum < -128 || signed_sum > 127), "ADD overflow", a, val, carry);
+        check(!(f & FLAG_N), "ADD negative", a, val, carry);
+        check((f & (FLAG_S | FLAG_Z | undocumented)) == sz_table[sum & 0xFF], "ADD sign/zero", a, val, carry);
+
+        int diff = a - val - carry;
+        int signed_diff = (int8_t)a - (int8_t)val - carry;
+        f = szhvc_sub[index];
+        check(!!(f & FLAG_C) == (diff < 0), "SUB borrow", a, val, carry);
+        check(!!(f & FLAG_H) == ((a & 15) < (val & 15) + carry), "SUB half borrow", a, val, carry);
+        check(!!(f & FLAG_PV) == (signed_diff < -128 || signed_diff > 127), "SUB overflow", a, val, carry);
+        check(!!(f & FLAG_N), "SUB negative", a, val, carry);
+        check((f & (FLAG_S | FLAG_Z | undocumented)) == sz_table[diff & 0xFF], "SUB sign/zero", a, val, carry);
+      }
+    }
+  }
+
+  for (int f = 0; f < 256; f += 0x11) {
+    for (int a = 0; a < 256; a++) {
+      for (int val = 0; val < 256; val++) {
+        uint8_t sum = a + val;
+        uint8_t diff = a - val;
+
+        table_state.f = f;
+        UPDATE_FLAGS_ADD(&table_state, sum, val);
+        check((table_state.f & (FLAG_S | FLAG_Z)) == (sz_table[sum] & (FLAG_S | FLAG_Z)), "UPDATE_FLAGS_ADD", a, val, f);
+        check(table_state.f == szhvc_add[(a << 8) | val], "UPDATE_FLAGS_ADD operand", a, val, f);
+
+        table_state.f = f;
+        UPDATE_FLAGS_SUB(&table_state, diff, val);
+        check((table_state.f & (FLAG_S | FLAG_Z)) == (sz_table[diff] & (FLAG_S | FLAG_Z)), "UPDATE_FLAGS_SUB", a, val, f);
+        check(table_state.f == szhvc_sub[(a << 8) | val], "UPDATE_FLAGS_SUB operand", a, val, f);
+      }
+    }
+  }
+
+  // INC/DEC are ADD/SUB of one with the carry flag left alone
+  for (int val = 0; val < 256; val++) {
+    uint8_t inc = val + 1;
+    uint8_t dec = val - 1;
+    check(szhv_inc[inc] == (szhvc_add[(val << 8) | 1] & ~FLAG_C), "INC", val, 0, 0);
+    check(szhv_dec[dec] == (szhvc_sub[(val << 8) | 1] & ~FLAG_C), "DEC", val, 0, 0);
+  }
+}
+
+static void write_table(FILE* out, const char* name, const uint8_t* table, int size) {
+  fprintf(out, "static const uint8_t %s[%d] = {\n", name, size);
+  for (int i = 0; i < size; i += 16) {
+    fprintf(out, "    ");
+    for (int j = i; j < i + 16; j++)
+      fprintf(out, "0x%02X%s", table[j], j + 1 < size ? "," : "");
+    fprintf(out, "\n");
+  }
+  fprintf(out, "};\n\n");
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <output header>\n", argv[0]);
+    return 1;
+  }
+
+  build_tables();
+  verify_tables();
+  if (failures) {
+    fprintf(stderr, "gen_flag_tables: %d mismatches, not writing %s\n", failures, argv[1]);
+    return 1;
+  }
+
+  FILE* out = fopen(argv[1], "w");
+  if (!out) {
+    perror("gen_flag_tables");
+    return 1;
+  }
+
+  fprintf(out, "// Generated by gen_flag_tables.c, do not edit\n");
+  fprintf(out, "#pragma once\n\n#include <stdint.h>\n\n");
+  write_table(out, "sz_table", sz_table, 256);
+  write_table(out, "szp_table", szp_table, 256);
+  write_table(out, "szhv_inc", szhv_inc, 256);
+  write_table(out, "szhv_dec", szhv_dec, 256);
+  fprintf(out, "// Indexed by (carry << 16) | (a << 8) | operand\n");
+  write_table(out, "szhvc_add", szhvc_add, ALU_TABLE_SIZE);
+  write_table(out, "szhvc_sub", szhvc_sub, ALU_TABLE_SIZE);
+
+  if (fclose(out) != 0) {
+    perror("gen_flag_tables");
+    return 1;
+  }
+  return 0;
+}
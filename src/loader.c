@@ -5,8 +5,10 @@
 #include "loader.h"
 #include "zx_spectrum.h"
 #include "memory.h"
+#include "machine.h"
+#include "z80.h"
 
-bool load_rom(const char* path) {
+bool load_rom(const char* path, ZX_Machine* machine) {
     // Existing ROM loading code
     FILE* rom = fopen(path, "rb");
     if (!rom) {
@@ -18,136 +20,204 @@ bool load_rom(const char* path) {
     long size = ftell(rom);
     rewind(rom);
   
-    if (size != ROM_SIZE) {
-      fprintf(stderr, "Invalid Spectrum ROM: %ld bytes (expected 16KB)\n", size);
+    // 16K for the 48K, 32K (editor ROM then 48K BASIC) for the 128K
+    if (size != ROM_SIZE && size != ROM_SIZE * ROM_BANKS) {
+      fprintf(stderr, "Invalid Spectrum ROM: %ld bytes (expected 16KB or 32KB)\n", size);
       fclose(rom);
       return false;
     }
   
-    size_t read = fread(&memory[ROM_START], 1, ROM_SIZE, rom);
+    size_t read = fread(machine->memory.rom, 1, size, rom);
     fclose(rom);
   
-    if (read != ROM_SIZE) {
-      fprintf(stderr, "Partial ROM read: %zu/16384 bytes\n", read);
+    if (read != (size_t)size) {
+      fprintf(stderr, "Partial ROM read: %zu/%ld bytes\n", read, size);
       return false;
     }
+    mem_set_model(machine, size == ROM_SIZE ? ZX_MODEL_48K : ZX_MODEL_128K);
   
     printf("Loaded Spectrum ROM successfully\n");
     return true;
   }
   
-bool load_z80_snapshot(const char* filename, Z80_State* state) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-      perror("Failed to open Z80 file");
-      return false;
+  // Expand the ED ED count value runs of .z80 memory data into len bytes of
+  // out. Returns the number of bytes of data used, 0 if it ran out first.
+  static size_t z80_decompress(const uint8_t* data, size_t size, uint8_t* out, size_t len) {
+    size_t src = 0;
+    size_t dst = 0;
+    while (dst < len) {
+      if (src + 3 < size && data[src] == 0xED && data[src + 1] == 0xED) {
+        for (int count = data[src + 2]; count > 0 && dst < len; count--)
+          out[dst++] = data[src + 3];
+        src += 4;
+      } else if (src < size) {
+        out[dst++] = data[src++];
+      } else {
+        return 0;
+      }
     }
-  
-    // Read main header (at least 30 bytes)
-    uint8_t header[58];
-    if (fread(header, 1, 30, file) != 30) {
-      fclose(file);
-      return false;
+    return src;
+  }
+
+  // RAM bank a .z80 memory page is loaded into, -1 if there is none
+  static int z80_page_bank(int page, bool is_128k) {
+    if (is_128k)
+      return page >= 3 && page <= 10 ? page - 3 : -1;
+    switch (page) {
+    case 8: return 5;   // 4000
+    case 4: return 2;   // 8000
+    case 5: return 0;   // C000
+    default: return -1;
     }
-  
-    // Detect version (byte 29/0x1D)
-    int version = 1;
-    if (header[29] == 23 || header[29] == 54) version = 2;
-  
-    // Read extended header for version 2/3
-    if (version >= 2) {
-      if (fread(&header[30], 1, 28, file) != 28) {
-        fclose(file);
+  }
+
+  // Version 1 memory: 48K from 4000 as one block, compressed or not
+  static bool load_z80_ram(ZX_Machine* machine, const uint8_t* data, size_t size, bool compressed) {
+    uint8_t* ram = malloc(RAM_SIZE);
+    bool ok = ram != NULL;
+    if (ok && compressed)
+      ok = z80_decompress(data, size, ram, RAM_SIZE) != 0;
+    else if (ok && size >= RAM_SIZE)
+      memcpy(ram, data, RAM_SIZE);
+    else
+      ok = false;
+    if (ok) {
+      static const int pages[] = { 8, 4, 5 };
+      for (int i = 0; i < 3; i++)
+        memcpy(machine->memory.ram[z80_page_bank(pages[i], false)], &ram[i * MEM_SLOT_SIZE], MEM_SLOT_SIZE);
+    }
+    free(ram);
+    return ok;
+  }
+
+  // Version 2 and 3 memory from pos on: each page is a length (0xFFFF for
+  // 16K stored as is), a page number and the data
+  static bool load_z80_pages(ZX_Machine* machine, const uint8_t* data, size_t pos, size_t size, bool is_128k) {
+    while (pos + 3 <= size) {
+      size_t length = data[pos] | (data[pos + 1] << 8);
+      int bank = z80_page_bank(data[pos + 2], is_128k);
+      pos += 3;
+      bool raw = length == 0xFFFF;
+      if (raw)
+        length = MEM_SLOT_SIZE;
+      if (pos + length > size)
         return false;
+      if (bank >= 0) {
+        uint8_t* out = machine->memory.ram[bank];
+        if (raw)
+          memcpy(out, &data[pos], MEM_SLOT_SIZE);
+        else if (z80_decompress(&data[pos], length, out, MEM_SLOT_SIZE) == 0)
+          return false;
       }
+      pos += length;
     }
-  
-    // Handle different version formats
-    uint16_t pc = (header[7] << 8) | header[6];
-    bool compressed = false;
-    size_t data_offset = 30;
-  
-    if (version >= 2) {
-      // Version 2+ specific handling
-      compressed = (header[34] & 0x20); // Compression flag in extended header
-      data_offset = 32 + header[30];    // Skip additional headers
-      pc = (header[33] << 8) | header[32];
-    }
-    else {
-      // Original version 1 handling
-      compressed = (header[12] & 0x20);
+    return true;
+  }
+
+bool load_z80_snapshot(const char* filename, ZX_Machine* machine) {
+    Z80_State* state = &machine->cpu;
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+      perror("Failed to open Z80 file");
+      return false;
     }
-  
-    // Read register state
-    state->pc = pc;
-    state->af = (header[0] << 8) | header[1];
-    state->bc = (header[2] << 8) | header[3];
-    state->de = (header[4] << 8) | header[5];
-    state->hl = (header[8] << 8) | header[9];
-    state->ix = (header[10] << 8) | header[11];
-    state->iy = (header[12] << 8) | header[13];
-    state->sp = (header[14] << 8) | header[15];
-    state->f = header[16];
-    state->imode = header[17];
-    state->r = header[18];
-  
-    // Get RAM data
+
     fseek(file, 0, SEEK_END);
     long file_size = ftell(file);
-    fseek(file, data_offset, SEEK_SET);
-    long data_size = file_size - data_offset;
-  
-    uint8_t* data = malloc(data_size);
-    if (!data || fread(data, 1, data_size, file) != data_size) {
+    rewind(file);
+    uint8_t* data = file_size > 0 ? malloc(file_size) : NULL;
+    if (!data || fread(data, 1, file_size, file) != (size_t)file_size || file_size < 30) {
+      fprintf(stderr, "Unable to read Z80 file\n");
       free(data);
       fclose(file);
       return false;
     }
     fclose(file);
-  
-    // Handle different memory models
-    size_t dest_idx = 0x4000;  // Standard 48K Spectrum RAM start
-    size_t ram_size = 0xC000;   // 48K RAM size
-  
-    if (!compressed) {
-      // Simple memory copy for uncompressed data
-      if (data_size != ram_size) {
-        fprintf(stderr, "Unexpected RAM size: %ld (expected %zu)\n",
-          data_size, ram_size);
+
+    // Version 1 header: 30 bytes, registers in little-endian order apart
+    // from A before F. Byte 12 holds bit 7 of R, the border colour and the
+    // compression flag; 255 means 1.
+    const uint8_t* header = data;
+    uint8_t flags = header[12] == 255 ? 1 : header[12];
+    state->a = header[0];
+    state->f = header[1];
+    state->bc = header[2] | (header[3] << 8);
+    state->hl = header[4] | (header[5] << 8);
+    state->pc = header[6] | (header[7] << 8);
+    state->sp = header[8] | (header[9] << 8);
+    state->i = header[10];
+    state->r = (header[11] & 0x7F) | ((flags & 0x01) << 7);
+    machine->border = (flags >> 1) & 0x07;
+    state->de = header[13] | (header[14] << 8);
+    state->bc_ = header[15] | (header[16] << 8);
+    state->de_ = header[17] | (header[18] << 8);
+    state->hl_ = header[19] | (header[20] << 8);
+    state->a_ = header[21];
+    state->f_ = header[22];
+    state->iy = header[23] | (header[24] << 8);
+    state->ix = header[25] | (header[26] << 8);
+    state->iff1 = header[27] ? 1 : 0;
+    state->iff2 = header[28] ? 1 : 0;
+    state->imode = header[29] & 0x03;
+
+    // Version 1: PC set, then 48K of RAM from 4000, compressed if bit 5 of
+    // byte 12 is set
+    int version = 1;
+    bool is_128k = false;
+    uint8_t paging = 0x30;
+    bool ok;
+    if (state->pc != 0) {
+      ok = load_z80_ram(machine, &data[30], file_size - 30, flags & 0x20);
+    } else {
+      // Versions 2 and 3: PC 0 in the first header, then the length of an
+      // extra header (23 for version 2, 54 or 55 for 3) with the real PC and
+      // the hardware, followed by 16K memory pages
+      size_t extra = file_size >= 32 ? header[30] | (header[31] << 8) : 0;
+      if ((extra != 23 && extra != 54 && extra != 55) || 32 + extra > (size_t)file_size) {
+        fprintf(stderr, "Unknown Z80 header length: %zu\n", extra);
         free(data);
         return false;
       }
-      memcpy(&memory[dest_idx], data, ram_size);
-    }
-    else {
-      // Enhanced decompression handling
-      size_t src_idx = 0;
-      while (src_idx < data_size && dest_idx < (0x4000 + ram_size)) {
-        if (data[src_idx] == 0xED && (src_idx + 1 < data_size) && data[src_idx + 1] == 0xED) {
-          // Compressed block
-          src_idx += 2;
-          if (src_idx + 1 >= data_size) break;
-  
-          uint16_t count = data[src_idx++];
-          uint16_t value = data[src_idx++];
-  
-          if (count == 0) count = 256;
-          memset(&memory[dest_idx], value, count);
-          dest_idx += count;
-        }
-        else {
-          // Uncompressed byte
-          memory[dest_idx++] = data[src_idx++];
-        }
+      version = extra == 23 ? 2 : 3;
+      state->pc = header[32] | (header[33] << 8);
+
+      uint8_t hardware = header[34];
+      is_128k = version == 2 ? hardware == 3 || hardware == 4 : hardware >= 4 && hardware <= 6;
+      bool is_48k = hardware <= 1 || (version == 3 && hardware == 3);
+      if (!is_128k && !is_48k) {
+        fprintf(stderr, "Unsupported Z80 hardware mode: %d\n", hardware);
+        free(data);
+        return false;
       }
+      if (is_128k && mem_get_model(machine) != ZX_MODEL_128K) {
+        fprintf(stderr, "128K snapshot needs the 128K ROM\n");
+        free(data);
+        return false;
+      }
+      if (is_128k)
+        paging = header[35];
+      ok = load_z80_pages(machine, data, 32 + extra, file_size, is_128k);
     }
-  
     free(data);
+    if (!ok) {
+      fprintf(stderr, "Truncated Z80 memory data\n");
+      return false;
+    }
+
+    // The memory went straight into the banks: set the paging the snapshot
+    // was taken with (a 48K one on a 128K machine runs the 48K ROM with
+    // paging locked) and drop whatever was cached or drawn from them
+    if (mem_get_model(machine) == ZX_MODEL_128K)
+      mem_page(machine, paging);
+    mem_mark_screen(machine);
+    z80_flush_block_cache(state);
+
     printf("Successfully loaded Z80 snapshot (version %d)\n", version);
     return true;
   }
 
-  bool load_sna(const char* filename, Z80_State* state) {
+  bool load_sna(const char* filename, ZX_Machine* machine) {
+    Z80_State* state = &machine->cpu;
     FILE* sna_file = fopen(filename, "rb");
     if (!sna_file) {
         perror("SNA load failed");
@@ -164,19 +234,28 @@ bool load_z80_snapshot(const char* filename, Z80_State* state) {
     fread(&state->bc, sizeof(uint16_t), 1, sna_file);
     fread(&state->iy, sizeof(uint16_t), 1, sna_file);
     fread(&state->ix, sizeof(uint16_t), 1, sna_file);
-    fread(&state->iff1, sizeof(uint8_t), 1, sna_file);
-    fread(&state->iff2, sizeof(uint8_t), 1, sna_file);
+
+    // Bit 2 holds IFF2; IFF1 is the same outside an NMI handler
+    uint8_t iff;
+    fread(&iff, sizeof(uint8_t), 1, sna_file);
+    state->iff1 = state->iff2 = (iff >> 2) & 1;
+
+    fread(&state->r, sizeof(uint8_t), 1, sna_file);
+    fread(&state->af, sizeof(uint16_t), 1, sna_file);
+    fread(&state->sp, sizeof(uint16_t), 1, sna_file);
 
     uint8_t imode;
     fread(&imode, sizeof(uint8_t), 1, sna_file);
     state->imode = imode & 0x03; // IM is only 2 bits
 
-    fread(&state->sp, sizeof(uint16_t), 1, sna_file);
-    fread(&state->af, sizeof(uint16_t), 1, sna_file);
-    fread(&state->r, sizeof(uint8_t), 1, sna_file);
+    uint8_t border;
+    fread(&border, sizeof(uint8_t), 1, sna_file);
+    machine->border = border & 0x07;
 
     // Read RAM (48 KB from 0x4000 to 0xFFFF)
-    size_t bytes_read = fread(&memory[0x4000], 1, 0xC000, sna_file);
+    size_t bytes_read = 0;
+    for (int slot = 1; slot < MEM_SLOTS; slot++)
+      bytes_read += fread(machine->memory.write_map[slot], 1, MEM_SLOT_SIZE, sna_file);
     if (bytes_read != 0xC000) {
         fprintf(stderr, "Partial SNA read: only %zu bytes read\n", bytes_read);
         fclose(sna_file);
@@ -186,7 +265,7 @@ bool load_z80_snapshot(const char* filename, Z80_State* state) {
     fclose(sna_file);
 
     // Fix PC: it's stored at the top of the stack
-    state->pc = memory[state->sp] | (memory[state->sp + 1] << 8);
+    state->pc = mem_read16(machine, state->sp);
     state->sp += 2;  // Adjust SP to pop the stored PC
 
     printf("Loaded SNA snapshot successfully\n");
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include "zx_spectrum.h"
 
-bool load_rom(const char* filename);
-bool load_z80_snapshot(const char* filename, Z80_State* state);
-bool load_sna(const char* filename, Z80_State* state);
\ No newline at end of file
+// A 16K ROM selects the 48K model, a 32K one the 128K
+bool load_rom(const char* filename, ZX_Machine* machine);
+bool load_z80_snapshot(const char* filename, ZX_Machine* machine);
+bool load_sna(const char* filename, ZX_Machine* machine);
\ No newline at end of file
@@ -0,0 +1,49 @@
+/* machine.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+#include "z80.h"
+#include "ula.h"
+
+ZX_Machine* machine_create(void) {
+  ZX_Machine* machine = calloc(1, sizeof(ZX_Machine));
+  if (!machine) {
+    printf("Error: Unable to allocate machine\n");
+    return NULL;
+  }
+
+  mem_set_model(machine, ZX_MODEL_48K);
+  machine_reset(machine);
+  return machine;
+}
+
+void machine_reset(ZX_Machine* machine) {
+  // Registers z80_init leaves alone are cleared too, so nothing carries
+  // over from whatever ran before
+  memset(&machine->cpu, 0, sizeof(machine->cpu));
+  z80_init(&machine->cpu);
+  machine->cpu.machine = machine;
+
+  memset(machine->memory.ram, 0, sizeof(machine->memory.ram));
+  mem_set_model(machine, mem_get_model(machine));
+  z80_flush_block_cache(&machine->cpu);
+  machine->border = 0;
+  memset(machine->keyboard, 0, sizeof(machine->keyboard));
+  beeper_init(&machine->beeper, machine->cpu.cycles);
+  machine->frame_count = 0;
+  memset(&machine->ula, 0, sizeof(machine->ula));
+  machine->ula_line = 0;
+  machine->frame_number = 0;
+  machine->frame_flash = false;
+  memset(&machine->render_stats, 0, sizeof(machine->render_stats));
+  ula_init(&machine->cpu);
+}
+
+void machine_destroy(ZX_Machine* machine) {
+  if (!machine)
+    return;
+  z80_free_block_cache(&machine->cpu);
+  free(machine);
+}
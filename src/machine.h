@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include "zx_spectrum.h"
+#include "memory.h"
+#include "ula.h"
+#include "beeper.h"
+
+// One emulated Spectrum: the CPU and everything it is wired to. Nothing a
+// running machine touches is global, so any number of them can run in one
+// process, each on one thread at a time.
+struct ZX_Machine {
+    Z80_State cpu;
+    ZX_Memory memory;
+
+    // Border colour, bits 0-2 of the last write to the ULA port
+    uint8_t border;
+    // Keys held down in each half-row of the keyboard matrix, bit n for
+    // key n (ula_set_key)
+    uint8_t keyboard[8];
+    // Speaker, driven by bit 4 of the ULA port
+    ZX_Beeper beeper;
+    // Frame interrupts since the machine was created
+    uint32_t frame_count;
+    // Lines fetched by the ULA, and the next one it will fetch. Between
+    // frames (when z80_run returns at a frame boundary) it holds the last
+    // complete frame.
+    ULA_Frame ula;
+    int ula_line;
+
+    // Block cache (and JIT code) of the cached dispatchers, allocated by
+    // z80.c the first time one of them runs on this machine
+    struct Z80_BlockCache* block_cache;
+
+    // Picture drawn by ula_render, ARGB8888, with the number and flash
+    // phase of the ULA frame it shows
+    uint32_t frame[FRAME_WIDTH * FRAME_HEIGHT];
+    uint32_t frame_number;
+    bool frame_flash;
+    ULA_RenderStats render_stats;
+};
+
+// Allocate a 48K machine with the CPU reset and the ULA interrupt running.
+// Returns NULL if out of memory.
+ZX_Machine* machine_create(void);
+// Power-on reset: CPU and RAM cleared, paging and cached code dropped. The
+// ROM and model are kept.
+void machine_reset(ZX_Machine* machine);
+void machine_destroy(ZX_Machine* machine);
@@ -9,309 +9,559 @@
 #include "z80.h"
 #include "loader.h"
 #include "memory.h"
+#include "machine.h"
+#include "ula.h"
+#include "beeper.h"
 
 //#define DEBUG
+// Report the time display_update spends getting each frame into the texture
+//#define DEBUG_UPLOAD_TIME
+// Report the time from each key event to the frame it is applied in
+//#define DEBUG_INPUT_LATENCY
+// Report the audio ring's fill level and the beeper's output rate
+//#define DEBUG_AUDIO_RATE
 #define DEBUG_TICK_SPEED
 #define LOGGING_INTERVAL_FAST  100
 #define LOGGING_INTERVAL_MID   500
 #define LOGGING_INTERVAL_SLOW 1000
 
 
-extern uint8_t memory[MEM_SIZE];
 
-SDL_Window* window = NULL;
-SDL_Renderer* renderer = NULL;
-SDL_Texture* texture = NULL;
-uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+// SDL objects of the window showing one machine
+typedef struct {
+  SDL_Window* window;
+  SDL_Renderer* renderer;
+  SDL_Texture* texture;
+  // Number and flash phase of the frame in the texture
+  uint32_t frame_number;
+  bool frame_flash;
+  // DEBUG_UPLOAD_TIME: frames shown and performance counter ticks spent
+  // getting them into the texture since the last report
+  uint32_t uploads;
+  uint64_t upload_ticks;
+} Display;
+
+// A finished frame: a copy of the lines the ULA fetched, a fraction of the
+// size of the picture. The display draws the pixels itself, straight into
+// the texture.
+typedef struct {
+  ULA_Frame frame;
+} FrameSlot;
+
+// Triple buffer between the emulation thread and the display. The emulator
+// fills its back slot and swaps it with the middle one; the display swaps
+// its front slot with the middle one when that holds a frame it hasn't
+// shown. Each swap is one atomic exchange, so neither side ever waits for
+// the other and the display always gets the newest frame.
+#define FRAME_FRESH 4   // in middle: the display hasn't taken this frame
+
+typedef struct {
+  FrameSlot slots[3];
+  SDL_atomic_t middle;
+  int back;     // emulation thread only
+  int front;    // display only
+} FrameExchange;
+
+void frame_exchange_init(FrameExchange* exchange) {
+  exchange->back = 0;
+  SDL_AtomicSet(&exchange->middle, 1);
+  exchange->front = 2;
+}
 
-// Spectrum color palette (RGB888)
-const uint32_t palette[16] = { 0xFF000000, 0xFF0000D7, 0xFFD70000,
-                              0xFFD700D7, // Black, Blue, Red, Magenta
-                              0xFF00D700, 0xFF00D7D7, 0xFFD7D700,
-                              0xFFD7D7D7, // Green, Cyan, Yellow, White
-                              0xFF000000, 0xFF0000FF, 0xFFFF0000,
-                              0xFFFF00FF, // Bright variants
-                              0xFF00FF00, 0xFF00FFFF, 0xFFFFFF00, 0xFFFFFFFF };
+// Hand the back slot over as the newest frame and take a free one back
+void frame_publish(FrameExchange* exchange) {
+  SDL_MemoryBarrierRelease();
+  int old = SDL_AtomicSet(&exchange->middle, exchange->back | FRAME_FRESH);
+  exchange->back = old & 3;
+}
 
-void display_init() {
-  SDL_Init(SDL_INIT_VIDEO);
-  window =
-    SDL_CreateWindow("ZX Spectrum Emulator", SDL_WINDOWPOS_UNDEFINED,
-      SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * SCALE_FACTOR,
-      SCREEN_HEIGHT * SCALE_FACTOR, SDL_WINDOW_SHOWN);
+// The newest frame if the display hasn't had it yet, otherwise NULL
+FrameSlot* frame_take(FrameExchange* exchange) {
+  if (!(SDL_AtomicGet(&exchange->middle) & FRAME_FRESH))
+    return NULL;
+  int old = SDL_AtomicSet(&exchange->middle, exchange->front);
+  SDL_MemoryBarrierAcquire();
+  exchange->front = old & 3;
+  return &exchange->slots[exchange->front];
+}
 
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-    SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH,
-    SCREEN_HEIGHT);
+// Host key events on their way from the display thread to the emulation
+// thread, which applies them at frame boundaries. Single producer, single
+// consumer: each side only writes its own index, so pushing and popping
+// never wait or lock.
+#define KEY_QUEUE_SIZE 64   // power of two
+
+typedef struct {
+  uint64_t time;    // SDL performance counter when the event arrived
+  uint8_t key;      // ZX_KEY
+  bool pressed;
+} KeyEvent;
+
+typedef struct {
+  KeyEvent events[KEY_QUEUE_SIZE];
+  SDL_atomic_t head;    // next to pop, written by the consumer
+  SDL_atomic_t tail;    // next to push, written by the producer
+} KeyQueue;
+
+// Returns false if the queue is full
+bool key_queue_push(KeyQueue* queue, KeyEvent event) {
+  int tail = SDL_AtomicGet(&queue->tail);
+  if (tail - SDL_AtomicGet(&queue->head) == KEY_QUEUE_SIZE)
+    return false;
+  queue->events[tail & (KEY_QUEUE_SIZE - 1)] = event;
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&queue->tail, tail + 1);
+  return true;
 }
 
-void display_update(uint8_t* memory) {
-  static uint32_t flash_counter = 0;
-  flash_counter++;
-
-  // Convert Spectrum screen memory to pixels
-  for (int y = 0; y < SCREEN_HEIGHT; y++) {
-    for (int x = 0; x < SCREEN_WIDTH; x++) {
-      // Calculate screen memory address
-      uint16_t addr = 0x4000 | ((y & 0b11000000) << 5) |
-        ((y & 0b00111000) << 2) | ((y & 0b00000111) << 8) |
-        (x >> 3);
-
-      // Get pixel value from bitmap
-      uint8_t byte = memory[addr];
-      uint8_t mask = 0x80 >> (x & 7);
-      bool pixel = byte & mask;
-
-      // Get color attributes
-      uint16_t attr_addr = 0x5800 + ((y >> 3) << 5) + (x >> 3);
-      uint8_t attr = memory[attr_addr];
-
-      // Decode colors
-      uint8_t ink = attr & 0x07;
-      uint8_t paper = (attr >> 3) & 0x07;
-      bool bright = (attr & 0x40) >> 6;
-      bool flash = (attr & 0x80) && (flash_counter & 0x10);
-
-      // Apply brightness and flash
-      if (bright) {
-        ink += 8;
-        paper += 8;
-      }
-      if (flash) {
-        uint8_t temp = ink;
-        ink = paper;
-        paper = temp;
-      }
+// The oldest event, or NULL if the queue is empty
+const KeyEvent* key_queue_peek(KeyQueue* queue) {
+  int head = SDL_AtomicGet(&queue->head);
+  if (head == SDL_AtomicGet(&queue->tail))
+    return NULL;
+  SDL_MemoryBarrierAcquire();
+  return &queue->events[head & (KEY_QUEUE_SIZE - 1)];
+}
 
-      // Set pixel color
-      pixels[y * SCREEN_WIDTH + x] = palette[(pixel ? ink : paper) + (bright ? 8 : 0)];
-    }
-  }
+void key_queue_pop(KeyQueue* queue) {
+  SDL_AtomicAdd(&queue->head, 1);
+}
 
-  // Update SDL texture
-  SDL_UpdateTexture(texture, NULL, pixels, SCREEN_WIDTH * sizeof(uint32_t));
-  SDL_RenderClear(renderer);
-  SDL_RenderCopy(renderer, texture, NULL, NULL);
-  SDL_RenderPresent(renderer);
+// Beeper samples on their way from the emulation thread to the SDL audio
+// callback, single producer and single consumer like KeyQueue. The
+// emulation thread never waits for room: what doesn't fit is dropped, and
+// the callback plays the last sample again when the ring runs dry.
+#define AUDIO_RING_SIZE 8192    // power of two
+#define AUDIO_RATE 48000
+#define AUDIO_DEVICE_SAMPLES 1024
+// Fill level the rate control steers towards, and the largest change of the
+// beeper's output rate it makes to get there
+#define AUDIO_TARGET_FILL (AUDIO_RING_SIZE / 4)
+#define AUDIO_MAX_RATE_ADJUST 0.005
+
+typedef struct {
+  int16_t samples[AUDIO_RING_SIZE];
+  SDL_atomic_t head;    // next to play, written by the callback
+  SDL_atomic_t tail;    // next to fill, written by the emulation thread
+  int16_t last;         // callback only
+} AudioRing;
+
+int audio_ring_fill(AudioRing* ring) {
+  return SDL_AtomicGet(&ring->tail) - SDL_AtomicGet(&ring->head);
 }
 
-// Helper function to convert SDL scancode to ZX Spectrum key value
-uint8_t sdl_scancode_to_zx_key(uint8_t scancode) {
-  // Implement the conversion logic here
-  static const uint8_t keymap[] = {
-      [SDL_SCANCODE_A] = 0x01,[SDL_SCANCODE_B] = 0x02,
-      [SDL_SCANCODE_C] = 0x03,[SDL_SCANCODE_D] = 0x04,
-      [SDL_SCANCODE_E] = 0x05,[SDL_SCANCODE_F] = 0x06,
-      [SDL_SCANCODE_G] = 0x07,[SDL_SCANCODE_H] = 0x08,
-      [SDL_SCANCODE_I] = 0x09,[SDL_SCANCODE_J] = 0x0A,
-      [SDL_SCANCODE_K] = 0x0B,[SDL_SCANCODE_L] = 0x0C,
-      [SDL_SCANCODE_M] = 0x0D,[SDL_SCANCODE_N] = 0x0E,
-      [SDL_SCANCODE_O] = 0x0F,[SDL_SCANCODE_P] = 0x10,
-      [SDL_SCANCODE_Q] = 0x11,[SDL_SCANCODE_R] = 0x12,
-      [SDL_SCANCODE_S] = 0x13,[SDL_SCANCODE_T] = 0x14,
-      [SDL_SCANCODE_U] = 0x15,[SDL_SCANCODE_V] = 0x16,
-      [SDL_SCANCODE_W] = 0x17,[SDL_SCANCODE_X] = 0x18,
-      [SDL_SCANCODE_Y] = 0x19,[SDL_SCANCODE_Z] = 0x1A,
-      [SDL_SCANCODE_1] = 0x1B,[SDL_SCANCODE_2] = 0x1C,
-      [SDL_SCANCODE_3] = 0x1D,[SDL_SCANCODE_4] = 0x1E,
-      [SDL_SCANCODE_5] = 0x1F,[SDL_SCANCODE_6] = 0x20,
-      [SDL_SCANCODE_7] = 0x21,[SDL_SCANCODE_8] = 0x22,
-      [SDL_SCANCODE_9] = 0x23,[SDL_SCANCODE_0] = 0x24,
-      [SDL_SCANCODE_RETURN] = 0x25,[SDL_SCANCODE_SPACE] = 0x26,
-      [SDL_SCANCODE_LSHIFT] = 0x27,[SDL_SCANCODE_RSHIFT] = 0x28,
-      [SDL_SCANCODE_CAPSLOCK] = 0x29,[SDL_SCANCODE_TAB] = 0x2A };
-
-  return keymap[scancode];
+// Returns the number of samples that fitted
+int audio_ring_push(AudioRing* ring, const int16_t* samples, int count) {
+  int tail = SDL_AtomicGet(&ring->tail);
+  int room = AUDIO_RING_SIZE - (tail - SDL_AtomicGet(&ring->head));
+  if (count > room)
+    count = room;
+  for (int i = 0; i < count; i++)
+    ring->samples[(tail + i) & (AUDIO_RING_SIZE - 1)] = samples[i];
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&ring->tail, tail + count);
+  return count;
 }
 
-// Helper function to convert ZX Spectrum key value to row and column
-uint8_t zx_key_to_row(uint8_t key_value) {
-  static const uint8_t rowmap[] = {
-      [0x01] = 0x00,[0x02] = 0x01,[0x03] = 0x02,[0x04] = 0x03,[0x05] = 0x04,
-      [0x06] = 0x05,[0x07] = 0x06,[0x08] = 0x07,[0x09] = 0x08,[0x0A] = 0x09,
-      [0x0B] = 0x0A,[0x0C] = 0x0B,[0x0D] = 0x0C,[0x0E] = 0x0D,[0x0F] = 0x0E,
-      [0x10] = 0x0F,[0x11] = 0x10,[0x12] = 0x11,[0x13] = 0x12,[0x14] = 0x13,
-      [0x15] = 0x14,[0x16] = 0x15,[0x17] = 0x16,[0x18] = 0x17,[0x19] = 0x18,
-      [0x1A] = 0x19,[0x1B] = 0x1A,[0x1C] = 0x1B,[0x1D] = 0x1C,[0x1E] = 0x1D,
-      [0x1F] = 0x1E,[0x20] = 0x1F,[0x21] = 0x20,[0x22] = 0x21,[0x23] = 0x22,
-      [0x24] = 0x23,[0x25] = 0x24,[0x26] = 0x25,[0x27] = 0x26,[0x28] = 0x27,
-      [0x29] = 0x28,[0x2A] = 0x29 };
-  return rowmap[key_value];
+// SDL audio callback, on SDL's audio thread
+void audio_callback(void* data, Uint8* stream, int len) {
+  AudioRing* ring = data;
+  int16_t* out = (int16_t*)stream;
+  int count = len / (int)sizeof(int16_t);
+  int head = SDL_AtomicGet(&ring->head);
+  int available = SDL_AtomicGet(&ring->tail) - head;
+  SDL_MemoryBarrierAcquire();
+  for (int i = 0; i < count; i++) {
+    if (i < available)
+      ring->last = ring->samples[(head + i) & (AUDIO_RING_SIZE - 1)];
+    out[i] = ring->last;
+  }
+  SDL_AtomicSet(&ring->head, head + (available < count ? available : count));
 }
 
-uint8_t zx_key_to_col(uint8_t key_value) {
-  switch (key_value) {
-  case 0x01:
-    return 0x00;
-  case 0x02:
-    return 0x01;
-  case 0x03:
-    return 0x02;
-  case 0x04:
-    return 0x03;
-  case 0x05:
-    return 0x04;
-  case 0x06:
-    return 0x05;
-  case 0x07:
-    return 0x06;
-  case 0x08:
-    return 0x07;
-  case 0x09:
-    return 0x08;
-  case 0x0A:
-    return 0x09;
-  case 0x0B:
-    return 0x0A;
-  case 0x0C:
-    return 0x0B;
-  case 0x0D:
-    return 0x0C;
-  case 0x0E:
-    return 0x0D;
-  case 0x0F:
-    return 0x0E;
-  case 0x10:
-    return 0x0F;
-  case 0x11:
-    return 0x10;
-  case 0x12:
-    return 0x11;
-  case 0x13:
-    return 0x12;
-  case 0x14:
-    return 0x13;
-  case 0x15:
-    return 0x14;
-  case 0x16:
-    return 0x15;
-  case 0x17:
-    return 0x16;
-  case 0x18:
-    return 0x17;
-  case 0x19:
-    return 0x18;
-  case 0x1A:
-    return 0x19;
-  case 0x1B:
-    return 0x1A;
-  case 0x1C:
-    return 0x1B;
-  case 0x1D:
-    return 0x1C;
-  case 0x1E:
-    return 0x1D;
-  case 0x1F:
-    return 0x1E;
-  case 0x20:
-    return 0x1F;
-  case 0x21:
-    return 0x20;
-  case 0x22:
-    return 0x21;
-  case 0x23:
-    return 0x22;
-  case 0x24:
-    return 0x23;
-  case 0x25:
-    return 0x24;
-  case 0x26:
-    return 0x25;
-  case 0x27:
-    return 0x26;
-  case 0x28:
-    return 0x27;
-  case 0x29:
-    return 0x28;
-  case 0x2A:
-    return 0x29;
-  default:
-    return 0;
+// Emulation thread state shared with the display thread
+typedef struct {
+  ZX_Machine* machine;
+  FrameExchange frames;
+  // Run as fast as possible instead of at 50 frames a second
+  bool turbo;
+  // Cleared by the display thread to stop the emulation thread
+  SDL_atomic_t running;
+  // Key events not applied yet
+  KeyQueue keys;
+  // Beeper output; audio_device is 0 when there is no sound
+  AudioRing audio;
+  SDL_AudioDeviceID audio_device;
+  int audio_rate;
+} Emulator;
+
+void display_init(Display* display) {
+  SDL_Init(SDL_INIT_VIDEO);
+  display->window =
+    SDL_CreateWindow("ZX Spectrum Emulator", SDL_WINDOWPOS_UNDEFINED,
+      SDL_WINDOWPOS_UNDEFINED, FRAME_WIDTH * SCALE_FACTOR,
+      FRAME_HEIGHT * SCALE_FACTOR, SDL_WINDOW_SHOWN);
+
+  display->renderer = SDL_CreateRenderer(display->window, -1,
+    SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  display->texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888,
+    SDL_TEXTUREACCESS_STREAMING, FRAME_WIDTH,
+    FRAME_HEIGHT);
+  display->frame_number = 0;
+  display->frame_flash = false;
+  display->uploads = 0;
+  display->upload_ticks = 0;
+}
+
+void display_update(Display* display, const FrameSlot* slot) {
+  const ULA_Frame* frame = &slot->frame;
+#ifdef DEBUG_UPLOAD_TIME
+  uint64_t start = SDL_GetPerformanceCounter();
+#endif
+
+  // Draw only the lines that changed, or all of them if frames were skipped
+  // or nothing has been drawn yet: each band of consecutive changed lines is
+  // locked and drawn into directly. Locked texture memory is write-only, so
+  // the lines are always drawn whole.
+  bool changed[FRAME_HEIGHT];
+  bool all = display->frame_number == 0 || frame->number != display->frame_number + 1;
+  bool flash_changed = frame->flash != display->frame_flash;
+  for (int line = 0; line < FRAME_HEIGHT; line++)
+    changed[line] = all || ula_line_changed(frame, line, flash_changed);
+
+  for (int line = 0; line < FRAME_HEIGHT;) {
+    if (!changed[line]) {
+      line++;
+      continue;
+    }
+    int first = line;
+    while (line < FRAME_HEIGHT && changed[line])
+      line++;
+
+    SDL_Rect rect = { 0, first, FRAME_WIDTH, line - first };
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(display->texture, &rect, &pixels, &pitch) != 0)
+      continue;
+    ula_draw_lines(frame, first, line - first, pixels, pitch);
+    SDL_UnlockTexture(display->texture);
+  }
+  display->frame_number = frame->number;
+  display->frame_flash = frame->flash;
+
+#ifdef DEBUG_UPLOAD_TIME
+  display->upload_ticks += SDL_GetPerformanceCounter() - start;
+  if (++display->uploads == LOGGING_INTERVAL_SLOW) {
+    printf("Upload: %.1f us per frame\n",
+      display->upload_ticks * 1e6 / SDL_GetPerformanceFrequency() / display->uploads);
+    display->uploads = 0;
+    display->upload_ticks = 0;
   }
+#endif
+
+  SDL_RenderClear(display->renderer);
+  SDL_RenderCopy(display->renderer, display->texture, NULL, NULL);
+  SDL_RenderPresent(display->renderer);
 }
 
-void input_handle(Z80_State* state) {
+// Matrix position of each host key, ZX_KEY + 1 so that 0 is no key
+static const uint8_t keymap[SDL_NUM_SCANCODES] = {
+    [SDL_SCANCODE_LSHIFT] = ZX_KEY(0, 0) + 1,[SDL_SCANCODE_Z] = ZX_KEY(0, 1) + 1,
+    [SDL_SCANCODE_X] = ZX_KEY(0, 2) + 1,[SDL_SCANCODE_C] = ZX_KEY(0, 3) + 1,
+    [SDL_SCANCODE_V] = ZX_KEY(0, 4) + 1,
+    [SDL_SCANCODE_A] = ZX_KEY(1, 0) + 1,[SDL_SCANCODE_S] = ZX_KEY(1, 1) + 1,
+    [SDL_SCANCODE_D] = ZX_KEY(1, 2) + 1,[SDL_SCANCODE_F] = ZX_KEY(1, 3) + 1,
+    [SDL_SCANCODE_G] = ZX_KEY(1, 4) + 1,
+    [SDL_SCANCODE_Q] = ZX_KEY(2, 0) + 1,[SDL_SCANCODE_W] = ZX_KEY(2, 1) + 1,
+    [SDL_SCANCODE_E] = ZX_KEY(2, 2) + 1,[SDL_SCANCODE_R] = ZX_KEY(2, 3) + 1,
+    [SDL_SCANCODE_T] = ZX_KEY(2, 4) + 1,
+    [SDL_SCANCODE_1] = ZX_KEY(3, 0) + 1,[SDL_SCANCODE_2] = ZX_KEY(3, 1) + 1,
+    [SDL_SCANCODE_3] = ZX_KEY(3, 2) + 1,[SDL_SCANCODE_4] = ZX_KEY(3, 3) + 1,
+    [SDL_SCANCODE_5] = ZX_KEY(3, 4) + 1,
+    [SDL_SCANCODE_0] = ZX_KEY(4, 0) + 1,[SDL_SCANCODE_9] = ZX_KEY(4, 1) + 1,
+    [SDL_SCANCODE_8] = ZX_KEY(4, 2) + 1,[SDL_SCANCODE_7] = ZX_KEY(4, 3) + 1,
+    [SDL_SCANCODE_6] = ZX_KEY(4, 4) + 1,
+    [SDL_SCANCODE_P] = ZX_KEY(5, 0) + 1,[SDL_SCANCODE_O] = ZX_KEY(5, 1) + 1,
+    [SDL_SCANCODE_I] = ZX_KEY(5, 2) + 1,[SDL_SCANCODE_U] = ZX_KEY(5, 3) + 1,
+    [SDL_SCANCODE_Y] = ZX_KEY(5, 4) + 1,
+    [SDL_SCANCODE_RETURN] = ZX_KEY(6, 0) + 1,[SDL_SCANCODE_L] = ZX_KEY(6, 1) + 1,
+    [SDL_SCANCODE_K] = ZX_KEY(6, 2) + 1,[SDL_SCANCODE_J] = ZX_KEY(6, 3) + 1,
+    [SDL_SCANCODE_H] = ZX_KEY(6, 4) + 1,
+    [SDL_SCANCODE_SPACE] = ZX_KEY(7, 0) + 1,[SDL_SCANCODE_RSHIFT] = ZX_KEY(7, 1) + 1,
+    [SDL_SCANCODE_LCTRL] = ZX_KEY(7, 1) + 1,[SDL_SCANCODE_RCTRL] = ZX_KEY(7, 1) + 1,
+    [SDL_SCANCODE_M] = ZX_KEY(7, 2) + 1,[SDL_SCANCODE_N] = ZX_KEY(7, 3) + 1,
+    [SDL_SCANCODE_B] = ZX_KEY(7, 4) + 1 };
+
+// Runs on the display thread; returns false when the window is closed
+bool input_handle(Emulator* emulator) {
   SDL_Event e;
   while (SDL_PollEvent(&e)) {
     if (e.type == SDL_QUIT)
-      exit(0);
-    // Add keyboard input handling here
-    if (e.type == SDL_KEYDOWN) {
-      uint8_t scancode = e.key.keysym.scancode;
-      uint8_t key_value = sdl_scancode_to_zx_key(scancode);
-      if (key_value != 0) {
-        uint8_t row = zx_key_to_row(key_value);
-        uint8_t col = zx_key_to_col(key_value);
-        memory[0x5c00 + row] |= (1 << col);
+      return false;
+    if ((e.type == SDL_KEYDOWN && !e.key.repeat) || e.type == SDL_KEYUP) {
+      uint8_t key = keymap[e.key.keysym.scancode];
+      if (key != 0) {
+        // Handed to the emulation thread, which owns the machine
+        KeyEvent event = { SDL_GetPerformanceCounter(), key - 1, e.type == SDL_KEYDOWN };
+        if (!key_queue_push(&emulator->keys, event))
+          printf("Warning: Key queue full, key dropped\n");
       }
     }
   }
+  return true;
 }
 
-void display_cleanup() {
-  SDL_DestroyTexture(texture);
-  SDL_DestroyRenderer(renderer);
-  SDL_DestroyWindow(window);
+// Runs on the emulation thread at a frame boundary: apply the key events
+// queued before the frame started. A key released in the same frame it was
+// pressed in is released a frame later, so the program gets to see it.
+void input_apply(Emulator* emulator) {
+  ZX_Machine* machine = emulator->machine;
+  uint64_t frame_start = SDL_GetPerformanceCounter();
+  uint8_t pressed[ZX_KEYS] = { 0 };
+  const KeyEvent* event;
+
+  while ((event = key_queue_peek(&emulator->keys)) && event->time <= frame_start) {
+    if (!event->pressed && pressed[event->key])
+      break;
+    pressed[event->key] = event->pressed;
+    ula_set_key(machine, event->key, event->pressed);
+#ifdef DEBUG_INPUT_LATENCY
+    printf("Input: key %d %s after %.2f ms\n", event->key, event->pressed ? "down" : "up",
+      (double)(frame_start - event->time) * 1000 / SDL_GetPerformanceFrequency());
+#endif
+    key_queue_pop(&emulator->keys);
+  }
+}
+
+// Open the sound output at the rate the beeper runs at; without it the
+// emulator runs silent. Must come before the emulation thread starts.
+void audio_init(Emulator* emulator) {
+  SDL_AudioSpec want, have;
+  SDL_zero(want);
+  want.freq = AUDIO_RATE;
+  want.format = AUDIO_S16SYS;
+  want.channels = 1;
+  want.samples = AUDIO_DEVICE_SAMPLES;
+  want.callback = audio_callback;
+  want.userdata = &emulator->audio;
+
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0 ||
+    !(emulator->audio_device = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+      SDL_AUDIO_ALLOW_FREQUENCY_CHANGE))) {
+    printf("Warning: Unable to open audio, running without sound: %s\n", SDL_GetError());
+    return;
+  }
+  emulator->audio_rate = have.freq;
+  beeper_set_rate(&emulator->machine->beeper, have.freq);
+
+  // Start at the target level so the rate control has nothing to make up
+  static const int16_t silence[AUDIO_TARGET_FILL];
+  audio_ring_push(&emulator->audio, silence, AUDIO_TARGET_FILL);
+  SDL_PauseAudioDevice(emulator->audio_device, 0);
+}
+
+void audio_cleanup(Emulator* emulator) {
+  if (emulator->audio_device)
+    SDL_CloseAudioDevice(emulator->audio_device);
+  emulator->audio_device = 0;
+}
+
+// Runs on the emulation thread after each frame: pass the frame's samples
+// on, then steer the beeper's output rate in proportion to how far the ring
+// is from AUDIO_TARGET_FILL. That makes up for the drift between the frame
+// timer and the sound card's clock without ever waiting for either.
+void audio_update(Emulator* emulator) {
+  ZX_Machine* machine = emulator->machine;
+  int16_t samples[BEEPER_BUFFER_SIZE];
+  int count = beeper_read(&machine->beeper, machine->cpu.cycles, samples, BEEPER_BUFFER_SIZE);
+  if (count > BEEPER_BUFFER_SIZE)
+    count = BEEPER_BUFFER_SIZE;
+  audio_ring_push(&emulator->audio, samples, count);
+
+  int fill = audio_ring_fill(&emulator->audio);
+  double error = (double)(AUDIO_TARGET_FILL - fill) / AUDIO_TARGET_FILL;
+  if (error > 1)
+    error = 1;
+  else if (error < -1)
+    error = -1;
+  double rate = emulator->audio_rate * (1 + AUDIO_MAX_RATE_ADJUST * error);
+  beeper_set_rate(&machine->beeper, rate);
+
+#ifdef DEBUG_AUDIO_RATE
+  if (machine->ula.number % LOGGING_INTERVAL_FAST == 0)
+    printf("Audio: %d samples buffered, beeper at %.1f Hz\n", fill, rate);
+#endif
+}
+
+void display_cleanup(Display* display) {
+  SDL_DestroyTexture(display->texture);
+  SDL_DestroyRenderer(display->renderer);
+  SDL_DestroyWindow(display->window);
   SDL_Quit();
 }
 
-void perform_sleep() {
-  SDL_Delay(2); // TODO: rework this to a more accurate sleep
+// Wait until the next 50 Hz frame deadline. If we fall more than a frame
+// behind (debugger, window drag) resynchronise instead of trying to catch up.
+void frame_sync(uint64_t* next_frame) {
+  uint64_t freq = SDL_GetPerformanceFrequency();
+  uint64_t frame_ticks = freq / FRAMES_PER_SECOND;
+  uint64_t now = SDL_GetPerformanceCounter();
+
+  if (*next_frame == 0 || now > *next_frame + frame_ticks) {
+    *next_frame = now + frame_ticks;
+    return;
+  }
+
+  while (now < *next_frame) {
+    uint64_t remaining_ms = (*next_frame - now) * 1000 / freq;
+    if (remaining_ms > 1)
+      SDL_Delay((uint32_t)(remaining_ms - 1));
+    now = SDL_GetPerformanceCounter();
+  }
+  *next_frame += frame_ticks;
+}
+
+// Run the CPU for one frame's worth of T-states. Overshoot from the last
+// instruction of a frame is carried into the next one.
+void run_frame(Z80_State* state, int* tstates) {
+  *tstates += z80_run(state, FRAME_TSTATES - *tstates);
+  *tstates -= FRAME_TSTATES;
+}
+
+// Emulation thread: run a frame, draw it into the back slot and publish it,
+// at 50 frames a second or, in turbo mode, as fast as the CPU goes
+int emulation_thread(void* data) {
+  Emulator* emulator = data;
+  ZX_Machine* machine = emulator->machine;
+  int tstates = 0;
+  uint64_t next_frame = 0;
+
+  while (SDL_AtomicGet(&emulator->running)) {
+    input_apply(emulator);
+    run_frame(&machine->cpu, &tstates);
+    if (emulator->audio_device)
+      audio_update(emulator);
+
+    // The ULA has fetched every line of the frame by its end
+    FrameSlot* slot = &emulator->frames.slots[emulator->frames.back];
+    slot->frame = machine->ula;
+    frame_publish(&emulator->frames);
+
+#ifdef DEBUG
+    int changed = 0;
+    for (int line = 0; line < FRAME_HEIGHT; line++)
+      changed += ula_line_changed(&machine->ula, line, false);
+    if (machine->ula.number % LOGGING_INTERVAL_SLOW == 0)
+      printf("Screen: %d of %d lines changed in frame %u\n", changed, FRAME_HEIGHT,
+        (unsigned)machine->ula.number);
+#endif
+
+    if (!emulator->turbo)
+      frame_sync(&next_frame);
+  }
+  return 0;
 }
 
 void print_usage(const char* program_name) {
   printf("ZX Spectrum Emulator\n");
-  printf("Usage: %s <rom_file> <z80_snapshot>\n\n", program_name);
-  printf("Example: %s 48.rom game.z80\n", program_name);
+  printf("Usage: %s <snapshot> [--turbo]\n\n", program_name);
+  printf("Example: %s game.z80\n", program_name);
+  printf("Loads a .z80 or .sna snapshot on top of 48.rom from the current directory.\n");
+  printf("--turbo runs the machine as fast as it will go instead of at 50 Hz.\n");
 }
 
 int main(int argc, char* argv[]) {
-  if (argc < 2) {
+  const char* snapshotName = NULL;
+  bool turbo = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--turbo") == 0)
+      turbo = true;
+    else if (!snapshotName)
+      snapshotName = argv[i];
+  }
+  if (!snapshotName) {
     print_usage(argv[0]);
     return RETCODE_INVALID_ARGUMENTS;
   }
 
-  display_init();
+  Display display;
+  display_init(&display);
 
-  Z80_State z80_state;
-  z80_init(&z80_state);
+  ZX_Machine* machine = machine_create();
+  if (!machine) {
+    display_cleanup(&display);
+    return 1;
+  }
 
   const char* romName = "48.rom";
-  const char* snapshotName = argv[1];
 
-  if (!load_rom(romName)) {
-    display_cleanup();
+  if (!load_rom(romName, machine)) {
+    display_cleanup(&display);
+    machine_destroy(machine);
     printf("Error: Unable to load ROM\n");
     return RETCODE_ROM_LOADING_FAILED;
   }
 
   char* snapshotExt = strrchr(snapshotName, '.');
   if (snapshotExt && (strcmp(snapshotExt, ".z80") == 0)) {
-    if (!load_z80_snapshot(snapshotName, &z80_state)) {
-      display_cleanup();
+    if (!load_z80_snapshot(snapshotName, machine)) {
+      display_cleanup(&display);
+      machine_destroy(machine);
       printf("Error: Unable to load Z80 Snapshot\n");
       return RETCODE_Z80_SNAPSHOT_LOADING_FAILED;
     }
   } else if (snapshotExt && (strcmp(snapshotExt, ".sna") == 0)) {
-    if (!load_sna(snapshotName, &z80_state)) {
-      display_cleanup();
+    if (!load_sna(snapshotName, machine)) {
+      display_cleanup(&display);
+      machine_destroy(machine);
       printf("Error: Unable to load SNA snapshot\n");
       return RETCODE_Z80_SNAPSHOT_LOADING_FAILED;
     }
   } else {
-    display_cleanup();
+    display_cleanup(&display);
+    machine_destroy(machine);
     printf("Error: Unknown snapshot format (%s)\n", snapshotExt);
     return RETCODE_Z80_SNAPSHOT_LOADING_FAILED;
   }
 
-  while (1) {
-    input_handle(&z80_state);
-    display_update(memory);
-    z80_step(&z80_state);
-    //perform_sleep();
+  // The machine belongs to the emulation thread from here on; this thread
+  // handles the window and shows whatever frame is newest
+  Emulator* emulator = calloc(1, sizeof(Emulator));
+  if (!emulator) {
+    display_cleanup(&display);
+    machine_destroy(machine);
+    printf("Error: Unable to allocate frame buffers\n");
+    return 1;
+  }
+  emulator->machine = machine;
+  emulator->turbo = turbo;
+  frame_exchange_init(&emulator->frames);
+  SDL_AtomicSet(&emulator->running, 1);
+  audio_init(emulator);
+
+  SDL_Thread* thread = SDL_CreateThread(emulation_thread, "emulation", emulator);
+  if (!thread) {
+    audio_cleanup(emulator);
+    display_cleanup(&display);
+    machine_destroy(machine);
+    free(emulator);
+    printf("Error: Unable to start emulation thread: %s\n", SDL_GetError());
+    return 1;
   }
 
-  display_cleanup();
+  while (input_handle(emulator)) {
+    FrameSlot* frame = frame_take(&emulator->frames);
+    if (frame)
+      display_update(&display, frame);
+    else
+      SDL_Delay(1);
+  }
+
+  SDL_AtomicSet(&emulator->running, 0);
+  SDL_WaitThread(thread, NULL);
+  audio_cleanup(emulator);
+  free(emulator);
+  display_cleanup(&display);
+  machine_destroy(machine);
   return RETCODE_NO_ERROR;
-}
\ No newline at end of file
+}
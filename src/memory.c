@@ -1,34 +1,321 @@
+#include <string.h>
+
 #include "memory.h"
+#include "machine.h"
+#include "z80.h"
+#include "ula.h"
+
+#define SLOT(mem, addr) (mem)->read_map[((addr) >> MEM_SLOT_SHIFT) & (MEM_SLOTS - 1)][(addr) & MEM_SLOT_MASK]
+#define WRITE_SLOT(mem, addr) (mem)->write_map[((addr) >> MEM_SLOT_SHIFT) & (MEM_SLOTS - 1)][(addr) & MEM_SLOT_MASK]
+#define CONTENDED(mem, addr) UNLIKELY((mem)->contended[((addr) >> MEM_SLOT_SHIFT) & (MEM_SLOTS - 1)])
+#define FLAGGED(mem, addr) UNLIKELY((mem)->write_flags[((addr) >> MEM_SLOT_SHIFT) & (MEM_SLOTS - 1)])
 
-uint8_t memory[MEM_SIZE] = { 0 };
+// Keeps the uncontended path of the accessors free of taken branches
+#if defined(__GNUC__)
+#define UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define UNLIKELY(x) (x)
+#endif
 
+// Offset of a byte in the screen bank, out of range (unsigned) for any other
+#define SCREEN_OFFSET(mem, ptr) ((uintptr_t)(ptr) - (uintptr_t)(mem)->screen)
+
+  // Mark the cell of the display file byte at offset: one pixel row for a
+  // bitmap byte, all 8 of its character row for an attribute
+  static inline void mark_screen(ZX_Memory* mem, uint32_t offset) {
+    uint32_t bit = 1u << (offset & 0x1F);
+    if (offset < SCREEN_BITMAP_SIZE) {
+      uint32_t y = ((offset >> 5) & 0xC0) | ((offset >> 2) & 0x38) | ((offset >> 8) & 0x07);
+      mem->screen_dirty[y] |= bit;
+      return;
+    }
+    uint32_t* row = &mem->screen_dirty[((offset - SCREEN_BITMAP_SIZE) >> 5) * 8];
+    for (int i = 0; i < 8; i++)
+      row[i] |= bit;
+  }
 
-uint8_t mem_read(uint32_t addr) {
-    return memory[addr];
+  // Hold the CPU up for an access to contended memory offset T-states into
+  // the current instruction. Past the end of the frame (the last instruction
+  // of a frame, or loaders between runs) nothing is contended.
+  static inline void contend(ZX_Machine* machine, int offset) {
+    Z80_State* state = &machine->cpu;
+    uint64_t t = state->cycles + state->pass_cycles + offset - machine->memory.frame_start;
+    if (t < FRAME_TSTATES)
+      state->pass_cycles += machine->memory.contention[t];
+  }
+
+  // Offset of the next access into the instruction, moving past a machine
+  // cycle of length T-states
+  static inline int next_access(ZX_Machine* machine, int length) {
+    int offset = machine->cpu.access_cycles;
+    machine->cpu.access_cycles = offset + length;
+    return offset;
+  }
+
+  // The work a flagged slot adds to a write to addr, after the store
+  static void write_flagged(ZX_Machine* machine, uint32_t addr, int offset) {
+    ZX_Memory* mem = &machine->memory;
+    uint8_t flags = mem->write_flags[(addr >> MEM_SLOT_SHIFT) & (MEM_SLOTS - 1)];
+    addr &= MEM_SIZE - 1;
+    if (flags & SLOT_CONTENDED)
+      contend(machine, offset);
+    if (flags & SLOT_SCREEN) {
+      uintptr_t screen = SCREEN_OFFSET(mem, &WRITE_SLOT(mem, addr));
+      if (screen < SCREEN_FILE_SIZE)
+        mark_screen(mem, screen);
+    }
+    if ((flags & SLOT_CODE) && mem->code_pages[addr >> CODE_PAGE_SHIFT])
+      z80_invalidate_code(&machine->cpu, addr);
+  }
+
+uint8_t mem_fetch(ZX_Machine* machine, uint32_t addr) {
+    ZX_Memory* mem = &machine->memory;
+    int offset = next_access(machine, 4);
+    // Every M1 cycle puts the next refresh address out, counting up R
+    machine->cpu.r = (machine->cpu.r & 0x80) | ((machine->cpu.r + 1) & 0x7F);
+    if (CONTENDED(mem, addr))
+      contend(machine, offset);
+    return SLOT(mem, addr);
+  }
+
+  uint8_t mem_read(ZX_Machine* machine, uint32_t addr) {
+    ZX_Memory* mem = &machine->memory;
+    int offset = next_access(machine, 3);
+    if (CONTENDED(mem, addr))
+      contend(machine, offset);
+    return SLOT(mem, addr);
   }
   
-  uint16_t mem_read16(uint32_t addr) {
-    return (memory[addr + 1] << 8) | memory[addr];
+  uint16_t mem_read16(ZX_Machine* machine, uint32_t addr) {
+    ZX_Memory* mem = &machine->memory;
+    int offset = next_access(machine, 6);
+    if (CONTENDED(mem, addr))
+      contend(machine, offset);
+    if (CONTENDED(mem, addr + 1))
+      contend(machine, offset + 3);
+    return (SLOT(mem, addr + 1) << 8) | SLOT(mem, addr);
+  }
+
+  uint8_t mem_peek(ZX_Machine* machine, uint32_t addr) {
+    return SLOT(&machine->memory, addr);
   }
   
-  void mem_write(uint32_t addr, uint8_t value) {
-    if (addr >= MEM_SIZE) return;
-    memory[addr] = value;
+  void mem_write(ZX_Machine* machine, uint32_t addr, uint8_t value) {
+    ZX_Memory* mem = &machine->memory;
+    int offset = next_access(machine, 3);
+    WRITE_SLOT(mem, addr) = value;
+    if (FLAGGED(mem, addr))
+      write_flagged(machine, addr, offset);
   }
   
-  void mem_write16(uint32_t addr, uint8_t value) {
-    if (addr >= MEM_SIZE) return;
-    memory[addr + 1] = value >> 8;
-    memory[addr] = value & 0xFF;
+  void mem_write16(ZX_Machine* machine, uint32_t addr, uint16_t value) {
+    ZX_Memory* mem = &machine->memory;
+    int offset = next_access(machine, 6);
+    WRITE_SLOT(mem, addr + 1) = value >> 8;
+    WRITE_SLOT(mem, addr) = value & 0xFF;
+    if (FLAGGED(mem, addr))
+      write_flagged(machine, addr, offset);
+    if (FLAGGED(mem, addr + 1))
+      write_flagged(machine, addr + 1, offset + 3);
+  }
+
+  void mem_mark_code(ZX_Machine* machine, uint16_t addr) {
+    machine->memory.code_pages[addr >> CODE_PAGE_SHIFT] = 1;
+    machine->memory.write_flags[addr >> MEM_SLOT_SHIFT] |= SLOT_CODE;
+  }
+
+  void mem_clear_code(ZX_Machine* machine) {
+    ZX_Memory* mem = &machine->memory;
+    memset(mem->code_pages, 0, sizeof(mem->code_pages));
+    for (int slot = 0; slot < MEM_SLOTS; slot++)
+      mem->write_flags[slot] &= ~SLOT_CODE;
   }
   
-  uint8_t input_port(Z80_State* state, uint8_t port) {
-    return mem_read(port);
+  void mem_load(ZX_Machine* machine, uint32_t addr, const uint8_t* data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++)
+      mem_write(machine, addr + i, data[i]);
+  }
+
+  // Drop cached code from every marked page in [addr, addr + len)
+  static void invalidate_range(ZX_Machine* machine, uint32_t addr, uint32_t len) {
+    for (uint32_t page = addr >> CODE_PAGE_SHIFT; page <= (addr + len - 1) >> CODE_PAGE_SHIFT; page++) {
+      if (machine->memory.code_pages[page])
+        z80_invalidate_code(&machine->cpu, page << CODE_PAGE_SHIFT);
+    }
+  }
+
+  // Keeps SLOT_CODE, which only the block cache sets and clears
+  static void update_write_flags(ZX_Memory* mem, int slot) {
+    uint8_t flags = mem->write_flags[slot] & SLOT_CODE;
+    if (mem->contended[slot])
+      flags |= SLOT_CONTENDED;
+    if (mem->write_map[slot] == mem->screen)
+      flags |= SLOT_SCREEN;
+    mem->write_flags[slot] = flags;
+  }
+
+  static void map_slot(ZX_Machine* machine, int slot, uint8_t* read, uint8_t* write) {
+    ZX_Memory* mem = &machine->memory;
+    if (mem->read_map[slot] == read && mem->write_map[slot] == write)
+      return;
+    mem->read_map[slot] = read;
+    mem->write_map[slot] = write;
+    mem->contended[slot] = false;
+    for (int bank = 1; bank < RAM_BANKS; bank += 2) {
+      if (read == mem->ram[bank])
+        mem->contended[slot] = true;
+    }
+    update_write_flags(mem, slot);
+    // Cached blocks are keyed by address, so whatever ran from here is gone
+    invalidate_range(machine, slot << MEM_SLOT_SHIFT, MEM_SLOT_SIZE);
+  }
+
+  static void set_screen(ZX_Machine* machine, uint8_t* screen) {
+    if (machine->memory.screen == screen)
+      return;
+    machine->memory.screen = screen;
+    for (int slot = 0; slot < MEM_SLOTS; slot++)
+      update_write_flags(&machine->memory, slot);
+    mem_mark_screen(machine);
+  }
+
+  // Delay of a contended access at each T-state of the frame: the ULA reads
+  // two bitmap and two attribute bytes in every 8 T-states of a screen line
+  // and lets the CPU in at the end of the group
+  static void init_contention(ZX_Memory* mem) {
+    static const uint8_t pattern[8] = { 6, 5, 4, 3, 2, 1, 0, 0 };
+    memset(mem->contention, 0, sizeof(mem->contention));
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+      uint8_t* line = &mem->contention[CONTENTION_START + y * LINE_TSTATES];
+      for (int t = 0; t < CONTENDED_TSTATES; t++)
+        line[t] = pattern[t & 7];
+    }
+  }
+
+  // The 128K layout is the same as the 48K one with paging at its reset state
+  void mem_set_model(ZX_Machine* machine, int model) {
+    ZX_Memory* mem = &machine->memory;
+    mem->model = model;
+    init_contention(mem);
+    mem->paging = 0;
+    map_slot(machine, 0, mem->rom[0], mem->rom_sink);
+    map_slot(machine, 1, mem->ram[5], mem->ram[5]);
+    map_slot(machine, 2, mem->ram[2], mem->ram[2]);
+    map_slot(machine, 3, mem->ram[0], mem->ram[0]);
+    set_screen(machine, mem->ram[5]);
+    // The banks may have been reloaded behind mem_write's back
+    mem_mark_screen(machine);
+  }
+
+  int mem_get_model(ZX_Machine* machine) {
+    return machine->memory.model;
+  }
+
+  void mem_page(ZX_Machine* machine, uint8_t val) {
+    ZX_Memory* mem = &machine->memory;
+    if (mem->model != ZX_MODEL_128K || (mem->paging & 0x20))
+      return;
+    mem->paging = val;
+    map_slot(machine, 0, mem->rom[(val >> 4) & 1], mem->rom_sink);
+    map_slot(machine, 3, mem->ram[val & 7], mem->ram[val & 7]);
+    set_screen(machine, mem->ram[(val & 0x08) ? 7 : 5]);
+  }
+
+  uint8_t* mem_screen(ZX_Machine* machine) {
+    return machine->memory.screen;
+  }
+
+  void mem_mark_screen(ZX_Machine* machine) {
+    memset(machine->memory.screen_dirty, 0xFF, sizeof(machine->memory.screen_dirty));
+  }
+
+  bool mem_copy(ZX_Machine* machine, uint32_t dst, uint32_t src, uint32_t len, bool down) {
+    uint8_t* to = &WRITE_SLOT(&machine->memory, dst);
+    const uint8_t* from = &SLOT(&machine->memory, src);
+
+    // Compare the banks rather than the addresses: the same RAM bank can be
+    // paged in at two of them
+    uintptr_t ahead = down ? (uintptr_t)from - (uintptr_t)to : (uintptr_t)to - (uintptr_t)from;
+    if (ahead == 1)
+      memset(to, down ? from[len - 1] : from[0], len);
+    else if (ahead != 0 && ahead < len)
+      return false;
+    else
+      memmove(to, from, len);
+
+    // Mark whatever part of the display file the copy landed on
+    intptr_t first = (intptr_t)to - (intptr_t)machine->memory.screen;
+    intptr_t end = first + len;
+    for (intptr_t offset = first < 0 ? 0 : first; offset < end && offset < SCREEN_FILE_SIZE; offset++)
+      mark_screen(&machine->memory, offset);
+    invalidate_range(machine, dst, len);
+    return true;
+  }
+
+  uint32_t mem_find(ZX_Machine* machine, uint32_t addr, uint8_t val, uint32_t len, bool down) {
+    const uint8_t* start = &SLOT(&machine->memory, addr);
+    if (!down) {
+      const uint8_t* found = memchr(start, val, len);
+      return found ? (uint32_t)(found - start) : len;
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+      if (start[len - 1 - i] == val)
+        return i;
+    }
+    return len;
+  }
+
+  // Delay over the 4 T-states of an I/O cycle: a ULA port is held up at its
+  // first and second T-state if the high byte is contended too, otherwise
+  // at the second; other ports with a contended high byte at all four. The
+  // cycle starts offset T-states into the instruction.
+  static void contend_port(ZX_Machine* machine, uint16_t port, int offset) {
+    ZX_Memory* mem = &machine->memory;
+    bool high = CONTENDED(mem, port);
+    bool ula = !(port & 0x0001);
+    if (!high && !ula)
+      return;
+
+    Z80_State* state = &machine->cpu;
+    uint64_t t = state->cycles + state->pass_cycles + offset - mem->frame_start;
+    if (t >= FRAME_TSTATES - 8)
+      return;
+    int delay = 0;
+    if (ula) {
+      if (high)
+        delay += mem->contention[t];
+      delay += mem->contention[t + delay + 1];
+    } else {
+      for (int i = 0; i < 4; i++)
+        delay += mem->contention[t + delay + i];
+    }
+    state->pass_cycles += delay;
+  }
+
+  uint8_t input_port(ZX_Machine* machine, uint16_t port) {
+    contend_port(machine, port, next_access(machine, 4));
+    // ULA, decoded on A0 low: the keyboard in bits 0-4; bit 6 (EAR) reads 0
+    // with no tape playing, as on an issue 3 board, and the rest read 1
+    if (!(port & 0x0001))
+      return 0xA0 | ula_read_keys(machine, port >> 8);
+    // Nothing else answers: the data bus floats high
+    return 0xFF;
   }
   
-  void output_port(Z80_State* state, uint8_t port, uint8_t val) {
-    // Set the border color
-    memory[0x5800 + (port & 0x1F)] = val;
-    //printf("Port %02X: %02X\n", port, val);
+  void output_port(ZX_Machine* machine, uint16_t port, uint8_t val) {
+    int offset = next_access(machine, 4);
+    contend_port(machine, port, offset);
+    // 128K paging, decoded on A15 and A1 low
+    if (!(port & 0x8002))
+      mem_page(machine, val);
+
+    // ULA, decoded on A0 low: bits 0-2 are the border colour, which the
+    // ULA picks up from the next line it draws, and bit 4 drives the speaker
+    if (!(port & 0x0001)) {
+      machine->border = val & 0x07;
+      Z80_State* state = &machine->cpu;
+      beeper_edge(&machine->beeper, state->cycles + state->pass_cycles + offset, val & 0x10);
+    }
   }
-  
\ No newline at end of file
+  
@@ -1,15 +1,115 @@
 #pragma once
 
 #include "zx_spectrum.h"
+#include <stdbool.h>
 #include <stdint.h>
 
-extern uint8_t memory[MEM_SIZE];
+// The 64K address space is four 16K slots, each with a read and a write
+// pointer into the ROM and RAM banks. Writes to ROM slots go to a sink, so
+// ROM protection takes no test in mem_write, and 128K paging (port 0x7FFD)
+// is a pointer swap.
+#define MEM_SLOT_SHIFT 14
+#define MEM_SLOT_SIZE (1 << MEM_SLOT_SHIFT)
+#define MEM_SLOT_MASK (MEM_SLOT_SIZE - 1)
+#define MEM_SLOTS (MEM_SIZE >> MEM_SLOT_SHIFT)
+#define ROM_BANKS 2
+#define RAM_BANKS 8
 
-// Memory interface
-uint8_t mem_read(uint32_t addr);
-uint16_t mem_read16(uint32_t addr);
-void mem_write(uint32_t addr, uint8_t val);
-void mem_write16(uint32_t addr, uint8_t val);
-uint8_t input_port(Z80_State* state, uint8_t port);
-void output_port(Z80_State* state, uint8_t port, uint8_t val);
+// Pages holding code cached by the Z80 block cache; mem_write hands writes to
+// them to z80_invalidate_code
+#define CODE_PAGE_SHIFT 6
+#define CODE_PAGES (MEM_SIZE >> CODE_PAGE_SHIFT)
+
+// Display file of the screen bank: the bitmap, then one attribute per 8x8
+// character cell
+#define SCREEN_BITMAP_SIZE 0x1800
+#define SCREEN_FILE_SIZE 0x1B00
+#define SCREEN_ROWS (SCREEN_HEIGHT / 8)
+#define SCREEN_COLUMNS (SCREEN_WIDTH / 8)
+
+// ULA contention: while the ULA fetches the screen it holds the CPU up on
+// any access to the RAM banks on its bus, the odd ones (5 at 4000, and on
+// the 128K whichever of 1, 3, 5, 7 is paged in at C000). It fetches during
+// the first CONTENDED_TSTATES of each screen line, from CONTENTION_START on
+// in the frame; the 48K timing is used for both models.
+#define CONTENTION_START (FIRST_SCREEN_LINE * LINE_TSTATES - 1)
+#define CONTENDED_TSTATES 128
+
+// write_flags bits: the slot maps a contended bank, the bank the ULA
+// displays, or code the block cache has recorded
+#define SLOT_CONTENDED 0x01
+#define SLOT_SCREEN 0x02
+#define SLOT_CODE 0x04
+
+// Memory of one machine (ZX_Machine.memory). The maps point into the banks
+// of the same structure, so it can't be copied as a whole; copy the banks
+// and call mem_set_model (and mem_page) instead.
+typedef struct {
+    uint8_t* read_map[MEM_SLOTS];
+    uint8_t* write_map[MEM_SLOTS];
+    int model;
+    uint8_t paging;
+    uint8_t code_pages[CODE_PAGES];
+    // Slots mapping a contended bank, and the delay an access to one takes
+    // at each T-state of the frame. The ULA keeps frame_start, the value of
+    // cpu.cycles the current frame started at.
+    uint8_t contended[MEM_SLOTS];
+    uint8_t contention[FRAME_TSTATES];
+    uint64_t frame_start;
+    // What a write to each slot has to do besides the store (SLOT_*): a slot
+    // with none of these set is written with no other work
+    uint8_t write_flags[MEM_SLOTS];
+    // Bank the ULA displays, and the character cells of each pixel row
+    // whose bitmap or attribute byte was written since the ULA last fetched
+    // the row: bit n for column n
+    uint8_t* screen;
+    uint32_t screen_dirty[SCREEN_HEIGHT];
+    uint8_t rom[ROM_BANKS][MEM_SLOT_SIZE];
+    uint8_t ram[RAM_BANKS][MEM_SLOT_SIZE];
+    // Writes to ROM land here
+    uint8_t rom_sink[MEM_SLOT_SIZE];
+} ZX_Memory;
+
+// Select the 48K or 128K memory map (enum ZX_MODEL) with paging reset
+void mem_set_model(ZX_Machine* machine, int model);
+int mem_get_model(ZX_Machine* machine);
+// Write to the 128K paging port: bits 0-2 RAM bank at C000, bit 3 screen in
+// bank 7, bit 4 ROM, bit 5 locks paging until the model is set again
+void mem_page(ZX_Machine* machine, uint8_t val);
+// Bank the ULA displays (5, or 7 on the 128K when selected)
+uint8_t* mem_screen(ZX_Machine* machine);
+// Mark the whole screen as changed, for anything that writes to the banks
+// without going through mem_write
+void mem_mark_screen(ZX_Machine* machine);
+
+// Memory interface. Accesses from the Z80 to contended memory are delayed
+// by the ULA: the delay for the T-state of the access (cpu.access_cycles
+// into the instruction) is added to cpu.pass_cycles. mem_fetch is the 4
+// T-state opcode fetch (M1), which also counts up R; the others are 3
+// T-state memory cycles.
+uint8_t mem_fetch(ZX_Machine* machine, uint32_t addr);
+uint8_t mem_read(ZX_Machine* machine, uint32_t addr);
+uint16_t mem_read16(ZX_Machine* machine, uint32_t addr);
+void mem_write(ZX_Machine* machine, uint32_t addr, uint8_t val);
+void mem_write16(ZX_Machine* machine, uint32_t addr, uint16_t val);
+// Read that is never held up, for looking at code rather than running it
+uint8_t mem_peek(ZX_Machine* machine, uint32_t addr);
+// Record that the block cache holds code from the 64-byte page of addr, so
+// writes there invalidate it, or that it holds none at all any more
+void mem_mark_code(ZX_Machine* machine, uint16_t addr);
+void mem_clear_code(ZX_Machine* machine);
+// Copy into RAM through the memory map, for the snapshot loaders
+void mem_load(ZX_Machine* machine, uint32_t addr, const uint8_t* data, uint32_t len);
+// Bulk forms for the block instructions, each range within one slot and
+// given by its lowest address. mem_copy copies as LDIR (or with down, LDDR)
+// would, one byte at a time: it returns false without doing anything for
+// overlaps where that differs from memmove, other than the one-byte fill.
+// mem_find returns the offset of the first byte equal to val going up (or
+// down from addr + len - 1), or len if there is none.
+bool mem_copy(ZX_Machine* machine, uint32_t dst, uint32_t src, uint32_t len, bool down);
+uint32_t mem_find(ZX_Machine* machine, uint32_t addr, uint8_t val, uint32_t len, bool down);
+// The ULA holds up accesses to its own ports (A0 low), and to any port whose
+// high byte would be a contended address, like contended memory
+uint8_t input_port(ZX_Machine* machine, uint16_t port);
+void output_port(ZX_Machine* machine, uint16_t port, uint8_t val);
 void z80_int_reti(Z80_State* state);
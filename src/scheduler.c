@@ -0,0 +1,75 @@
+/* scheduler.c */
+#include <stdio.h>
+
+#include "scheduler.h"
+
+static void sift_up(Z80_Scheduler* scheduler, int pos) {
+  Z80_Event event = scheduler->events[pos];
+  while (pos > 0) {
+    int parent = (pos - 1) / 2;
+    if (scheduler->events[parent].time <= event.time)
+      break;
+    scheduler->events[pos] = scheduler->events[parent];
+    pos = parent;
+  }
+  scheduler->events[pos] = event;
+}
+
+static void sift_down(Z80_Scheduler* scheduler, int pos) {
+  Z80_Event event = scheduler->events[pos];
+  for (;;) {
+    int child = pos * 2 + 1;
+    if (child >= scheduler->count)
+      break;
+    if (child + 1 < scheduler->count &&
+      scheduler->events[child + 1].time < scheduler->events[child].time)
+      child++;
+    if (event.time <= scheduler->events[child].time)
+      break;
+    scheduler->events[pos] = scheduler->events[child];
+    pos = child;
+  }
+  scheduler->events[pos] = event;
+}
+
+void scheduler_init(Z80_Scheduler* scheduler) {
+  scheduler->count = 0;
+}
+
+bool scheduler_add(Z80_Scheduler* scheduler, uint64_t time, Z80_EventHandler handler, void* data) {
+  if (scheduler->count == SCHEDULER_MAX_EVENTS) {
+    printf("Error: Event queue full\n");
+    return false;
+  }
+
+  int pos = scheduler->count++;
+  scheduler->events[pos].time = time;
+  scheduler->events[pos].handler = handler;
+  scheduler->events[pos].data = data;
+  sift_up(scheduler, pos);
+  return true;
+}
+
+void scheduler_cancel(Z80_Scheduler* scheduler, Z80_EventHandler handler, void* data) {
+  int kept = 0;
+  for (int i = 0; i < scheduler->count; i++) {
+    Z80_Event* event = &scheduler->events[i];
+    if (event->handler != handler || event->data != data)
+      scheduler->events[kept++] = *event;
+  }
+  if (kept == scheduler->count)
+    return;
+
+  // Rebuild the heap from what is left
+  scheduler->count = kept;
+  for (int pos = kept / 2 - 1; pos >= 0; pos--)
+    sift_down(scheduler, pos);
+}
+
+Z80_Event scheduler_pop(Z80_Scheduler* scheduler) {
+  Z80_Event first = scheduler->events[0];
+  scheduler->events[0] = scheduler->events[--scheduler->count];
+  if (scheduler->count)
+    sift_down(scheduler, 0);
+  return first;
+}
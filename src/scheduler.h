@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cycle-ordered event queue attached to the CPU (Z80_State.scheduler).
+// z80_run only checks it between runs of instructions: it cuts its budget at
+// the earliest pending event, so handlers fire at the first instruction
+// boundary at or after their T-state without any per-instruction polling.
+#define SCHEDULER_MAX_EVENTS 32
+
+struct Z80_State;
+
+// Called with the T-state the event was scheduled for, which may be a few
+// T-states before state->cycles; periodic events should reschedule relative
+// to it so they don't drift.
+typedef void (*Z80_EventHandler)(struct Z80_State* state, uint64_t time, void* data);
+
+typedef struct {
+    uint64_t time;
+    Z80_EventHandler handler;
+    void* data;
+} Z80_Event;
+
+// Binary min-heap on time
+typedef struct {
+    Z80_Event events[SCHEDULER_MAX_EVENTS];
+    int count;
+} Z80_Scheduler;
+
+void scheduler_init(Z80_Scheduler* scheduler);
+// Returns false if the queue is full
+bool scheduler_add(Z80_Scheduler* scheduler, uint64_t time, Z80_EventHandler handler, void* data);
+// Remove every pending event with this handler and data
+void scheduler_cancel(Z80_Scheduler* scheduler, Z80_EventHandler handler, void* data);
+// Remove and return the earliest event; the queue must not be empty
+Z80_Event scheduler_pop(Z80_Scheduler* scheduler);
+
+// T-state of the earliest event, UINT64_MAX if there is none
+static inline uint64_t scheduler_next(const Z80_Scheduler* scheduler) {
+  return scheduler->count ? scheduler->events[0].time : UINT64_MAX;
+}
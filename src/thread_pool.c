@@ -0,0 +1,150 @@
+/* thread_pool.c */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+// Job numbers [next, end) still to run by one worker
+typedef struct {
+  pthread_mutex_t lock;
+  int next;
+  int end;
+} ThreadPoolRun;
+
+typedef struct {
+  ThreadPoolRun* runs;
+  int workers;
+  ThreadPoolJob job;
+  void* data;
+} ThreadPool;
+
+typedef struct {
+  ThreadPool* pool;
+  int index;
+} ThreadPoolWorker;
+
+static bool take_job(ThreadPoolRun* run, int* job) {
+  bool taken = false;
+  pthread_mutex_lock(&run->lock);
+  if (run->next < run->end) {
+    *job = run->next++;
+    taken = true;
+  }
+  pthread_mutex_unlock(&run->lock);
+  return taken;
+}
+
+// Move the back half of the longest other run to this worker and return its
+// first job. Only one lock is held at a time; a thief between the two steps
+// holds jobs nobody else can see, so a worker may give up a little early,
+// but every job still runs exactly once.
+static bool steal_job(ThreadPool* pool, int self, int* job) {
+  for (;;) {
+    int victim = -1;
+    int longest = 0;
+    for (int i = 0; i < pool->workers; i++) {
+      if (i == self)
+        continue;
+      ThreadPoolRun* run = &pool->runs[i];
+      pthread_mutex_lock(&run->lock);
+      int left = run->end - run->next;
+      pthread_mutex_unlock(&run->lock);
+      if (left > longest) {
+        longest = left;
+        victim = i;
+      }
+    }
+    if (victim < 0)
+      return false;
+
+    ThreadPoolRun* run = &pool->runs[victim];
+    int first = 0;
+    int end = 0;
+    pthread_mutex_lock(&run->lock);
+    int left = run->end - run->next;
+    if (left > 0) {
+      end = run->end;
+      first = run->end - (left + 1) / 2;
+      run->end = first;
+    }
+    pthread_mutex_unlock(&run->lock);
+    // Emptied by someone else in the meantime, look again
+    if (left <= 0)
+      continue;
+
+    ThreadPoolRun* own = &pool->runs[self];
+    pthread_mutex_lock(&own->lock);
+    own->next = first + 1;
+    own->end = end;
+    pthread_mutex_unlock(&own->lock);
+    *job = first;
+    return true;
+  }
+}
+
+static void* worker_main(void* arg) {
+  ThreadPoolWorker* worker = arg;
+  ThreadPool* pool = worker->pool;
+  int job;
+
+  while (take_job(&pool->runs[worker->index], &job) ||
+    steal_job(pool, worker->index, &job))
+    pool->job(worker->index, job, pool->data);
+  return NULL;
+}
+
+bool thread_pool_run(int workers, int count, ThreadPoolJob job, void* data) {
+  if (workers < 1)
+    workers = 1;
+
+  ThreadPool pool = { NULL, workers, job, data };
+  pool.runs = calloc(workers, sizeof(ThreadPoolRun));
+  ThreadPoolWorker* info = calloc(workers, sizeof(ThreadPoolWorker));
+  pthread_t* threads = calloc(workers, sizeof(pthread_t));
+  if (!pool.runs || !info || !threads) {
+    printf("Error: Unable to allocate thread pool\n");
+    free(pool.runs);
+    free(info);
+    free(threads);
+    for (int i = 0; i < count; i++)
+      job(0, i, data);
+    return false;
+  }
+
+  for (int i = 0; i < workers; i++) {
+    pthread_mutex_init(&pool.runs[i].lock, NULL);
+    pool.runs[i].next = (int)((long long)count * i / workers);
+    pool.runs[i].end = (int)((long long)count * (i + 1) / workers);
+    info[i].pool = &pool;
+    info[i].index = i;
+  }
+
+  // Worker 0 is this thread
+  int started = 1;
+  bool ok = true;
+  for (; started < workers; started++) {
+    if (pthread_create(&threads[started], NULL, worker_main, &info[started]) != 0) {
+      printf("Error: Unable to start worker thread\n");
+      ok = false;
+      break;
+    }
+  }
+  // The jobs of workers that didn't start get stolen by the others
+  worker_main(&info[0]);
+  for (int i = 1; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  for (int i = 0; i < workers; i++)
+    pthread_mutex_destroy(&pool.runs[i].lock);
+  free(pool.runs);
+  free(info);
+  free(threads);
+  return ok;
+}
+
+int thread_pool_cpus(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (int)cpus : 1;
+}
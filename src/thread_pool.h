@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Work-stealing pool for a fixed set of independent jobs numbered 0 to
+// count - 1. Each worker starts with an equal run of job numbers and takes
+// jobs from its front; a worker that runs dry steals the back half of the
+// longest run left, so a few slow jobs don't leave the other cores idle.
+// Jobs of one worker always run on the same thread, in turn, so per-worker
+// state indexed by worker needs no locking.
+typedef void (*ThreadPoolJob)(int worker, int job, void* data);
+
+// Run every job on workers threads and wait for them all. Returns false if
+// some of the threads couldn't be started; the jobs have still all run, on
+// the threads that could.
+bool thread_pool_run(int workers, int count, ThreadPoolJob job, void* data);
+// Number of CPUs online, at least 1
+int thread_pool_cpus(void);
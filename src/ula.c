@@ -0,0 +1,352 @@
+/* ula.c */
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "ula.h"
+#include "z80.h"
+#include "memory.h"
+#include "machine.h"
+
+#ifdef ULA_HAVE_SIMD
+#include <immintrin.h>
+#endif
+
+// Spectrum color palette (RGB888)
+static const uint32_t palette[16] = { 0xFF000000, 0xFF0000D7, 0xFFD70000,
+                              0xFFD700D7, // Black, Blue, Red, Magenta
+                              0xFF00D700, 0xFF00D7D7, 0xFFD7D700,
+                              0xFFD7D7D7, // Green, Cyan, Yellow, White
+                              0xFF000000, 0xFF0000FF, 0xFFFF0000,
+                              0xFFFF00FF, // Bright variants
+                              0xFF00FF00, 0xFF00FFFF, 0xFFFFFF00, 0xFFFFFFFF };
+
+// Offset of the first bitmap byte of each pixel row in the screen bank
+#define ROW_OFFSET(y) ((((y) & 0xC0) << 5) | (((y) & 0x38) << 2) | (((y) & 0x07) << 8))
+#define ROW_OFFSETS8(y) ROW_OFFSET(y), ROW_OFFSET(y + 1), ROW_OFFSET(y + 2), \
+  ROW_OFFSET(y + 3), ROW_OFFSET(y + 4), ROW_OFFSET(y + 5), ROW_OFFSET(y + 6), \
+  ROW_OFFSET(y + 7)
+#define ROW_OFFSETS64(y) ROW_OFFSETS8(y), ROW_OFFSETS8(y + 8), ROW_OFFSETS8(y + 16), \
+  ROW_OFFSETS8(y + 24), ROW_OFFSETS8(y + 32), ROW_OFFSETS8(y + 40), \
+  ROW_OFFSETS8(y + 48), ROW_OFFSETS8(y + 56)
+
+static const uint16_t row_offset[SCREEN_HEIGHT] = {
+  ROW_OFFSETS64(0), ROW_OFFSETS64(64), ROW_OFFSETS64(128)
+};
+
+// Each bitmap byte as eight pixel masks, leftmost pixel first: all ones
+// where the pixel is ink
+#define PIXEL_MASK(byte, bit) (((byte) >> (bit)) & 1 ? 0xFFFFFFFFu : 0)
+#define PIXEL_MASKS(byte) { PIXEL_MASK(byte, 7), PIXEL_MASK(byte, 6), \
+  PIXEL_MASK(byte, 5), PIXEL_MASK(byte, 4), PIXEL_MASK(byte, 3), \
+  PIXEL_MASK(byte, 2), PIXEL_MASK(byte, 1), PIXEL_MASK(byte, 0) }
+#define PIXEL_MASKS4(byte) PIXEL_MASKS(byte), PIXEL_MASKS(byte + 1), \
+  PIXEL_MASKS(byte + 2), PIXEL_MASKS(byte + 3)
+#define PIXEL_MASKS16(byte) PIXEL_MASKS4(byte), PIXEL_MASKS4(byte + 4), \
+  PIXEL_MASKS4(byte + 8), PIXEL_MASKS4(byte + 12)
+#define PIXEL_MASKS64(byte) PIXEL_MASKS16(byte), PIXEL_MASKS16(byte + 16), \
+  PIXEL_MASKS16(byte + 32), PIXEL_MASKS16(byte + 48)
+
+static const uint32_t pixel_masks[256][8] = {
+  PIXEL_MASKS64(0), PIXEL_MASKS64(64), PIXEL_MASKS64(128), PIXEL_MASKS64(192)
+};
+
+static void ula_int_end(Z80_State* state, uint64_t time, void* data) {
+  (void)time;
+  (void)data;
+  z80_set_int(state, false);
+}
+
+// Fetch a visible line: the border colour as it is now and, on screen
+// lines, the cells written since the line was last fetched
+static void fetch_line(ZX_Machine* machine, int line) {
+  ULA_Line* out = &machine->ula.lines[line];
+  out->border_changed = out->border != machine->border;
+  out->border = machine->border;
+
+  int y = line - BORDER_TOP;
+  if (y < 0 || y >= SCREEN_HEIGHT)
+    return;
+  ZX_Memory* mem = &machine->memory;
+  out->changed = mem->screen_dirty[y];
+  if (!out->changed)
+    return;
+  mem->screen_dirty[y] = 0;
+  const uint8_t* screen = mem_screen(machine);
+  memcpy(out->bitmap, screen + row_offset[y], SCREEN_COLUMNS);
+  memcpy(out->attrs, screen + SCREEN_BITMAP_SIZE + (y >> 3) * SCREEN_COLUMNS, SCREEN_COLUMNS);
+}
+
+static void complete_frame(ZX_Machine* machine) {
+  machine->ula.number++;
+  // Flashing cells swap ink and paper every 16 frames
+  machine->ula.flash = machine->frame_count & 0x10;
+}
+
+// One visible line per event, each when the beam reaches its first screen
+// pixel (or where that would be on a border line). Anything the CPU changes
+// before then shows on the line, anything after on the next.
+static void ula_line(Z80_State* state, uint64_t time, void* data) {
+  ZX_Machine* machine = state->machine;
+  fetch_line(machine, machine->ula_line);
+  if (++machine->ula_line < FRAME_HEIGHT) {
+    scheduler_add(&state->scheduler, time + LINE_TSTATES, ula_line, data);
+    return;
+  }
+  machine->ula_line = 0;
+  complete_frame(machine);
+}
+
+static void ula_frame(Z80_State* state, uint64_t time, void* data) {
+  z80_set_int(state, true);
+  state->machine->memory.frame_start = time;
+  state->machine->frame_count++;
+  scheduler_add(&state->scheduler, time + INT_TSTATES, ula_int_end, data);
+  scheduler_add(&state->scheduler, time + (FIRST_SCREEN_LINE - BORDER_TOP) * LINE_TSTATES,
+    ula_line, data);
+  scheduler_add(&state->scheduler, time + FRAME_TSTATES, ula_frame, data);
+}
+
+void ula_init(Z80_State* state) {
+  scheduler_cancel(&state->scheduler, ula_frame, NULL);
+  scheduler_cancel(&state->scheduler, ula_int_end, NULL);
+  scheduler_cancel(&state->scheduler, ula_line, NULL);
+  z80_set_int(state, false);
+  state->machine->ula_line = 0;
+
+  uint64_t next_frame = (state->cycles / FRAME_TSTATES + 1) * FRAME_TSTATES;
+  state->machine->memory.frame_start = next_frame - FRAME_TSTATES;
+  scheduler_add(&state->scheduler, next_frame, ula_frame, NULL);
+}
+
+void ula_set_key(ZX_Machine* machine, int key, bool pressed) {
+  if (key < 0 || key >= ZX_KEYS)
+    return;
+  uint8_t bit = 1 << (key % 5);
+  if (pressed)
+    machine->keyboard[key / 5] |= bit;
+  else
+    machine->keyboard[key / 5] &= ~bit;
+}
+
+uint8_t ula_read_keys(ZX_Machine* machine, uint8_t high) {
+  uint8_t keys = 0;
+  for (int row = 0; row < 8; row++) {
+    if (!(high & (1 << row)))
+      keys |= machine->keyboard[row];
+  }
+  return ~keys & 0x1F;
+}
+
+void ula_fetch_frame(ZX_Machine* machine) {
+  for (int line = 0; line < FRAME_HEIGHT; line++)
+    fetch_line(machine, line);
+  complete_frame(machine);
+}
+
+// Pixel row kernels: expand a run of cells of one pixel row, given their
+// bitmap bytes and attributes, into 8 pixels each. All of them produce the
+// same output as render_row_scalar.
+typedef void (*RenderRow)(const uint8_t* bitmap, const uint8_t* attrs,
+  const uint32_t* ink, const uint32_t* paper, uint32_t* out, int cells);
+
+// One character cell at a time: a bitmap byte and its attribute give eight
+// pixels, each paper with the ink bits of the mask swapped in
+static void render_row_scalar(const uint8_t* bitmap, const uint8_t* attrs,
+  const uint32_t* ink, const uint32_t* paper, uint32_t* out, int cells) {
+  for (int cell = 0; cell < cells; cell++, out += 8) {
+    const uint32_t* mask = pixel_masks[bitmap[cell]];
+    uint32_t bg = paper[attrs[cell]];
+    uint32_t diff = ink[attrs[cell]] ^ bg;
+    for (int i = 0; i < 8; i++)
+      out[i] = bg ^ (diff & mask[i]);
+  }
+}
+
+#ifdef ULA_HAVE_SIMD
+// The masks come from the byte itself: broadcast it, keep one bit per lane
+// and compare, so no table is read per cell
+
+// Eight pixels as two vectors of four
+static void render_row_sse2(const uint8_t* bitmap, const uint8_t* attrs,
+  const uint32_t* ink, const uint32_t* paper, uint32_t* out, int cells) {
+  const __m128i left_bits = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+  const __m128i right_bits = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+  for (int cell = 0; cell < cells; cell++, out += 8) {
+    __m128i byte = _mm_set1_epi32(bitmap[cell]);
+    __m128i fg = _mm_set1_epi32(ink[attrs[cell]]);
+    __m128i bg = _mm_set1_epi32(paper[attrs[cell]]);
+    __m128i left = _mm_cmpeq_epi32(_mm_and_si128(byte, left_bits), left_bits);
+    __m128i right = _mm_cmpeq_epi32(_mm_and_si128(byte, right_bits), right_bits);
+    _mm_storeu_si128((__m128i*)out,
+      _mm_or_si128(_mm_and_si128(left, fg), _mm_andnot_si128(left, bg)));
+    _mm_storeu_si128((__m128i*)(out + 4),
+      _mm_or_si128(_mm_and_si128(right, fg), _mm_andnot_si128(right, bg)));
+  }
+}
+
+// Sixteen pixels, two cells, per iteration, and an odd cell on its own
+__attribute__((target("avx2")))
+static void render_row_avx2(const uint8_t* bitmap, const uint8_t* attrs,
+  const uint32_t* ink, const uint32_t* paper, uint32_t* out, int cells) {
+  const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+  int cell = 0;
+  for (; cell + 1 < cells; cell += 2, out += 16) {
+    __m256i byte0 = _mm256_set1_epi32(bitmap[cell]);
+    __m256i byte1 = _mm256_set1_epi32(bitmap[cell + 1]);
+    __m256i mask0 = _mm256_cmpeq_epi32(_mm256_and_si256(byte0, bits), bits);
+    __m256i mask1 = _mm256_cmpeq_epi32(_mm256_and_si256(byte1, bits), bits);
+    __m256i pixels0 = _mm256_blendv_epi8(_mm256_set1_epi32(paper[attrs[cell]]),
+      _mm256_set1_epi32(ink[attrs[cell]]), mask0);
+    __m256i pixels1 = _mm256_blendv_epi8(_mm256_set1_epi32(paper[attrs[cell + 1]]),
+      _mm256_set1_epi32(ink[attrs[cell + 1]]), mask1);
+    _mm256_storeu_si256((__m256i*)out, pixels0);
+    _mm256_storeu_si256((__m256i*)(out + 8), pixels1);
+  }
+  if (cell < cells) {
+    __m256i byte = _mm256_set1_epi32(bitmap[cell]);
+    __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+    _mm256_storeu_si256((__m256i*)out, _mm256_blendv_epi8(
+      _mm256_set1_epi32(paper[attrs[cell]]), _mm256_set1_epi32(ink[attrs[cell]]), mask));
+  }
+}
+#endif
+
+// ULA_RENDER_AUTO, or the kernel forced by ula_set_render
+static int render_mode = ULA_RENDER_AUTO;
+
+static bool render_available(int mode) {
+  switch (mode) {
+  case ULA_RENDER_SCALAR:
+    return true;
+#ifdef ULA_HAVE_SIMD
+  case ULA_RENDER_SSE2:
+    return true;
+  case ULA_RENDER_AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+bool ula_set_render(int mode) {
+  if (mode != ULA_RENDER_AUTO && !render_available(mode))
+    return false;
+  render_mode = mode;
+  return true;
+}
+
+int ula_get_render(void) {
+  if (render_mode != ULA_RENDER_AUTO)
+    return render_mode;
+  if (render_available(ULA_RENDER_AVX2))
+    return ULA_RENDER_AVX2;
+  if (render_available(ULA_RENDER_SSE2))
+    return ULA_RENDER_SSE2;
+  return ULA_RENDER_SCALAR;
+}
+
+// Kernel and colours for one call's worth of drawing
+typedef struct {
+    RenderRow render_row;
+    // Ink and paper of every attribute in the flash phase being drawn
+    uint32_t ink[256];
+    uint32_t paper[256];
+} Renderer;
+
+static void renderer_init(Renderer* renderer, bool flash_phase) {
+  renderer->render_row = render_row_scalar;
+#ifdef ULA_HAVE_SIMD
+  switch (ula_get_render()) {
+  case ULA_RENDER_SSE2:
+    renderer->render_row = render_row_sse2;
+    break;
+  case ULA_RENDER_AVX2:
+    renderer->render_row = render_row_avx2;
+    break;
+  }
+#endif
+
+  for (int attr = 0; attr < 256; attr++) {
+    int bright = (attr & 0x40) >> 3;
+    uint32_t fg = palette[(attr & 0x07) | bright];
+    uint32_t bg = palette[((attr >> 3) & 0x07) | bright];
+    bool swap = (attr & 0x80) && flash_phase;
+    renderer->ink[attr] = swap ? bg : fg;
+    renderer->paper[attr] = swap ? fg : bg;
+  }
+}
+
+// Draw a whole line, out pointing at its first pixel
+static void draw_line(const Renderer* renderer, const ULA_Frame* frame, int line, uint32_t* out) {
+  const ULA_Line* fetched = &frame->lines[line];
+  uint32_t border = palette[fetched->border];
+  if (line < BORDER_TOP || line >= BORDER_TOP + SCREEN_HEIGHT) {
+    for (int x = 0; x < FRAME_WIDTH; x++)
+      out[x] = border;
+    return;
+  }
+
+  for (int x = 0; x < BORDER_LEFT; x++) {
+    out[x] = border;
+    out[FRAME_WIDTH - 1 - x] = border;
+  }
+  renderer->render_row(fetched->bitmap, fetched->attrs, renderer->ink, renderer->paper,
+    out + BORDER_LEFT, SCREEN_COLUMNS);
+}
+
+bool ula_line_changed(const ULA_Frame* frame, int line, bool flash_changed) {
+  const ULA_Line* fetched = &frame->lines[line];
+  if (fetched->border_changed || fetched->changed)
+    return true;
+  if (!flash_changed || line < BORDER_TOP || line >= BORDER_TOP + SCREEN_HEIGHT)
+    return false;
+  for (int i = 0; i < SCREEN_COLUMNS; i++) {
+    if (fetched->attrs[i] & 0x80)
+      return true;
+  }
+  return false;
+}
+
+void ula_draw_lines(const ULA_Frame* frame, int first, int count, uint32_t* pixels, int pitch) {
+  Renderer renderer;
+  renderer_init(&renderer, frame->flash);
+  for (int line = first; line < first + count; line++) {
+    draw_line(&renderer, frame, line, pixels);
+    pixels = (uint32_t*)((uint8_t*)pixels + pitch);
+  }
+}
+
+void ula_render(ZX_Machine* machine) {
+  const ULA_Frame* frame = &machine->ula;
+  ULA_RenderStats* stats = &machine->render_stats;
+  stats->frames++;
+  stats->last_lines = 0;
+  if (frame->number == machine->frame_number)
+    return;
+
+  // The changed marks only hold against the frame right before; 0 means
+  // nothing has been drawn yet
+  bool all = machine->frame_number == 0 || frame->number != machine->frame_number + 1;
+  bool flash_changed = frame->flash != machine->frame_flash;
+  Renderer renderer;
+  renderer_init(&renderer, frame->flash);
+
+  for (int line = 0; line < FRAME_HEIGHT; line++) {
+    if (!all && !ula_line_changed(frame, line, false)) {
+      if (!ula_line_changed(frame, line, flash_changed))
+        continue;
+      stats->flash_lines++;
+    }
+    draw_line(&renderer, frame, line, machine->frame + line * FRAME_WIDTH);
+    stats->last_lines++;
+  }
+  stats->lines += stats->last_lines;
+  machine->frame_number = frame->number;
+  machine->frame_flash = frame->flash;
+}
+
+void ula_get_render_stats(ZX_Machine* machine, ULA_RenderStats* stats) {
+  *stats = machine->render_stats;
+}
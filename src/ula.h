@@ -0,0 +1,87 @@
+#pragma once
+
+#include "zx_spectrum.h"
+#include "memory.h"
+
+// Start the 50 Hz frame interrupt: /INT is held for INT_TSTATES from every
+// multiple of FRAME_TSTATES in state->cycles, starting with the next one.
+// From that frame on the ULA also fetches every visible line into
+// machine->ula as the beam reaches it.
+void ula_init(Z80_State* state);
+
+// Keyboard matrix: 8 half-rows of 5 keys. A read of the ULA port selects
+// the half-rows whose bit in the high address byte is low (A8 for half-row
+// 0: CAPS SHIFT, Z, X, C, V) and reads a key held down in any of them as a 0
+// in bits 0-4, bit 0 being the key at the outer end of the half-row.
+#define ZX_KEY(row, bit) ((row) * 5 + (bit))
+#define ZX_KEYS 40
+
+void ula_set_key(ZX_Machine* machine, int key, bool pressed);
+uint8_t ula_read_keys(ZX_Machine* machine, uint8_t high);
+
+// One visible line as the ULA fetched it when the beam got there: the
+// border colour at the time and, on screen lines, the bitmap and attribute
+// bytes. The changed marks compare with the same line of the frame before.
+typedef struct {
+    uint8_t border;
+    bool border_changed;
+    uint32_t changed;       // screen lines: cells fetched anew, bit n for column n
+    uint8_t bitmap[SCREEN_COLUMNS];
+    uint8_t attrs[SCREEN_COLUMNS];
+} ULA_Line;
+
+// A frame's worth of lines, top border first. number counts the frames the
+// ULA has completed, so a reader can tell whether it missed one; flash is the
+// frame's flash phase.
+typedef struct {
+    ULA_Line lines[FRAME_HEIGHT];
+    uint32_t number;
+    bool flash;
+} ULA_Frame;
+
+// Fetch every line of a frame at once from the screen as it is now, for
+// tools that draw without running the CPU
+void ula_fetch_frame(ZX_Machine* machine);
+
+// Draw the last frame the ULA completed into machine->frame. Only the lines
+// that changed since the frame drawn before are drawn again, or all of them
+// if frames were missed.
+void ula_render(ZX_Machine* machine);
+
+// The parts of ula_render, for drawing somewhere else. ula_line_changed says
+// whether a line differs from the frame before, given whether the flash
+// phase changed since then. ula_draw_lines draws count whole lines from
+// first on, with pixels pointing at the first pixel of the first line and
+// pitch bytes from one pixel row to the next.
+bool ula_line_changed(const ULA_Frame* frame, int line, bool flash_changed);
+void ula_draw_lines(const ULA_Frame* frame, int first, int count, uint32_t* pixels, int pitch);
+
+typedef struct {
+    uint64_t frames;        // calls to ula_render
+    uint64_t lines;         // lines drawn, out of FRAME_HEIGHT per frame
+    uint64_t flash_lines;   // lines drawn again only because they flash
+    uint32_t last_lines;    // lines drawn by the last call
+} ULA_RenderStats;
+
+void ula_get_render_stats(ZX_Machine* machine, ULA_RenderStats* stats);
+
+// Pixel expansion kernel used by ula_render. The SIMD kernels are built for
+// x86-64 with GCC or Clang (define ULA_NO_SIMD to leave them out), AVX2 is
+// only used if the CPU has it. By default the fastest available kernel is
+// picked; ula_set_render forces one and returns false if it isn't available.
+// All kernels draw exactly the same picture.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(ULA_NO_SIMD)
+#define ULA_HAVE_SIMD
+#endif
+
+enum ULA_RENDER
+{
+    ULA_RENDER_AUTO = -1,
+    ULA_RENDER_SCALAR = 0,
+    ULA_RENDER_SSE2,
+    ULA_RENDER_AVX2
+};
+
+bool ula_set_render(int mode);
+// The kernel ula_render uses, never ULA_RENDER_AUTO
+int ula_get_render(void);
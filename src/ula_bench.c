@@ -0,0 +1,121 @@
+/* ula_bench.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zx_spectrum.h"
+#include "memory.h"
+#include "machine.h"
+#include "ula.h"
+
+#define DEFAULT_FRAMES 20000
+#define PARTIAL_WRITES 16
+
+static const char* render_names[] = { "scalar", "sse2", "avx2" };
+
+static void print_usage(const char* program_name) {
+  printf("Screen renderer benchmark\n");
+  printf("Usage: %s [frames]\n\n", program_name);
+  printf("Draws a screen of random bitmap and attribute bytes with every pixel\n");
+  printf("kernel this build and CPU have, checks they all draw the same picture\n");
+  printf("and reports the time per frame, fetch included, then the time for\n");
+  printf("frames that change only %d bytes of the screen.\n", PARTIAL_WRITES);
+}
+
+int main(int argc, char* argv[]) {
+  int frames = DEFAULT_FRAMES;
+  if (argc > 2 || (argc == 2 && atoi(argv[1]) <= 0)) {
+    print_usage(argv[0]);
+    return RETCODE_INVALID_ARGUMENTS;
+  }
+  if (argc == 2)
+    frames = atoi(argv[1]);
+
+  ZX_Machine* machine = machine_create();
+  if (!machine)
+    return 1;
+
+  // Fixed seed so every run draws the same screen
+  uint32_t seed = 12345;
+  for (uint16_t addr = 0x4000; addr < 0x5B00; addr++) {
+    seed = seed * 1103515245u + 12345u;
+    mem_write(machine, addr, seed >> 16);
+  }
+
+  static uint32_t reference[2][FRAME_WIDTH * FRAME_HEIGHT];
+  int status = RETCODE_NO_ERROR;
+  double reference_time = 0;
+
+  for (int mode = ULA_RENDER_SCALAR; mode <= ULA_RENDER_AVX2; mode++) {
+    if (!ula_set_render(mode)) {
+      printf("%-6s not available in this build or CPU\n", render_names[mode]);
+      continue;
+    }
+
+    // Both flash phases, so swapped cells are checked too
+    for (int phase = 0; phase < 2; phase++) {
+      machine->frame_count = phase ? 0x10 : 0;
+      memset(machine->frame, 0, sizeof(machine->frame));
+      ula_fetch_frame(machine);
+      // Draw every line, not just the changed ones
+      machine->frame_number = 0;
+      ula_render(machine);
+      if (mode == ULA_RENDER_SCALAR)
+        memcpy(reference[phase], machine->frame, sizeof(machine->frame));
+      else if (memcmp(reference[phase], machine->frame, sizeof(machine->frame)) != 0) {
+        printf("Error: %s kernel differs from %s\n", render_names[mode],
+          render_names[ULA_RENDER_SCALAR]);
+        status = 1;
+      }
+    }
+
+    clock_t start = clock();
+    for (int frame = 0; frame < frames; frame++) {
+      machine->frame_count = frame;
+      mem_mark_screen(machine);
+      ula_fetch_frame(machine);
+      machine->frame_number = 0;
+      ula_render(machine);
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (seconds <= 0)
+      seconds = 1e-9;
+    if (mode == ULA_RENDER_SCALAR)
+      reference_time = seconds;
+
+    printf("%-6s %d frames in %.3f s: %.2f us/frame, %.0f Mpixels/s, %.2fx %s\n",
+      render_names[mode], frames, seconds, seconds / frames * 1e6,
+      (double)frames * FRAME_WIDTH * FRAME_HEIGHT / seconds / 1e6,
+      reference_time / seconds, render_names[ULA_RENDER_SCALAR]);
+  }
+
+  ula_set_render(ULA_RENDER_AUTO);
+  printf("Default kernel: %s\n", render_names[ula_get_render()]);
+
+  // A frame that changes a few bytes costs only the lines they are on, plus
+  // the ones with flashing cells every 16 frames
+  ULA_RenderStats before, after;
+  ula_get_render_stats(machine, &before);
+  clock_t start = clock();
+  for (int frame = 0; frame < frames; frame++) {
+    machine->frame_count = frame;
+    for (int i = 0; i < PARTIAL_WRITES; i++) {
+      seed = seed * 1103515245u + 12345u;
+      mem_write(machine, 0x4000 + (seed >> 16) % 0x1B00, seed >> 8);
+    }
+    ula_fetch_frame(machine);
+    ula_render(machine);
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  if (seconds <= 0)
+    seconds = 1e-9;
+  ula_get_render_stats(machine, &after);
+  uint64_t lines = after.lines - before.lines;
+  printf("%d writes/frame: %.2f us/frame, %.1f of %d lines drawn per frame (%.1f flashing)\n",
+    PARTIAL_WRITES, seconds / frames * 1e6, (double)lines / frames,
+    FRAME_HEIGHT, (double)(after.flash_lines - before.flash_lines) / frames);
+
+  machine_destroy(machine);
+  return status;
+}
@@ -1,7 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "z80.h"
+#include "z80_flag_tables.h"
+#include "z80_jit.h"
 #include "memory.h"
+#include "machine.h"
 
 // Precomputed parity table (even parity)
 static const uint8_t parity_table[256] = {
@@ -15,18 +20,114 @@ static const uint8_t parity_table[256] = {
     0,1,1,0,1,0,0,1,1,0,0,1,0,1,1,0,1,0,0,1,0,1,1,0,0,1,1,0,1,0,0,1
 };
 
-void z80_int_reti(Z80_State* state) {
-    // Pop the PC from the stack
-    uint16_t lo = mem_read(state->sp++);
-    uint16_t hi = mem_read(state->sp++);
-    state->pc = (hi << 8) | lo;
+// Base T-states for unprefixed opcodes (conditional branches not taken)
+static const uint8_t cycles_main[256] = {
+     4,10, 7, 6, 4, 4, 7, 4, 4,11, 7, 6, 4, 4, 7, 4,
+     8,10, 7, 6, 4, 4, 7, 4,12,11, 7, 6, 4, 4, 7, 4,
+     7,10,16, 6, 4, 4, 7, 4, 7,11,16, 6, 4, 4, 7, 4,
+     7,10,13, 6,11,11,10, 4, 7,11,13, 6, 4, 4, 7, 4,
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+     7, 7, 7, 7, 7, 7, 4, 7, 4, 4, 4, 4, 4, 4, 7, 4,
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+     5,10,10,10,10,11, 7,11, 5,10,10, 0,10,17, 7,11,
+     5,10,10,11,10,11, 7,11, 5, 4,10,11,10, 0, 7,11,
+     5,10,10,19,10,11, 7,11, 5, 4,10, 4,10, 0, 7,11,
+     5,10,10, 4,10,11, 7,11, 5, 6,10, 4,10, 0, 7,11
+};
 
-    // Reset the interrupt flag
-    state->iff1 = 0;
-    state->iff2 = 0;
+// T-states for CB-prefixed opcodes, prefix included
+static const uint8_t cycles_cb[256] = {
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,12, 8, 8, 8, 8, 8, 8, 8,12, 8,
+     8, 8, 8, 8, 8, 8,12, 8, 8, 8, 8, 8, 8, 8,12, 8,
+     8, 8, 8, 8, 8, 8,12, 8, 8, 8, 8, 8, 8, 8,12, 8,
+     8, 8, 8, 8, 8, 8,12, 8, 8, 8, 8, 8, 8, 8,12, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8,
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8
+};
+
+// T-states for ED-prefixed opcodes, prefix included (block ops: one iteration)
+static const uint8_t cycles_ed[256] = {
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    12,12,15,20, 8,14, 8, 9,12,12,15,20, 8,14, 8, 9,
+    12,12,15,20, 8,14, 8, 9,12,12,15,20, 8,14, 8, 9,
+    12,12,15,20, 8,14, 8,18,12,12,15,20, 8,14, 8,18,
+    12,12,15,20, 8,14, 8, 8,12,12,15,20, 8,14, 8, 8,
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    16,16,16,16, 8, 8, 8, 8,16,16,16,16, 8, 8, 8, 8,
+    16,16,16,16, 8, 8, 8, 8,16,16,16,16, 8, 8, 8, 8,
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8
+};
+
+// T-states for DD/FD-prefixed opcodes, prefix included
+static const uint8_t cycles_xy[256] = {
+     8,14,11,10, 8, 8,11, 8, 8,15,11,10, 8, 8,11, 8,
+    12,14,11,10, 8, 8,11, 8,16,15,11,10, 8, 8,11, 8,
+    11,14,20,10, 8, 8,11, 8,11,15,20,10, 8, 8,11, 8,
+    11,14,17,10,23,23,19, 8,11,15,17,10, 8, 8,11, 8,
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8,
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8,
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8,
+    19,19,19,19,19,19, 8,19, 8, 8, 8, 8, 8, 8,19, 8,
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8,
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8,
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8,
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8,
+     9,14,14,14,14,15,11,15, 9,14,14, 0,14,21,11,15,
+     9,14,14,15,14,15,11,15, 9, 8,14,15,14, 0,11,15,
+     9,14,14,23,14,15,11,15, 9, 8,14, 8,14, 0,11,15,
+     9,14,14, 8,14,15,11,15, 9,10,14, 8,14, 0,11,15
+};
 
-    // Decrement the stack pointer
-    state->sp -= 2;
+// T-states for DD CB/FD CB-prefixed opcodes, prefixes included
+static const uint8_t cycles_xycb[256] = {
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,
+    20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,
+    20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,
+    20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23
+};
+
+// RETI and RETN: return and restore IFF1 from IFF2. If that re-enables
+// interrupts, end the current run of instructions so z80_run sees an /INT
+// that is still being held.
+void z80_int_reti(Z80_State* state) {
+  state->pc = pop16(state);
+  state->iff1 = state->iff2;
+  if (state->iff1)
+    state->run_exit = 1;
 }
 
 void z80_init(Z80_State* state) {
@@ -34,35 +135,141 @@ void z80_init(Z80_State* state) {
   state->sp = 0xFFFF;
   state->iff1 = state->iff2 = 0;
   state->imode = 0;
+  state->flag_op = FLAGS_VALID;
+  state->int_line = state->nmi_pending = state->ei_delay = 0;
+  state->halted = 0;
+  state->block_op = 0;
+  state->cycles = 0;
+  scheduler_init(&state->scheduler);
+  state->run_exit = state->exit_requested = 0;
+}
+
+// F as left by the last ALU operation, see enum Z80_FLAG_OPS
+static inline uint8_t alu_flags(uint8_t f, int op, uint32_t arg) {
+  switch (op) {
+  case FLAGS_ADD: return szhvc_add[arg];
+  case FLAGS_SUB: return szhvc_sub[arg];
+  // CP takes bits 3 and 5 from the operand rather than the result
+  case FLAGS_CP: return (szhvc_sub[arg] & ~(FLAG_5 | FLAG_3)) | (arg & (FLAG_5 | FLAG_3));
+  case FLAGS_AND: return szp_table[arg] | FLAG_H;
+  case FLAGS_LOGIC: return szp_table[arg];
+  case FLAGS_INC: return (f & FLAG_C) | szhv_inc[arg];
+  case FLAGS_DEC: return (f & FLAG_C) | szhv_dec[arg];
+  }
+  return f;
+}
+
+#ifdef Z80_LAZY_FLAGS
+// Lazy flags: the ALU helpers only record the operation and its table index,
+// F is worked out when an instruction that reads or writes it comes along
+// (see lazy_flag_users) and whenever z80_step/z80_run hand the state back.
+#define ALU_FLAGS(state, op, arg) ((state)->flag_op = (op), (state)->flag_arg = (arg))
+#define SYNC_FLAGS(state) z80_sync_flags(state)
+#define SYNC_FLAGS_FOR(state, opcode) \
+    do { if (lazy_flag_users[opcode]) z80_sync_flags(state); } while (0)
+
+static inline void z80_sync_flags(Z80_State* state) {
+  if (state->flag_op != FLAGS_VALID) {
+    state->f = alu_flags(state->f, state->flag_op, state->flag_arg);
+    state->flag_op = FLAGS_VALID;
+  }
+}
+
+// Main opcodes whose handlers touch F directly (or hand over to a prefixed
+// decoder); the ALU helpers below take care of themselves
+static const uint8_t lazy_flag_users[256] = {
+    0,0,0,0,0,0,0,1,1,1,0,0,0,0,0,1,
+    0,0,0,0,0,0,0,1,0,1,0,0,0,0,0,1,
+    1,0,0,0,0,0,0,1,1,1,0,0,0,0,0,1,
+    1,0,0,0,0,0,0,1,1,1,0,0,0,0,0,1,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    1,0,1,0,1,0,0,0,1,0,1,1,1,0,0,0,
+    1,0,1,0,1,0,0,0,1,0,1,0,1,1,0,0,
+    1,0,1,0,1,0,0,0,1,1,1,0,1,1,0,0,
+    1,1,1,0,1,1,0,0,1,0,1,0,1,1,0,0
+};
+#else
+#define ALU_FLAGS(state, op, arg) ((state)->f = alu_flags((state)->f, (op), (arg)))
+#define SYNC_FLAGS(state)
+#define SYNC_FLAGS_FOR(state, opcode)
+#endif
+
+// Count n M1 cycles into R, whose top bit stays as LD R,A left it.
+// mem_fetch does this for every opcode it fetches; this is for the M1
+// cycles that skip it.
+static inline void add_r(Z80_State* state, int n) {
+  state->r = (state->r & 0x80) | ((state->r + n) & 0x7F);
+}
+
+// 8-bit ALU helpers: every flag update is one load from the generated tables
+static inline void add_a(Z80_State* state, uint8_t val) {
+  ALU_FLAGS(state, FLAGS_ADD, (state->a << 8) | val);
+  state->a += val;
+}
+
+static inline void adc_a(Z80_State* state, uint8_t val) {
+  SYNC_FLAGS(state);
+  int carry = state->f & FLAG_C;
+  ALU_FLAGS(state, FLAGS_ADD, (carry << 16) | (state->a << 8) | val);
+  state->a += val + carry;
 }
 
-static void add_a(Z80_State* state, uint8_t val) {
-  uint16_t res = state->a + val;
-  uint8_t carry = (res > 0xFF) ? FLAG_C : 0;
+static inline void sub_a(Z80_State* state, uint8_t val) {
+  ALU_FLAGS(state, FLAGS_SUB, (state->a << 8) | val);
+  state->a -= val;
+}
+
+static inline void sbc_a(Z80_State* state, uint8_t val) {
+  SYNC_FLAGS(state);
+  int carry = state->f & FLAG_C;
+  ALU_FLAGS(state, FLAGS_SUB, (carry << 16) | (state->a << 8) | val);
+  state->a -= val + carry;
+}
+
+static inline void and_a(Z80_State* state, uint8_t val) {
+  state->a &= val;
+  ALU_FLAGS(state, FLAGS_AND, state->a);
+}
 
-  CLR_FLAG(state, FLAG_N | FLAG_C | FLAG_H);
-  SET_FLAG(state, carry);
-  if (((state->a & 0x0F) + (val & 0x0F)) > 0x0F) SET_FLAG(state, FLAG_H);
+static inline void xor_a(Z80_State* state, uint8_t val) {
+  state->a ^= val;
+  ALU_FLAGS(state, FLAGS_LOGIC, state->a);
+}
 
-  state->a = res & 0xFF;
-  UPDATE_SZP(state, state->a);
+static inline void or_a(Z80_State* state, uint8_t val) {
+  state->a |= val;
+  ALU_FLAGS(state, FLAGS_LOGIC, state->a);
 }
 
-static void sub_a(Z80_State* state, uint8_t val) {
-  uint16_t res = state->a - val;
-  uint8_t carry = (res > 0xFF) ? FLAG_C : 0;
+static inline void cp_a(Z80_State* state, uint8_t val) {
+  ALU_FLAGS(state, FLAGS_CP, (state->a << 8) | val);
+}
 
-  SET_FLAG(state, FLAG_N);
-  CLR_FLAG(state, FLAG_C | FLAG_H);
-  SET_FLAG(state, carry);
-  if (((state->a & 0x0F) - (val & 0x0F)) & 0x10) SET_FLAG(state, FLAG_H);
+// INC/DEC keep C, so any pending flags have to be settled first
+static inline uint8_t inc8(Z80_State* state, uint8_t val) {
+  val++;
+  SYNC_FLAGS(state);
+  ALU_FLAGS(state, FLAGS_INC, val);
+  return val;
+}
 
-  state->a = res & 0xFF;
-  UPDATE_SZP(state, state->a);
+static inline uint8_t dec8(Z80_State* state, uint8_t val) {
+  val--;
+  SYNC_FLAGS(state);
+  ALU_FLAGS(state, FLAGS_DEC, val);
+  return val;
 }
 
 int decode_cb(Z80_State* state) {
-  uint8_t opcode = mem_read(state->pc++);
+  uint8_t opcode = mem_fetch(state->machine, state->pc++);
+  int cycles = cycles_cb[opcode];
   uint8_t temp;
 
   switch (opcode) {
@@ -116,11 +323,11 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x06: // RLC (HL)
-    temp = (mem_read(state->hl) >> 7) & 1;
+    temp = (mem_read(state->machine, state->hl) >> 7) & 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= temp ? FLAG_C : 0;
-    mem_write(state->hl, (mem_read(state->hl) << 1) | temp);
-    UPDATE_SZP(state, mem_read(state->hl));
+    mem_write(state->machine, state->hl, (mem_read(state->machine, state->hl) << 1) | temp);
+    UPDATE_SZP(state, mem_read(state->machine, state->hl));
     break;
 
   case 0x07: // RLC A
@@ -180,11 +387,11 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x0E: // RRC (HL)
-    temp = mem_read(state->hl) & 1;
+    temp = mem_read(state->machine, state->hl) & 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= temp ? FLAG_C : 0;
-    mem_write(state->hl, (mem_read(state->hl) >> 1) | (temp << 7));
-    UPDATE_SZP(state, mem_read(state->hl));
+    mem_write(state->machine, state->hl, (mem_read(state->machine, state->hl) >> 1) | (temp << 7));
+    UPDATE_SZP(state, mem_read(state->machine, state->hl));
     break;
 
   case 0x0F: // RRC A
@@ -244,11 +451,11 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x16: // RL (HL)
-    temp = (mem_read(state->hl) << 1) | (state->f & FLAG_C);
+    temp = (mem_read(state->machine, state->hl) << 1) | (state->f & FLAG_C);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (temp & 0x100) ? FLAG_C : 0;
-    mem_write(state->hl, temp & 0xFF);
-    UPDATE_SZP(state, mem_read(state->hl));
+    mem_write(state->machine, state->hl, temp & 0xFF);
+    UPDATE_SZP(state, mem_read(state->machine, state->hl));
     break;
 
   case 0x17: // RL A
@@ -308,11 +515,11 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x1E: // RR (HL)
-    temp = mem_read(state->hl) & 1;
-    mem_write(state->hl, (mem_read(state->hl) >> 1) | ((state->f & FLAG_C) << 7));
+    temp = mem_read(state->machine, state->hl) & 1;
+    mem_write(state->machine, state->hl, (mem_read(state->machine, state->hl) >> 1) | ((state->f & FLAG_C) << 7));
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= temp ? FLAG_C : 0;
-    UPDATE_SZP(state, mem_read(state->hl));
+    UPDATE_SZP(state, mem_read(state->machine, state->hl));
     break;
 
   case 0x1F: // RR A
@@ -372,11 +579,11 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x26: // SLA (HL)
-    temp = (mem_read(state->hl) >> 7) & 1;
-    mem_write(state->hl, mem_read(state->hl) << 1);
+    temp = (mem_read(state->machine, state->hl) >> 7) & 1;
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) << 1);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= temp ? FLAG_C : 0;
-    UPDATE_SZP(state, mem_read(state->hl));
+    UPDATE_SZP(state, mem_read(state->machine, state->hl));
     break;
 
   case 0x27: // SLA A
@@ -385,6 +592,7 @@ int decode_cb(Z80_State* state) {
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= temp ? FLAG_C : 0;
     UPDATE_SZP(state, state->a);
+    break;
 
   case 0x28: // SRA B
     temp = state->b & 1;
@@ -435,12 +643,12 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x2E: // SRA (HL)
-    temp = mem_read(state->hl) & 1;
-    uint8_t val = mem_read(state->hl);
-    mem_write(state->hl, (val >> 1) | (val & 0x80));
+    temp = mem_read(state->machine, state->hl) & 1;
+    uint8_t val = mem_read(state->machine, state->hl);
+    mem_write(state->machine, state->hl, (val >> 1) | (val & 0x80));
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= temp ? FLAG_C : 0;
-    UPDATE_SZP(state, mem_read(state->hl));
+    UPDATE_SZP(state, mem_read(state->machine, state->hl));
     break;
 
   case 0x2F: // SRA A
@@ -500,12 +708,12 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x36: // SLL (HL)
-    temp = mem_read(state->hl) >> 7;
-    val = mem_read(state->hl);
-    mem_write(state->hl, (val << 1) & 0xFF);
+    temp = mem_read(state->machine, state->hl) >> 7;
+    val = mem_read(state->machine, state->hl);
+    mem_write(state->machine, state->hl, (val << 1) & 0xFF);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= temp ? FLAG_C : 0;
-    UPDATE_SZP(state, mem_read(state->hl));
+    UPDATE_SZP(state, mem_read(state->machine, state->hl));
     break;
 
   case 0x37: // SLL A
@@ -565,9 +773,9 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x3E: // SRL (HL)
-    temp = mem_read(state->hl) & 1;
-    val = mem_read(state->hl) >> 1;
-    mem_write(state->hl, val);
+    temp = mem_read(state->machine, state->hl) & 1;
+    val = mem_read(state->machine, state->hl) >> 1;
+    mem_write(state->machine, state->hl, val);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= temp ? FLAG_C : 0;
     UPDATE_SZP(state, val);
@@ -619,7 +827,7 @@ int decode_cb(Z80_State* state) {
 
   case 0x46: // BIT 0, (HL)
     state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= (mem_read(state->hl) & 0x01) ? 0 : FLAG_Z;
+    state->f |= (mem_read(state->machine, state->hl) & 0x01) ? 0 : FLAG_Z;
     state->f |= FLAG_H;
     break;
 
@@ -667,7 +875,7 @@ int decode_cb(Z80_State* state) {
 
   case 0x4E: // BIT 1, (HL)
     state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= (mem_read(state->hl) & 0x02) ? 0 : FLAG_Z;
+    state->f |= (mem_read(state->machine, state->hl) & 0x02) ? 0 : FLAG_Z;
     state->f |= FLAG_H;
     break;
 
@@ -715,7 +923,7 @@ int decode_cb(Z80_State* state) {
 
   case 0x56: // BIT 2, (HL)
     state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= (mem_read(state->hl) & 0x04) ? 0 : FLAG_Z;
+    state->f |= (mem_read(state->machine, state->hl) & 0x04) ? 0 : FLAG_Z;
     state->f |= FLAG_H;
     break;
 
@@ -763,7 +971,7 @@ int decode_cb(Z80_State* state) {
 
   case 0x5E: // BIT 3, (HL)
     state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= (mem_read(state->hl) & 0x08) ? 0 : FLAG_Z;
+    state->f |= (mem_read(state->machine, state->hl) & 0x08) ? 0 : FLAG_Z;
     state->f |= FLAG_H;
     break;
 
@@ -811,7 +1019,7 @@ int decode_cb(Z80_State* state) {
 
   case 0x66: // BIT 4, (HL)
     state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= (mem_read(state->hl) & 0x10) ? 0 : FLAG_Z;
+    state->f |= (mem_read(state->machine, state->hl) & 0x10) ? 0 : FLAG_Z;
     state->f |= FLAG_H;
     break;
 
@@ -859,7 +1067,7 @@ int decode_cb(Z80_State* state) {
 
   case 0x6e: // BIT 5, (HL)
     state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= (mem_read(state->hl) & 0x20) ? 0 : FLAG_Z;
+    state->f |= (mem_read(state->machine, state->hl) & 0x20) ? 0 : FLAG_Z;
     state->f |= FLAG_H;
     break;
 
@@ -907,7 +1115,7 @@ int decode_cb(Z80_State* state) {
 
   case 0x76: // BIT 6, (HL)
     state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= (mem_read(state->hl) & 0x40) ? 0 : FLAG_Z;
+    state->f |= (mem_read(state->machine, state->hl) & 0x40) ? 0 : FLAG_Z;
     state->f |= FLAG_H;
     break;
 
@@ -955,7 +1163,7 @@ int decode_cb(Z80_State* state) {
 
   case 0x7e: // BIT 7, (HL)
     state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= (mem_read(state->hl) & 0x80) ? 0 : FLAG_Z;
+    state->f |= (mem_read(state->machine, state->hl) & 0x80) ? 0 : FLAG_Z;
     state->f |= FLAG_H;
     break;
 
@@ -990,7 +1198,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x86: // RES 0,(HL)
-    mem_write(state->hl, mem_read(state->hl) & ~(1 << 0));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) & ~(1 << 0));
     break;
 
   case 0x87: // RES 0,A
@@ -1022,7 +1230,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x8e: // RES 1,(HL)
-    mem_write(state->hl, mem_read(state->hl) & ~(1 << 1));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) & ~(1 << 1));
     break;
 
   case 0x8f: // RES 1,A
@@ -1054,7 +1262,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x96: // RES 2,(HL)
-    mem_write(state->hl, mem_read(state->hl) & ~(1 << 2));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) & ~(1 << 2));
     break;
 
   case 0x97: // RES 2,A
@@ -1086,7 +1294,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0x9e: // RES 3,(HL)
-    mem_write(state->hl, mem_read(state->hl) & ~(1 << 3));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) & ~(1 << 3));
     break;
 
   case 0x9f: // RES 3,A
@@ -1118,7 +1326,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xa6: // RES 4,(HL)
-    mem_write(state->hl, mem_read(state->hl) & ~(1 << 4));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) & ~(1 << 4));
     break;
 
   case 0xa7: // RES 4,A
@@ -1150,7 +1358,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xae: // RES 5,(HL)
-    mem_write(state->hl, mem_read(state->hl) & ~(1 << 5));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) & ~(1 << 5));
     break;
 
   case 0xaf: // RES 5,A
@@ -1182,7 +1390,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xb6: // RES 6,(HL)
-    mem_write(state->hl, mem_read(state->hl) & ~(1 << 6));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) & ~(1 << 6));
     break;
 
   case 0xb7: // RES 6,A
@@ -1214,7 +1422,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xbe: // RES 7,(HL)
-    mem_write(state->hl, mem_read(state->hl) & ~(1 << 7));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) & ~(1 << 7));
     break;
 
   case 0xbf: // RES 7,A
@@ -1246,7 +1454,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xc6: // SET 0,(HL)
-    mem_write(state->hl, mem_read(state->hl) | (1 << 0));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) | (1 << 0));
     break;
 
   case 0xc7: // SET 0,A
@@ -1278,7 +1486,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xce: // SET 1,(HL)
-    mem_write(state->hl, mem_read(state->hl) | (1 << 1));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) | (1 << 1));
     break;
 
   case 0xcf: // SET 1,A
@@ -1310,7 +1518,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xd6: // SET 2,(HL)
-    mem_write(state->hl, mem_read(state->hl) | (1 << 2));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) | (1 << 2));
     break;
 
   case 0xd7: // SET 2,A
@@ -1342,7 +1550,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xde: // SET 3,(HL)
-    mem_write(state->hl, mem_read(state->hl) | (1 << 3));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) | (1 << 3));
     break;
 
   case 0xdf: // SET 3,A
@@ -1374,7 +1582,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xe6: // SET 4,(HL)
-    mem_write(state->hl, mem_read(state->hl) | (1 << 4));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) | (1 << 4));
     break;
 
   case 0xe7: // SET 4,A
@@ -1406,7 +1614,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xee: // SET 5,(HL)
-    mem_write(state->hl, mem_read(state->hl) | (1 << 5));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) | (1 << 5));
     break;
 
   case 0xef: // SET 5,A
@@ -1438,7 +1646,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xf6: // SET 6,(HL)
-    mem_write(state->hl, mem_read(state->hl) | (1 << 6));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) | (1 << 6));
     break;
 
   case 0xf7: // SET 6,A
@@ -1470,7 +1678,7 @@ int decode_cb(Z80_State* state) {
     break;
 
   case 0xfe: // SET 7,(HL)
-    mem_write(state->hl, mem_read(state->hl) | (1 << 7));
+    mem_write(state->machine, state->hl, mem_read(state->machine, state->hl) | (1 << 7));
     break;
 
   case 0xff: // SET 7,A
@@ -1479,12 +1687,21 @@ int decode_cb(Z80_State* state) {
 
   default:
     printf("Unknown CB opcode: %02X\n", opcode);
-    return 0;
+    return -1;
   }
+
+  return cycles;
 }
 
-int decode_dd(Z80_State* state) {
-  uint8_t opcode = mem_read(state->pc++);
+// DD and FD prefixed instructions share one implementation working on the
+// index register passed in; XY stands for IX or IY in the comments below.
+#define XY (*xy)
+
+static int decode_index_cb(Z80_State* state, uint16_t* xy);
+
+static int decode_index(Z80_State* state, uint16_t* xy) {
+  uint8_t opcode = mem_fetch(state->machine, state->pc++);
+  int cycles = cycles_xy[opcode];
   uint8_t temp;
   uint16_t temp16;
   uint8_t n;
@@ -1494,403 +1711,384 @@ int decode_dd(Z80_State* state) {
 
   switch (opcode) {
 
-  case 0x09: // ADD IX,BC
-    state->ix += state->bc;
+  case 0x09: // ADD XY,BC
+    XY += state->bc;
     break;
 
-  case 0x19: // ADD IX,DE
-    state->ix += state->de;
+  case 0x19: // ADD XY,DE
+    XY += state->de;
     break;
 
-  case 0x21: // LD IX,nnnn
-    state->ix = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
+  case 0x21: // LD XY,nnnn
+    XY = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
     break;
 
-  case 0x22: // LD (nnnn),IX
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    mem_write16(temp16, state->ix);
+  case 0x22: // LD (nnnn),XY
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    mem_write16(state->machine, temp16, XY);
     break;
 
-  case 0x23: // INC IX
-    state->ix++;
+  case 0x23: // INC XY
+    XY++;
     break;
 
-  case 0x24: // INC IXH
-    state->ix = (state->ix & 0x00FF) | ((state->ix + 0x0100) & 0xFF00);
+  case 0x24: // INC XYH
+    XY = (XY & 0x00FF) | ((XY + 0x0100) & 0xFF00);
     break;
 
-  case 0x25: // DEC IXH
-    state->ix = (state->ix & 0x00FF) | ((state->ix - 0x0100) & 0xFF00);
+  case 0x25: // DEC XYH
+    XY = (XY & 0x00FF) | ((XY - 0x0100) & 0xFF00);
     break;
 
-  case 0x26: // LD IXH,nn
-    state->ix = (state->ix & 0x00FF) | (mem_read(state->pc++) << 8);
+  case 0x26: // LD XYH,nn
+    XY = (XY & 0x00FF) | (mem_read(state->machine, state->pc++) << 8);
     break;
 
-  case 0x29: // ADD IX,IX
-    state->ix += state->ix;
+  case 0x29: // ADD XY,XY
+    XY += XY;
     break;
 
-  case 0x2A: // LD IX,(nnnn)
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    state->ix = mem_read16(temp16);
+  case 0x2A: // LD XY,(nnnn)
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    XY = mem_read16(state->machine, temp16);
     break;
 
-  case 0x2B: // DEC IX
-    state->ix--;
+  case 0x2B: // DEC XY
+    XY--;
     break;
 
-  case 0x2C: // INC IXL
-    state->ix = (state->ix & 0xFF00) | ((state->ix + 0x0001) & 0x00FF);
+  case 0x2C: // INC XYL
+    XY = (XY & 0xFF00) | ((XY + 0x0001) & 0x00FF);
     break;
 
-  case 0x2D: // DEC IXL
-    state->ix = (state->ix & 0xFF00) | ((state->ix - 0x0001) & 0x00FF);
+  case 0x2D: // DEC XYL
+    XY = (XY & 0xFF00) | ((XY - 0x0001) & 0x00FF);
     break;
 
-  case 0x2E: // LD IXL,nn
-    state->ix = (state->ix & 0xFF00) | mem_read(state->pc++);
+  case 0x2E: // LD XYL,nn
+    XY = (XY & 0xFF00) | mem_read(state->machine, state->pc++);
     break;
 
-  case 0x34: // INC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, mem_read(temp16) + 1);
+  case 0x34: // INC (XY+dd)
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, mem_read(state->machine, temp16) + 1);
     break;
 
-  case 0x35: // DEC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, mem_read(temp16) - 1);
+  case 0x35: // DEC (XY+dd)
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, mem_read(state->machine, temp16) - 1);
     break;
 
-  case 0x36: // LD (IX+dd),nn
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, mem_read(state->pc++));
+  case 0x36: // LD (XY+dd),nn
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, mem_read(state->machine, state->pc++));
     break;
 
-  case 0x39: // ADD IX,SP
-    state->ix += state->sp;
+  case 0x39: // ADD XY,SP
+    XY += state->sp;
     break;
 
-  case 0x44: // LD B,IXH
-    state->b = (state->ix >> 8) & 0xFF;
+  case 0x44: // LD B,XYH
+    state->b = (XY >> 8) & 0xFF;
     break;
 
-  case 0x45: // LD B,IXL
-    state->b = state->ix & 0xFF;
+  case 0x45: // LD B,XYL
+    state->b = XY & 0xFF;
     break;
 
-  case 0x46: // LD B,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->b = mem_read(temp16);
+  case 0x46: // LD B,(XY+dd)
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    state->b = mem_read(state->machine, temp16);
     break;
 
-  case 0x4C: // LD C,IXH
-    state->c = (state->ix >> 8) & 0xFF;
+  case 0x4C: // LD C,XYH
+    state->c = (XY >> 8) & 0xFF;
     break;
 
-  case 0x4D: // LD C,IXL
-    state->c = state->ix & 0xFF;
+  case 0x4D: // LD C,XYL
+    state->c = XY & 0xFF;
     break;
 
-  case 0x4E: // LD C,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->c = mem_read(temp16);
+  case 0x4E: // LD C,(XY+dd)
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    state->c = mem_read(state->machine, temp16);
     break;
 
-  case 0x54: // LD D,IXH
-    state->d = (state->ix >> 8) & 0xFF;
+  case 0x54: // LD D,XYH
+    state->d = (XY >> 8) & 0xFF;
     break;
 
-  case 0x55: // LD D,IXL
-    state->d = state->ix & 0xFF;
+  case 0x55: // LD D,XYL
+    state->d = XY & 0xFF;
     break;
 
-  case 0x56: // LD D,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->d = mem_read(temp16);
+  case 0x56: // LD D,(XY+dd)
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    state->d = mem_read(state->machine, temp16);
     break;
 
-  case 0x5C: // LD E,IXH
-    state->e = (state->ix >> 8) & 0xFF;
+  case 0x5C: // LD E,XYH
+    state->e = (XY >> 8) & 0xFF;
     break;
 
-  case 0x5D: // LD E,IXL
-    state->e = state->ix & 0xFF;
+  case 0x5D: // LD E,XYL
+    state->e = XY & 0xFF;
     break;
 
-  case 0x5E: // LD E,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->e = mem_read(temp16);
+  case 0x5E: // LD E,(XY+dd)
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    state->e = mem_read(state->machine, temp16);
     break;
 
-  case 0x60: // LD IXH,B
-    state->ix = (state->ix & 0x00FF) | (state->b << 8);
+  case 0x60: // LD XYH,B
+    XY = (XY & 0x00FF) | (state->b << 8);
     break;
 
-  case 0x61: // LD IXH,C
-    state->ix = (state->ix & 0x00FF) | (state->c << 8);
+  case 0x61: // LD XYH,C
+    XY = (XY & 0x00FF) | (state->c << 8);
     break;
 
-  case 0x62: // LD IXH,D
-    state->ix = (state->ix & 0x00FF) | (state->d << 8);
+  case 0x62: // LD XYH,D
+    XY = (XY & 0x00FF) | (state->d << 8);
     break;
 
-  case 0x63: // LD IXH,E
-    state->ix = (state->ix & 0x00FF) | (state->e << 8);
+  case 0x63: // LD XYH,E
+    XY = (XY & 0x00FF) | (state->e << 8);
     break;
 
-  case 0x64: // LD IXH,IXH
-    // No operation needed, IXH already holds its value
+  case 0x64: // LD XYH,XYH
+    // No operation needed, XYH already holds its value
     break;
 
-  case 0x65: // LD IXH,IXL
-    state->ix = (state->ix & 0x00FF) | ((state->ix & 0xFF) << 8);
+  case 0x65: // LD XYH,XYL
+    XY = (XY & 0x00FF) | ((XY & 0xFF) << 8);
     break;
 
-  case 0x66: // LD H,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->h = mem_read(temp16);
+  case 0x66: // LD H,(XY+dd)
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    state->h = mem_read(state->machine, temp16);
     break;
 
-  case 0x67: // LD IXH,A
-    state->ix = (state->ix & 0x00FF) | (state->a << 8);
+  case 0x67: // LD XYH,A
+    XY = (XY & 0x00FF) | (state->a << 8);
     break;
 
-  case 0x68: // LD IXL,B
-    state->ix = (state->ix & 0xFF00) | state->b;
+  case 0x68: // LD XYL,B
+    XY = (XY & 0xFF00) | state->b;
     break;
 
-  case 0x69: // LD IXL,C
-    state->ix = (state->ix & 0xFF00) | state->c;
+  case 0x69: // LD XYL,C
+    XY = (XY & 0xFF00) | state->c;
     break;
 
-  case 0x6A: // LD IXL,D
-    state->ix = (state->ix & 0xFF00) | state->d;
+  case 0x6A: // LD XYL,D
+    XY = (XY & 0xFF00) | state->d;
     break;
 
-  case 0x6B: // LD IXL,E
-    state->ix = (state->ix & 0xFF00) | state->e;
+  case 0x6B: // LD XYL,E
+    XY = (XY & 0xFF00) | state->e;
     break;
 
-  case 0x6C: // LD IXL,IXH
-    state->ix = (state->ix & 0xFF00) | ((state->ix >> 8) & 0xFF);
+  case 0x6C: // LD XYL,XYH
+    XY = (XY & 0xFF00) | ((XY >> 8) & 0xFF);
     break;
 
-  case 0x6D: // LD IXL,IXL
-    // No operation needed, IXL already holds its value
+  case 0x6D: // LD XYL,XYL
+    // No operation needed, XYL already holds its value
     break;
 
-  case 0x6E: // LD L,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->l = mem_read(temp16);
+  case 0x6E: // LD L,(XY+dd)
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    state->l = mem_read(state->machine, temp16);
     break;
 
-  case 0x6F: // LD IXL,A
-    state->ix = (state->ix & 0xFF00) | state->a;
+  case 0x6F: // LD XYL,A
+    XY = (XY & 0xFF00) | state->a;
     break;
 
-  case 0x70: // LD (IX+dd),B
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, state->b);
+  case 0x70: // LD (XY+dd),B
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, state->b);
     break;
 
-  case 0x71: // LD (IX+dd),C
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, state->c);
+  case 0x71: // LD (XY+dd),C
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, state->c);
     break;
 
-  case 0x72: // LD (IX+dd),D
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, state->d);
+  case 0x72: // LD (XY+dd),D
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, state->d);
     break;
 
-  case 0x73: // LD (IX+dd),E
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, state->e);
+  case 0x73: // LD (XY+dd),E
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, state->e);
     break;
 
-  case 0x74: // LD (IX+dd),H
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, state->h);
+  case 0x74: // LD (XY+dd),H
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, state->h);
     break;
 
-  case 0x75: // LD (IX+dd),L
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, state->l);
+  case 0x75: // LD (XY+dd),L
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, state->l);
     break;
 
-  case 0x77: // LD (IX+dd),A
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    mem_write(temp16, state->a);
+  case 0x77: // LD (XY+dd),A
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    mem_write(state->machine, temp16, state->a);
     break;
 
-  case 0x7C: // LD A,IXH
-    state->a = (state->ix >> 8) & 0xFF;
+  case 0x7C: // LD A,XYH
+    state->a = (XY >> 8) & 0xFF;
     break;
 
-  case 0x7D: // LD A,IXL
-    state->a = state->ix & 0xFF;
+  case 0x7D: // LD A,XYL
+    state->a = XY & 0xFF;
     break;
 
-  case 0x7E: // LD A,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->a = mem_read(temp16);
+  case 0x7E: // LD A,(XY+dd)
+    temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+    state->a = mem_read(state->machine, temp16);
     break;
 
-  case 0x84: // ADD A,IXH
-    state->a += (state->ix >> 8) & 0xFF;
+  case 0x84: // ADD A,XYH
+    add_a(state, XY >> 8);
     break;
 
-  case 0x85: // ADD A,IXL
-    state->a += state->ix & 0xFF;
+  case 0x85: // ADD A,XYL
+    add_a(state, XY & 0xFF);
     break;
 
-  case 0x86: // ADD A,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->a += mem_read(temp16);
+  case 0x86: // ADD A,(XY+dd)
+    add_a(state, mem_read(state->machine, XY + (int8_t)mem_read(state->machine, state->pc++)));
     break;
 
-  case 0x8C: // ADC A,IXH
-    state->a += (state->ix >> 8) & 0xFF + TST_FLAG(state, FLAG_C);
+  case 0x8C: // ADC A,XYH
+    adc_a(state, XY >> 8);
     break;
 
-  case 0x8D: // ADC A,IXL
-    state->a += state->ix & 0xFF + TST_FLAG(state, FLAG_C);
+  case 0x8D: // ADC A,XYL
+    adc_a(state, XY & 0xFF);
     break;
 
-  case 0x8E: // ADC A,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->a += mem_read(temp16) + TST_FLAG(state, FLAG_C);
+  case 0x8E: // ADC A,(XY+dd)
+    adc_a(state, mem_read(state->machine, XY + (int8_t)mem_read(state->machine, state->pc++)));
     break;
 
-  case 0x94: // SUB A,IXH
-    state->a -= (state->ix >> 8) & 0xFF;
+  case 0x94: // SUB A,XYH
+    sub_a(state, XY >> 8);
     break;
 
-  case 0x95: // SUB A,IXL
-    state->a -= state->ix & 0xFF;
+  case 0x95: // SUB A,XYL
+    sub_a(state, XY & 0xFF);
     break;
 
-  case 0x96: // SUB A,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->a -= mem_read(temp16);
+  case 0x96: // SUB A,(XY+dd)
+    sub_a(state, mem_read(state->machine, XY + (int8_t)mem_read(state->machine, state->pc++)));
     break;
 
-  case 0x9C: // SBC A,IXH
-    state->a -= (state->ix >> 8) & 0xFF + TST_FLAG(state, FLAG_C);
+  case 0x9C: // SBC A,XYH
+    sbc_a(state, XY >> 8);
     break;
 
-  case 0x9D: // SBC A,IXL
-    state->a -= state->ix & 0xFF + TST_FLAG(state, FLAG_C);
+  case 0x9D: // SBC A,XYL
+    sbc_a(state, XY & 0xFF);
     break;
 
-  case 0x9E: // SBC A,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->a -= mem_read(temp16) + TST_FLAG(state, FLAG_C);
+  case 0x9E: // SBC A,(XY+dd)
+    sbc_a(state, mem_read(state->machine, XY + (int8_t)mem_read(state->machine, state->pc++)));
     break;
 
-  case 0xA4: // AND A,IXH
-    state->a &= (state->ix >> 8) & 0xFF;
-    UPDATE_SZ(state, state->a);
+  case 0xA4: // AND A,XYH
+    and_a(state, XY >> 8);
     break;
 
-  case 0xA5: // AND A,IXL
-    state->a &= state->ix & 0xFF;
-    UPDATE_SZ(state, state->a);
+  case 0xA5: // AND A,XYL
+    and_a(state, XY & 0xFF);
     break;
 
-  case 0xA6: // AND A,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->a &= mem_read(temp16);
-    UPDATE_SZ(state, state->a);
+  case 0xA6: // AND A,(XY+dd)
+    and_a(state, mem_read(state->machine, XY + (int8_t)mem_read(state->machine, state->pc++)));
     break;
 
-  case 0xAC: // XOR A,IXH
-    state->a ^= (state->ix >> 8) & 0xFF;
-    UPDATE_SZ(state, state->a);
+  case 0xAC: // XOR A,XYH
+    xor_a(state, XY >> 8);
     break;
 
-  case 0xAD: // XOR A,IXL
-    state->a ^= state->ix & 0xFF;
-    UPDATE_SZ(state, state->a);
+  case 0xAD: // XOR A,XYL
+    xor_a(state, XY & 0xFF);
     break;
 
-  case 0xAE: // XOR A,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->a ^= mem_read(temp16);
-    UPDATE_SZ(state, state->a);
+  case 0xAE: // XOR A,(XY+dd)
+    xor_a(state, mem_read(state->machine, XY + (int8_t)mem_read(state->machine, state->pc++)));
     break;
 
-  case 0xB4: // OR A,IXH
-    state->a |= (state->ix >> 8) & 0xFF;
-    UPDATE_SZ(state, state->a);
+  case 0xB4: // OR A,XYH
+    or_a(state, XY >> 8);
     break;
 
-  case 0xB5: // OR A,IXL
-    state->a |= state->ix & 0xFF;
-    UPDATE_SZ(state, state->a);
+  case 0xB5: // OR A,XYL
+    or_a(state, XY & 0xFF);
     break;
 
-  case 0xB6: // OR A,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    state->a |= mem_read(temp16);
-    UPDATE_SZ(state, state->a);
+  case 0xB6: // OR A,(XY+dd)
+    or_a(state, mem_read(state->machine, XY + (int8_t)mem_read(state->machine, state->pc++)));
     break;
 
-  case 0xBC: // CP IXH
-    temp = (state->ix >> 8) & 0xFF;
-    res = state->a - temp;
-    UPDATE_FLAGS_SUB(state, res, temp);
+  case 0xBC: // CP XYH
+    cp_a(state, XY >> 8);
     break;
 
-  case 0xBD: // CP IXL
-    temp = state->ix & 0xFF;
-    res = state->a - temp;
-    UPDATE_FLAGS_SUB(state, res, temp);
+  case 0xBD: // CP XYL
+    cp_a(state, XY & 0xFF);
     break;
 
-  case 0xBE: // CP (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = state->a - temp;
-    UPDATE_FLAGS_SUB(state, res, temp);
+  case 0xBE: // CP (XY+dd)
+    cp_a(state, mem_read(state->machine, XY + (int8_t)mem_read(state->machine, state->pc++)));
     break;
 
   case 0xCB: // CB-prefixed opcodes
-    return decode_ddcb(state);
+    return decode_index_cb(state, xy);
 
-  case 0xE1: // POP IX
-    state->ix = pop16(state);
+  case 0xE1: // POP XY
+    XY = pop16(state);
     break;
 
-  case 0xE3: // EX (SP),IX
+  case 0xE3: // EX (SP),XY
     temp16 = pop16(state);
-    push16(state, state->ix);
-    state->ix = temp16;
+    push16(state, XY);
+    XY = temp16;
     break;
 
-  case 0xE5: // PUSH IX
-    push16(state, state->ix);
+  case 0xE5: // PUSH XY
+    push16(state, XY);
     break;
 
-  case 0xE9: // JP IX
-    state->pc = state->ix;
+  case 0xE9: // JP XY
+    state->pc = XY;
     break;
 
-  case 0xF9: // LD SP,IX
-    state->sp = state->ix;
+  case 0xF9: // LD SP,XY
+    state->sp = XY;
     break;
 
   default:
-    printf("Unknown DD opcode: %02X\n", opcode);
-    return 0;
+    printf("Unknown %s opcode: %02X\n", xy == &state->ix ? "DD" : "FD", opcode);
+    return -1;
   }
+
+  return cycles;
 }
 
-int decode_ddcb(Z80_State* state) {
-  uint8_t opcode = mem_read(state->pc++);
+static int decode_index_cb(Z80_State* state, uint16_t* xy) {
+  // The displacement comes before the opcode: DD CB dd op
+  uint16_t temp16 = XY + (int8_t)mem_read(state->machine, state->pc++);
+  uint8_t opcode = mem_read(state->machine, state->pc++);
+  int cycles = cycles_xycb[opcode];
   uint8_t temp;
-  uint16_t temp16;
   uint8_t n;
   uint8_t carry;
   uint8_t res;
@@ -1898,585 +2096,533 @@ int decode_ddcb(Z80_State* state) {
 
   switch (opcode) {
 
-  case 0x00: // LD B,RLC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x00: // LD B,RLC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 7) | (temp << 1);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->b = res;
     break;
 
-  case 0x01: // LD C,RLC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x01: // LD C,RLC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 7) | (temp << 1);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->c = res;
     break;
 
-  case 0x02: // LD D,RLC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x02: // LD D,RLC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 7) | (temp << 1);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->d = res;
     break;
 
-  case 0x03: // LD E,RLC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x03: // LD E,RLC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 7) | (temp << 1);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->e = res;
     break;
 
-  case 0x04: // LD H,RLC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x04: // LD H,RLC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 7) | (temp << 1);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->h = res;
     break;
 
-  case 0x05: // LD L,RLC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x05: // LD L,RLC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 7) | (temp << 1);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->l = res;
     break;
 
-  case 0x06: // RLC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x06: // RLC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 7) | (temp << 1);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x07: // LD A,RLC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x07: // LD A,RLC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 7) | (temp << 1);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->a = res;
     break;
 
-  case 0x08: // LD B,RRC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x08: // LD B,RRC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->b = res;
     break;
 
-  case 0x09: // LD C,RRC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x09: // LD C,RRC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->c = res;
     break;
 
-  case 0x0a: // LD D,RRC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x0A: // LD D,RRC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->d = res;
     break;
 
-  case 0x0b: // LD E,RRC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x0B: // LD E,RRC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->e = res;
     break;
 
-  case 0x0c: // LD H,RRC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x0C: // LD H,RRC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->h = res;
     break;
 
-  case 0x0d: // LD L,RRC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x0D: // LD L,RRC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->l = res;
     break;
 
-  case 0x0e: // RRC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x0E: // RRC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x0f: // LD A,RRC (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x0F: // LD A,RRC (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->a = res;
     break;
 
-  case 0x10: // LD B,RL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x10: // LD B,RL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->b = res;
     break;
 
-  case 0x11: // LD C,RL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x11: // LD C,RL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->c = res;
     break;
 
-  case 0x12: // LD D,RL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x12: // LD D,RL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp << 1) | (temp >> 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->d = res;
     break;
 
-  case 0x13: // LD E,RL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x13: // LD E,RL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp << 1) | (temp >> 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->e = res;
     break;
 
-  case 0x14: // LD H,RL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x14: // LD H,RL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp << 1) | (temp >> 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->h = res;
     break;
 
-  case 0x15: // LD L,RL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x15: // LD L,RL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp << 1) | (temp >> 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->l = res;
     break;
 
-  case 0x16: // RL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x16: // RL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp << 1) | (temp >> 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x17: // LD A,RL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x17: // LD A,RL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp << 1) | (temp >> 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->a = res;
     break;
 
-  case 0x18: // LD B,RR (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x18: // LD B,RR (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->b = res;
     break;
 
-  case 0x19: // LD C,RR (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x19: // LD C,RR (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->c = res;
     break;
 
-  case 0x1a: // LD D,RR (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x1A: // LD D,RR (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->d = res;
     break;
 
-  case 0x1b: // LD E,RR (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x1B: // LD E,RR (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->e = res;
     break;
 
-  case 0x1c: // LD H,RR (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x1C: // LD H,RR (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->h = res;
     break;
 
-  case 0x1d: // LD L,RR (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x1D: // LD L,RR (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->l = res;
     break;
 
-  case 0x1e: // RR (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x1E: // RR (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x1f: // LD A,RR (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x1F: // LD A,RR (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = (temp >> 1) | (temp << 7);
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->a = res;
     break;
 
-  case 0x20: // LD B,SLA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x20: // LD B,SLA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->b = res;
     break;
 
-  case 0x21: // LD C,SLA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x21: // LD C,SLA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->c = res;
     break;
 
-  case 0x22: // LD D,SLA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x22: // LD D,SLA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->d = res;
     break;
 
-  case 0x23: // LD E,SLA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x23: // LD E,SLA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->e = res;
     break;
 
-  case 0x24: // LD H,SLA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x24: // LD H,SLA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->h = res;
     break;
 
-  case 0x25: // LD L,SLA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x25: // LD L,SLA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->l = res;
     break;
 
-  case 0x26: // SLA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x26: // SLA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x27: // LD A,SLA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x27: // LD A,SLA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->a = res;
     break;
 
-  case 0x28: // LD B,SRA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x28: // LD B,SRA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->b = res;
     break;
 
-  case 0x29: // LD C,SRA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x29: // LD C,SRA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->c = res;
     break;
 
-  case 0x2a: // LD D,SRA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x2A: // LD D,SRA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->d = res;
     break;
 
-  case 0x2b: // LD E,SRA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x2B: // LD E,SRA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->e = res;
     break;
 
-  case 0x2c: // LD H,SRA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x2C: // LD H,SRA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->h = res;
     break;
 
-  case 0x2d: // LD L,SRA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x2D: // LD L,SRA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->l = res;
     break;
 
-  case 0x2e: // SRA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x2E: // SRA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x2f: // LD A,SRA (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x2F: // LD A,SRA (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->a = res;
     break;
 
-  case 0x30: // LD B,SLL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x30: // LD B,SLL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->b = res;
     break;
 
-  case 0x31: // LD C,SLL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x31: // LD C,SLL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->c = res;
     break;
 
-  case 0x32: // LD D,SLL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x32: // LD D,SLL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->d = res;
     break;
 
-  case 0x33: // LD E,SLL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x33: // LD E,SLL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->e = res;
     break;
 
-  case 0x34: // LD H,SLL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x34: // LD H,SLL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->h = res;
     break;
 
-  case 0x35: // LD L,SLL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x35: // LD L,SLL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->l = res;
     break;
 
-  case 0x36: // SLL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x36: // SLL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x37: // LD A,SLL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x37: // LD A,SLL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp << 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->a = res;
     break;
 
-  case 0x38: // LD B,SRL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x38: // LD B,SRL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->b = res;
     break;
 
-  case 0x39: // LD C,SRL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x39: // LD C,SRL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->c = res;
     break;
 
-  case 0x3a: // LD D,SRL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x3A: // LD D,SRL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->d = res;
     break;
 
-  case 0x3b: // LD E,SRL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x3B: // LD E,SRL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->e = res;
     break;
 
-  case 0x3c: // LD H,SRL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x3C: // LD H,SRL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->h = res;
     break;
 
-  case 0x3d: // LD L,SRL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x3D: // LD L,SRL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->l = res;
     break;
 
-  case 0x3e: // SRL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x3E: // SRL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x3f: // LD A,SRL (IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x3F: // LD A,SRL (XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp >> 1;
     state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
     state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
     state->a = res;
     break;
 
-  case 0x47: // BIT 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x40: // BIT 0, (XY+d)
+  case 0x41: // BIT 0, (XY+d)
+  case 0x42: // BIT 0, (XY+d)
+  case 0x43: // BIT 0, (XY+d)
+  case 0x44: // BIT 0, (XY+d)
+  case 0x45: // BIT 0, (XY+d)
+  case 0x46: // BIT 0, (XY+d)
+    temp = mem_read(state->machine, temp16);
+    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
+    state->f |= FLAG_H;
+    if (!(temp & 0x01)) SET_FLAG(state, FLAG_Z);
+    break;
+
+  case 0x47: // BIT 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     state->f &= ~(FLAG_N | FLAG_H | FLAG_S | FLAG_Z | FLAG_PV);
     state->f |= (temp & FLAG_S) | (temp & FLAG_PV);
     if(temp & 0x01)
@@ -2485,9 +2631,21 @@ int decode_ddcb(Z80_State* state) {
       SET_FLAG(state, FLAG_Z);
     break;
 
-  case 0x4f: // BIT 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x48: // BIT 1, (XY+d)
+  case 0x49: // BIT 1, (XY+d)
+  case 0x4A: // BIT 1, (XY+d)
+  case 0x4B: // BIT 1, (XY+d)
+  case 0x4C: // BIT 1, (XY+d)
+  case 0x4D: // BIT 1, (XY+d)
+  case 0x4E: // BIT 1, (XY+d)
+    temp = mem_read(state->machine, temp16);
+    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
+    state->f |= FLAG_H;
+    if (!(temp & 0x02)) SET_FLAG(state, FLAG_Z);
+    break;
+
+  case 0x4F: // BIT 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     state->f &= ~(FLAG_N | FLAG_H | FLAG_S | FLAG_Z | FLAG_PV);
     state->f |= (temp & FLAG_S) | (temp & FLAG_PV);
     if(temp & 0x02)
@@ -2496,9 +2654,21 @@ int decode_ddcb(Z80_State* state) {
       SET_FLAG(state, FLAG_Z);
     break;
 
-  case 0x57: // BIT 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x50: // BIT 2, (XY+d)
+  case 0x51: // BIT 2, (XY+d)
+  case 0x52: // BIT 2, (XY+d)
+  case 0x53: // BIT 2, (XY+d)
+  case 0x54: // BIT 2, (XY+d)
+  case 0x55: // BIT 2, (XY+d)
+  case 0x56: // BIT 2, (XY+d)
+    temp = mem_read(state->machine, temp16);
+    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
+    state->f |= FLAG_H;
+    if (!(temp & 0x04)) SET_FLAG(state, FLAG_Z);
+    break;
+
+  case 0x57: // BIT 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     state->f &= ~(FLAG_N | FLAG_H | FLAG_S | FLAG_Z | FLAG_PV);
     state->f |= (temp & FLAG_S) | (temp & FLAG_PV);
     if(temp & 0x04)
@@ -2507,9 +2677,21 @@ int decode_ddcb(Z80_State* state) {
       SET_FLAG(state, FLAG_Z);
     break;
 
-  case 0x5f: // BIT 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x58: // BIT 3, (XY+d)
+  case 0x59: // BIT 3, (XY+d)
+  case 0x5A: // BIT 3, (XY+d)
+  case 0x5B: // BIT 3, (XY+d)
+  case 0x5C: // BIT 3, (XY+d)
+  case 0x5D: // BIT 3, (XY+d)
+  case 0x5E: // BIT 3, (XY+d)
+    temp = mem_read(state->machine, temp16);
+    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
+    state->f |= FLAG_H;
+    if (!(temp & 0x08)) SET_FLAG(state, FLAG_Z);
+    break;
+
+  case 0x5F: // BIT 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     state->f &= ~(FLAG_N | FLAG_H | FLAG_S | FLAG_Z | FLAG_PV);
     state->f |= (temp & FLAG_S) | (temp & FLAG_PV);
     if(temp & 0x08)
@@ -2518,9 +2700,21 @@ int decode_ddcb(Z80_State* state) {
       SET_FLAG(state, FLAG_Z);
     break;
 
-  case 0x67: // BIT 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x60: // BIT 4, (XY+d)
+  case 0x61: // BIT 4, (XY+d)
+  case 0x62: // BIT 4, (XY+d)
+  case 0x63: // BIT 4, (XY+d)
+  case 0x64: // BIT 4, (XY+d)
+  case 0x65: // BIT 4, (XY+d)
+  case 0x66: // BIT 4, (XY+d)
+    temp = mem_read(state->machine, temp16);
+    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
+    state->f |= FLAG_H;
+    if (!(temp & 0x10)) SET_FLAG(state, FLAG_Z);
+    break;
+
+  case 0x67: // BIT 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     state->f &= ~(FLAG_N | FLAG_H | FLAG_S | FLAG_Z | FLAG_PV);
     state->f |= (temp & FLAG_S) | (temp & FLAG_PV);
     if(temp & 0x10)
@@ -2529,9 +2723,21 @@ int decode_ddcb(Z80_State* state) {
       SET_FLAG(state, FLAG_Z);
     break;
 
-  case 0x6f: // BIT 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x68: // BIT 5, (XY+d)
+  case 0x69: // BIT 5, (XY+d)
+  case 0x6A: // BIT 5, (XY+d)
+  case 0x6B: // BIT 5, (XY+d)
+  case 0x6C: // BIT 5, (XY+d)
+  case 0x6D: // BIT 5, (XY+d)
+  case 0x6E: // BIT 5, (XY+d)
+    temp = mem_read(state->machine, temp16);
+    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
+    state->f |= FLAG_H;
+    if (!(temp & 0x20)) SET_FLAG(state, FLAG_Z);
+    break;
+
+  case 0x6F: // BIT 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     state->f &= ~(FLAG_N | FLAG_H | FLAG_S | FLAG_Z | FLAG_PV);
     state->f |= (temp & FLAG_S) | (temp & FLAG_PV);
     if(temp & 0x20)
@@ -2540,9 +2746,21 @@ int decode_ddcb(Z80_State* state) {
       SET_FLAG(state, FLAG_Z);
     break;
 
-  case 0x77: // BIT 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x70: // BIT 6, (XY+d)
+  case 0x71: // BIT 6, (XY+d)
+  case 0x72: // BIT 6, (XY+d)
+  case 0x73: // BIT 6, (XY+d)
+  case 0x74: // BIT 6, (XY+d)
+  case 0x75: // BIT 6, (XY+d)
+  case 0x76: // BIT 6, (XY+d)
+    temp = mem_read(state->machine, temp16);
+    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
+    state->f |= FLAG_H;
+    if (!(temp & 0x40)) SET_FLAG(state, FLAG_Z);
+    break;
+
+  case 0x77: // BIT 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     state->f &= ~(FLAG_N | FLAG_H | FLAG_S | FLAG_Z | FLAG_PV);
     state->f |= (temp & FLAG_S) | (temp & FLAG_PV);
     if(temp & 0x40)
@@ -2551,9 +2769,20 @@ int decode_ddcb(Z80_State* state) {
       SET_FLAG(state, FLAG_Z);
     break;
 
-  case 0x7f: // BIT 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x78: // BIT 7, (XY+d)
+  case 0x79: // BIT 7, (XY+d)
+  case 0x7A: // BIT 7, (XY+d)
+  case 0x7B: // BIT 7, (XY+d)
+  case 0x7C: // BIT 7, (XY+d)
+  case 0x7D: // BIT 7, (XY+d)
+    temp = mem_read(state->machine, temp16);
+    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
+    state->f |= FLAG_H;
+    if (!(temp & 0x80)) SET_FLAG(state, FLAG_Z);
+    break;
+
+  case 0x7F: // BIT 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     state->f &= ~(FLAG_N | FLAG_H | FLAG_S | FLAG_Z | FLAG_PV);
     state->f |= (temp & FLAG_S) | (temp & FLAG_PV);
     if(temp & 0x80)
@@ -2562,926 +2791,980 @@ int decode_ddcb(Z80_State* state) {
       SET_FLAG(state, FLAG_Z);
     break;
 
-  case 0x80: // LD B,RES 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x80: // LD B,RES 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 0);
     state->b = res;
     break;
 
-  case 0x81: // LD C,RES 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x81: // LD C,RES 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 0);
     state->c = res;
     break;
 
-  case 0x82: // LD D,RES 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x82: // LD D,RES 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 0);
     state->d = res;
     break;
 
-  case 0x83: // LD E,RES 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x83: // LD E,RES 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 0);
     state->e = res;
     break;
 
-  case 0x84: // LD H,RES 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x84: // LD H,RES 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 0);
     state->h = res;
     break;
 
-  case 0x85: // LD L,RES 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x85: // LD L,RES 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 0);
     state->l = res;
     break;
 
-  case 0x86: // RES 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x86: // RES 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 0);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x87: // LD A,RES 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x87: // LD A,RES 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 0);
     state->a = res;
     break;
 
-  case 0x88: // LD B,RES 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x88: // LD B,RES 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 1);
     state->b = res;
     break;
 
-  case 0x89: // LD C,RES 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x89: // LD C,RES 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 1);
     state->c = res;
     break;
 
-  case 0x8a: // LD D,RES 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x8A: // LD D,RES 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 1);
     state->d = res;
     break;
 
-  case 0x8b: // LD E,RES 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x8B: // LD E,RES 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 1);
     state->e = res;
     break;
 
-  case 0x8c: // LD H,RES 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x8C: // LD H,RES 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 1);
     state->h = res;
     break;
 
-  case 0x8d: // LD L,RES 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x8D: // LD L,RES 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 1);
     state->l = res;
     break;
 
-  case 0x8e: // RES 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x8E: // RES 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 1);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x8f: // LD A,RES 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x8F: // LD A,RES 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 1);
     state->a = res;
     break;
 
-  case 0x90: // LD B,RES 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x90: // LD B,RES 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 2);
     state->b = res;
     break;
 
-  case 0x91: // LD C,RES 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x91: // LD C,RES 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 2);
     state->c = res;
     break;
 
-  case 0x92: // LD D,RES 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x92: // LD D,RES 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 2);
     state->d = res;
     break;
 
-  case 0x93: // LD E,RES 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x93: // LD E,RES 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 2);
     state->e = res;
     break;
 
-  case 0x94: // LD H,RES 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x94: // LD H,RES 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 2);
     state->h = res;
     break;
 
-  case 0x95: // LD L,RES 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x95: // LD L,RES 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 2);
     state->l = res;
     break;
 
-  case 0x96: // RES 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x96: // RES 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 2);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x97: // LD A,RES 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x97: // LD A,RES 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 2);
     state->a = res;
     break;
 
-  case 0x98: // LD B,RES 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x98: // LD B,RES 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 3);
     state->b = res;
     break;
 
-  case 0x99: // LD C,RES 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x99: // LD C,RES 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 3);
     state->c = res;
     break;
 
-  case 0x9a: // LD D,RES 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x9A: // LD D,RES 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 3);
     state->d = res;
     break;
 
-  case 0x9b: // LD E,RES 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x9B: // LD E,RES 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 3);
     state->e = res;
     break;
 
-  case 0x9c: // LD H,RES 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x9C: // LD H,RES 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 3);
     state->h = res;
     break;
 
-  case 0x9d: // LD L,RES 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x9D: // LD L,RES 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 3);
     state->l = res;
     break;
 
-  case 0x9e: // RES 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x9E: // RES 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 3);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0x9f: // LD A,RES 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0x9F: // LD A,RES 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 3);
     state->a = res;
     break;
 
-  case 0xa0: // LD B,RES 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA0: // LD B,RES 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 4);
     state->b = res;
     break;
 
-  case 0xa1: // LD C,RES 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA1: // LD C,RES 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 4);
     state->c = res;
     break;
 
-  case 0xa2: // LD D,RES 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA2: // LD D,RES 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 4);
     state->d = res;
     break;
 
-  case 0xa3: // LD E,RES 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA3: // LD E,RES 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 4);
     state->e = res;
     break;
 
-  case 0xa4: // LD H,RES 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA4: // LD H,RES 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 4);
     state->h = res;
     break;
 
-  case 0xa5: // LD L,RES 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA5: // LD L,RES 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 4);
     state->l = res;
     break;
 
-  case 0xa6: // RES 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA6: // RES 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 4);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xa7: // LD A,RES 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA7: // LD A,RES 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 4);
     state->a = res;
     break;
 
-  case 0xa8: // LD B,RES 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA8: // LD B,RES 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 5);
     state->b = res;
     break;
 
-  case 0xa9: // LD C,RES 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xA9: // LD C,RES 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 5);
     state->c = res;
     break;
 
-  case 0xaa: // LD D,RES 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xAA: // LD D,RES 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 5);
     state->d = res;
     break;
 
-  case 0xab: // LD E,RES 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xAB: // LD E,RES 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 5);
     state->e = res;
     break;
 
-  case 0xac: // LD H,RES 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xAC: // LD H,RES 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 5);
     state->h = res;
     break;
 
-  case 0xad: // LD L,RES 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xAD: // LD L,RES 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 5);
     state->l = res;
     break;
 
-  case 0xae: // RES 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xAE: // RES 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 5);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xaf: // LD A,RES 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xAF: // LD A,RES 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 5);
     state->a = res;
     break;
 
-  case 0xb0: // LD B,RES 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB0: // LD B,RES 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 6);
     state->b = res;
     break;
 
-  case 0xb1: // LD C,RES 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB1: // LD C,RES 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 6);
     state->c = res;
     break;
 
-  case 0xb2: // LD D,RES 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB2: // LD D,RES 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 6);
     state->d = res;
     break;
 
-  case 0xb3: // LD E,RES 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB3: // LD E,RES 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 6);
     state->e = res;
     break;
 
-  case 0xb4: // LD H,RES 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB4: // LD H,RES 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 6);
     state->h = res;
     break;
 
-  case 0xb5: // LD L,RES 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB5: // LD L,RES 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 6);
     state->l = res;
     break;
 
-  case 0xb6: // RES 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB6: // RES 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 6);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xb7: // LD A,RES 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB7: // LD A,RES 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 6);
     state->a = res;
     break;
 
-  case 0xb8: // LD B,RES 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB8: // LD B,RES 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 7);
     state->b = res;
     break;
 
-  case 0xb9: // LD C,RES 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xB9: // LD C,RES 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 7);
     state->c = res;
     break;
 
-  case 0xBA: // LD D,RES 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xBA: // LD D,RES 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 7);
     state->d = res;
     break;
 
-  case 0xBB: // LD E,RES 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xBB: // LD E,RES 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 7);
     state->e = res;
     break;
 
-  case 0xBC: // LD H,RES 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xBC: // LD H,RES 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 7);
     state->h = res;
     break;
 
-  case 0xBD: // LD L,RES 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xBD: // LD L,RES 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 7);
     state->l = res;
     break;
 
-  case 0xBE: // RES 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xBE: // RES 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 7);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xBF: // LD A,RES 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xBF: // LD A,RES 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp & ~(1 << 7);
     state->a = res;
     break;
 
-  case 0xC0: // LD B,SET 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC0: // LD B,SET 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 0);
     state->b = res;
     break;
 
-  case 0xC1: // LD C,SET 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC1: // LD C,SET 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 0);
     state->c = res;
     break;
 
-  case 0xC2: // LD D,SET 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC2: // LD D,SET 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 0);
     state->d = res;
     break;
 
-  case 0xC3: // LD E,SET 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC3: // LD E,SET 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 0);
     state->e = res;
     break;
 
-  case 0xC4: // LD H,SET 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC4: // LD H,SET 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 0);
     state->h = res;
     break;
 
-  case 0xC5: // LD L,SET 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC5: // LD L,SET 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 0);
     state->l = res;
     break;
 
-  case 0xC6: // SET 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC6: // SET 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 0);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xC7: // LD A,SET 0,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC7: // LD A,SET 0,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 0);
     state->a = res;
     break;
 
-  case 0xC8: // LD B,SET 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC8: // LD B,SET 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 1);
     state->b = res;
     break;
 
-  case 0xC9: // LD C,SET 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xC9: // LD C,SET 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 1);
     state->c = res;
     break;
 
-  case 0xCA: // LD D,SET 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xCA: // LD D,SET 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 1);
     state->d = res;
     break;
 
-  case 0xCB: // LD E,SET 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xCB: // LD E,SET 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 1);
     state->e = res;
     break;
 
-  case 0xCC: // LD H,SET 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xCC: // LD H,SET 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 1);
     state->h = res;
     break;
 
-  case 0xCD: // LD L,SET 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xCD: // LD L,SET 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 1);
     state->l = res;
     break;
 
-  case 0xCE: // SET 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xCE: // SET 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 1);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xCF: // LD A,SET 1,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xCF: // LD A,SET 1,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 1);
     state->a = res;
     break;
 
-  case 0xD0: // LD B,SET 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD0: // LD B,SET 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 2);
     state->b = res;
     break;
 
-  case 0xD1: // LD C,SET 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD1: // LD C,SET 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 2);
     state->c = res;
     break;
 
-  case 0xD2: // LD D,SET 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD2: // LD D,SET 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 2);
     state->d = res;
     break;
 
-  case 0xD3: // LD E,SET 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD3: // LD E,SET 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 2);
     state->e = res;
     break;
 
-  case 0xD4: // LD H,SET 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD4: // LD H,SET 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 2);
     state->h = res;
     break;
 
-  case 0xD5: // LD L,SET 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD5: // LD L,SET 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 2);
     state->l = res;
     break;
 
-  case 0xD6: // SET 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD6: // SET 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 2);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xD7: // LD A,SET 2,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD7: // LD A,SET 2,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 2);
     state->a = res;
     break;
 
-  case 0xD8: // LD B,SET 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD8: // LD B,SET 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 3);
     state->b = res;
     break;
 
-  case 0xD9: // LD C,SET 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xD9: // LD C,SET 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 3);
     state->c = res;
     break;
 
-  case 0xDA: // LD D,SET 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xDA: // LD D,SET 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 3);
     state->d = res;
     break;
 
-  case 0xDB: // LD E,SET 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xDB: // LD E,SET 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 3);
     state->e = res;
     break;
 
-  case 0xDC: // LD H,SET 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xDC: // LD H,SET 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 3);
     state->h = res;
     break;
 
-  case 0xDD: // LD L,SET 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xDD: // LD L,SET 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 3);
     state->l = res;
     break;
 
-  case 0xDE: // SET 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xDE: // SET 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 3);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xDF: // LD A,SET 3,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xDF: // LD A,SET 3,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 3);
     state->a = res;
     break;
 
-  case 0xE0: // LD B,SET 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE0: // LD B,SET 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 4);
     state->b = res;
     break;
 
-  case 0xE1: // LD C,SET 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE1: // LD C,SET 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 4);
     state->c = res;
     break;
 
-  case 0xE2: // LD D,SET 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE2: // LD D,SET 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 4);
     state->d = res;
     break;
 
-  case 0xE3: // LD E,SET 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE3: // LD E,SET 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 4);
     state->e = res;
     break;
 
-  case 0xE4: // LD H,SET 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE4: // LD H,SET 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 4);
     state->h = res;
     break;
 
-  case 0xE5: // LD L,SET 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE5: // LD L,SET 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 4);
     state->l = res;
     break;
 
-  case 0xE6: // SET 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE6: // SET 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 4);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xE7: // LD A,SET 4,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE7: // LD A,SET 4,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 4);
     state->a = res;
     break;
 
-  case 0xE8: // LD B,SET 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE8: // LD B,SET 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 5);
     state->b = res;
     break;
 
-  case 0xE9: // LD C,SET 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xE9: // LD C,SET 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 5);
     state->c = res;
     break;
 
-  case 0xEA: // LD D,SET 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xEA: // LD D,SET 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 5);
     state->d = res;
     break;
 
-  case 0xEB: // LD E,SET 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xEB: // LD E,SET 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 5);
     state->e = res;
     break;
 
-  case 0xEC: // LD H,SET 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xEC: // LD H,SET 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 5);
     state->h = res;
     break;
 
-  case 0xED: // LD L,SET 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xED: // LD L,SET 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 5);
     state->l = res;
     break;
 
-  case 0xEE: // SET 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xEE: // SET 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 5);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xEF: // LD A,SET 5,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xEF: // LD A,SET 5,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 5);
     state->a = res;
     break;
 
-  case 0xF0: // LD B,SET 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF0: // LD B,SET 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 6);
     state->b = res;
     break;
 
-  case 0xF1: // LD C,SET 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF1: // LD C,SET 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 6);
     state->c = res;
     break;
 
-  case 0xF2: // LD D,SET 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF2: // LD D,SET 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 6);
     state->d = res;
     break;
 
-  case 0xF3: // LD E,SET 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF3: // LD E,SET 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 6);
     state->e = res;
     break;
 
-  case 0xF4: // LD H,SET 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF4: // LD H,SET 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 6);
     state->h = res;
     break;
 
-  case 0xF5: // LD L,SET 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF5: // LD L,SET 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 6);
     state->l = res;
     break;
 
-  case 0xF6: // SET 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF6: // SET 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 6);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xF7: // LD A,SET 6,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF7: // LD A,SET 6,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 6);
     state->a = res;
     break;
 
-  case 0xF8: // LD B,SET 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF8: // LD B,SET 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 7);
     state->b = res;
     break;
 
-  case 0xF9: // LD C,SET 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xF9: // LD C,SET 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 7);
     state->c = res;
     break;
 
-  case 0xFA: // LD D,SET 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xFA: // LD D,SET 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 7);
     state->d = res;
     break;
 
-  case 0xFB: // LD E,SET 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xFB: // LD E,SET 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 7);
     state->e = res;
     break;
 
-  case 0xFC: // LD H,SET 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xFC: // LD H,SET 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 7);
     state->h = res;
     break;
 
-  case 0xFD: // LD L,SET 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xFD: // LD L,SET 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 7);
     state->l = res;
     break;
 
-  case 0xFE: // SET 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xFE: // SET 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 7);
-    mem_write(temp16, res);
+    mem_write(state->machine, temp16, res);
     break;
 
-  case 0xFF: // LD A,SET 7,(IX+dd)
-    temp16 = state->ix + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
+  case 0xFF: // LD A,SET 7,(XY+dd)
+    temp = mem_read(state->machine, temp16);
     res = temp | (1 << 7);
     state->a = res;
     break;
 
   default:
-    printf("Unknown DD CB opcode: %02X\n", opcode);
+    printf("Unknown %s CB opcode: %02X\n", xy == &state->ix ? "DD" : "FD", opcode);
+    return -1;
+  }
+
+  return cycles;
+}
+
+#undef XY
+
+int decode_dd(Z80_State* state) {
+  return decode_index(state, &state->ix);
+}
+
+int decode_ddcb(Z80_State* state) {
+  return decode_index_cb(state, &state->ix);
+}
+
+int decode_fd(Z80_State* state) {
+  return decode_index(state, &state->iy);
+}
+
+int decode_fdcb(Z80_State* state) {
+  return decode_index_cb(state, &state->iy);
+}
+
+// One iteration of the LDI/CPI/INI/OUTI group (ED A0-BB): bits 0-1 of the
+// opcode pick the operation, bit 3 counts down and bit 4 repeats. Returns
+// true if a repeating instruction has to go round again.
+static bool block_iteration(Z80_State* state, uint8_t opcode) {
+  uint16_t step = (opcode & 0x08) ? 0xFFFF : 1;
+  uint8_t val;
+  uint8_t res;
+  bool more;
+
+  switch (opcode & 0x03) {
+  case 0: // LDI/LDD: (DE) <- (HL)
+    val = mem_read(state->machine, state->hl);
+    mem_write(state->machine, state->de, val);
+    state->hl += step;
+    state->de += step;
+    state->bc--;
+    // Bits 3 and 5 come from bits 3 and 1 of A plus the byte copied
+    val += state->a;
+    state->f = (state->f & (FLAG_S | FLAG_Z | FLAG_C)) | (val & FLAG_3) |
+      ((val << 4) & FLAG_5) | (state->bc ? FLAG_PV : 0);
+    more = state->bc != 0;
+    break;
+
+  case 1: // CPI/CPD: compare A with (HL), C kept
+    val = mem_read(state->machine, state->hl);
+    state->hl += step;
+    state->bc--;
+    res = state->a - val;
+    val = szhvc_sub[(state->a << 8) | val];
+    state->f = (val & (FLAG_S | FLAG_Z | FLAG_H | FLAG_N)) | (state->f & FLAG_C) |
+      (state->bc ? FLAG_PV : 0);
+    res -= (val & FLAG_H) ? 1 : 0;
+    state->f |= (res & FLAG_3) | ((res << 4) & FLAG_5);
+    more = state->bc != 0 && !(state->f & FLAG_Z);
+    break;
+
+  case 2: // INI/IND: (HL) <- IN (C), B counts
+    val = input_port(state->machine, state->bc);
+    mem_write(state->machine, state->hl, val);
+    state->hl += step;
+    state->b--;
+    state->f = (state->f & FLAG_C) | sz_table[state->b] | FLAG_N;
+    more = state->b != 0;
+    break;
+
+  default: // OUTI/OUTD: OUT (C) <- (HL), B counts before the write
+    val = mem_read(state->machine, state->hl);
+    state->b--;
+    output_port(state->machine, state->bc, val);
+    state->hl += step;
+    state->f = (state->f & FLAG_C) | sz_table[state->b] | FLAG_N;
+    more = state->b != 0;
+    break;
+  }
+
+  return (opcode & 0x10) && more;
+}
+
+// Block instructions run one iteration per execution. One that has to go
+// round again leaves the PC on itself, so it can be interrupted between
+// iterations, and ends the dispatcher's pass: z80_run carries on with
+// z80_block_run instead of dispatching it once per byte.
+static int block_instruction(Z80_State* state, uint8_t opcode) {
+  if (!block_iteration(state, opcode)) {
+    state->block_op = 0;
+    return cycles_ed[opcode];
+  }
+
+  state->pc -= 2;
+  state->block_op = opcode;
+  state->run_exit = 1;
+  return cycles_ed[opcode] + 5;
+}
+
+// Accesses to contended memory are held up by the ULA (memory.c), so the
+// shortcuts that skip them are not taken there
+static inline bool contended(Z80_State* state, uint16_t addr) {
+  return state->machine->memory.contended[addr >> MEM_SLOT_SHIFT];
+}
+
+// Do up to n iterations of LDIR/LDDR/CPIR/CPDR at once through the bulk
+// memory functions, none of them the last one. Registers are left as the
+// single iterations would leave them; flags are left to the iteration that
+// follows, which recomputes all of them. The bulk functions work on one bank
+// at a time, so this stops at the first 16K boundary. Returns the iterations
+// done, 0 if the bulk path does not apply.
+static uint32_t block_bulk(Z80_State* state, uint8_t opcode, uint32_t n) {
+  bool down = opcode & 0x08;
+  bool copy = (opcode & 0x03) == 0;
+  uint32_t done;
+
+  // Room left in the slots of HL and DE in the direction of the copy
+  uint32_t room = down ? (state->hl & MEM_SLOT_MASK) + 1 : MEM_SLOT_SIZE - (state->hl & MEM_SLOT_MASK);
+  if (n > room)
+    n = room;
+  room = down ? (state->de & MEM_SLOT_MASK) + 1 : MEM_SLOT_SIZE - (state->de & MEM_SLOT_MASK);
+  if (copy && n > room)
+    n = room;
+  if (n == 0)
+    return 0;
+
+  uint16_t src = down ? state->hl - (n - 1) : state->hl;
+  if (contended(state, src) || contended(state, state->pc) ||
+    (copy && contended(state, state->de)))
+    return 0;
+  if (!copy) {
+    // CPIR/CPDR stop on the first byte equal to A
+    done = mem_find(state->machine, src, state->a, n, down);
+    state->hl += down ? -done : done;
+    state->bc -= done;
+    return done;
+  }
+
+  uint16_t dst = down ? state->de - (n - 1) : state->de;
+  // The instruction has to be fetched again after every iteration
+  if ((uint16_t)(state->pc - dst) < n || (uint16_t)(state->pc + 1 - dst) < n)
+    return 0;
+  if (!mem_copy(state->machine, dst, src, n, down))
     return 0;
+
+  state->hl += down ? -n : n;
+  state->de += down ? -n : n;
+  state->bc -= n;
+  return n;
+}
+
+// Carry on with the repeating block instruction in state->block_op until it
+// finishes or the iteration that crosses limit T-states of the pass has run.
+static void z80_block_run(Z80_State* state, int limit) {
+  uint8_t opcode = state->block_op;
+  uint16_t pc = state->pc;
+
+  state->block_op = 0;
+  // Let the dispatcher fetch whatever has replaced the instruction
+  if (mem_peek(state->machine, pc) != 0xED || mem_peek(state->machine, (uint16_t)(pc + 1)) != opcode)
+    return;
+
+  while (state->pass_cycles < limit) {
+    if (!(opcode & 0x02)) {
+      uint32_t count = state->bc ? state->bc : 0x10000;
+      uint32_t fit = ((uint32_t)(limit - state->pass_cycles) + 20) / 21;
+      uint32_t done = block_bulk(state, opcode, (count < fit ? count : fit) - 1);
+      add_r(state, done * 2);
+      state->pass_cycles += done * 21;
+    }
+    // Each iteration fetches ED and the opcode again
+    add_r(state, 2);
+    state->access_cycles = 8;
+    if (!block_iteration(state, opcode)) {
+      state->pc = pc + 2;
+      state->pass_cycles += cycles_ed[opcode];
+      return;
+    }
+    state->pass_cycles += 21;
+    if (mem_peek(state->machine, pc) != 0xED || mem_peek(state->machine, (uint16_t)(pc + 1)) != opcode)
+      return;
   }
+
+  state->block_op = opcode;
 }
 
 int decode_ed(Z80_State* state) {
-  uint8_t opcode = mem_read(state->pc++);
+  uint8_t opcode = mem_fetch(state->machine, state->pc++);
+  int cycles = cycles_ed[opcode];
   uint8_t temp;
   uint16_t temp16;
   uint8_t n;
   uint8_t carry;
   uint8_t res;
-  uint8_t port;
+  uint16_t port;
 
   switch (opcode) {
   case 0x40: // IN B,(C)
-    port = state->c;
-    state->b = input_port(state, port);
+    port = state->bc;
+    state->b = input_port(state->machine, port);
     break;
 
   case 0x41: // OUT (C),B
-    port = state->c;
-    output_port(state, port, state->b);
+    port = state->bc;
+    output_port(state->machine, port, state->b);
     break;
 
   case 0x42: // SBC HL,BC
@@ -3497,8 +3780,8 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x43: // LD (nnnn),BC
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    mem_write16(temp16, state->bc);
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    mem_write16(state->machine, temp16, state->bc);
     break;
 
   case 0x47: // LD I,A
@@ -3506,13 +3789,13 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x48: // IN C,(C)
-    port = state->c;
-    state->c = input_port(state, port);
+    port = state->bc;
+    state->c = input_port(state->machine, port);
     break;
 
   case 0x49: // OUT (C),C
-    port = state->c;
-    output_port(state, port, state->c);
+    port = state->bc;
+    output_port(state->machine, port, state->c);
     break;
 
   case 0x4a: // ADC HL,BC
@@ -3528,8 +3811,8 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x4b: // LD BC,(nnnn)
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    state->bc = mem_read16(temp16);
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    state->bc = mem_read16(state->machine, temp16);
     break;
 
   case 0x4d: // RETI
@@ -3541,13 +3824,13 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x50: // IN D,(C)
-    port = state->c;
-    state->d = input_port(state, port);
+    port = state->bc;
+    state->d = input_port(state->machine, port);
     break;
 
   case 0x51: // OUT (C),D
-    port = state->c;
-    output_port(state, port, state->d);
+    port = state->bc;
+    output_port(state->machine, port, state->d);
     break;
 
   case 0x52: // SBC HL,DE
@@ -3563,8 +3846,8 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x53: // LD (nnnn),DE
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    mem_write16(temp16, state->de);
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    mem_write16(state->machine, temp16, state->de);
     break;
 
   case 0x57: // LD A,I
@@ -3572,13 +3855,13 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x58: // IN E,(C)
-    port = state->c;
-    state->e = input_port(state, port);
+    port = state->bc;
+    state->e = input_port(state->machine, port);
     break;
 
   case 0x59: // OUT (C),E
-    port = state->c;
-    output_port(state, port, state->e);
+    port = state->bc;
+    output_port(state->machine, port, state->e);
     break;
 
   case 0x5a: // ADC HL,DE
@@ -3594,8 +3877,8 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x5b: // LD DE,(nnnn)
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    state->de = mem_read16(temp16);
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    state->de = mem_read16(state->machine, temp16);
     break;
 
   case 0x5f: // LD A,R
@@ -3603,13 +3886,13 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x60: // IN H,(C)
-    port = state->c;
-    state->h = input_port(state, port);
+    port = state->bc;
+    state->h = input_port(state->machine, port);
     break;
 
   case 0x61: // OUT (C),H
-    port = state->c;
-    output_port(state, port, state->h);
+    port = state->bc;
+    output_port(state->machine, port, state->h);
     break;
 
   case 0x62: // SBC HL,HL
@@ -3624,24 +3907,24 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x63: // LD (nnnn),HL
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    mem_write16(temp16, state->hl);
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    mem_write16(state->machine, temp16, state->hl);
     break;
 
   case 0x67: // RRD
-    temp = (mem_read(state->hl) & 0xF0) | (state->a & 0x0F);
-    state->a = (state->a >> 4) | (mem_read(state->hl) << 4);
-    mem_write(state->hl, temp);
+    temp = (mem_read(state->machine, state->hl) & 0xF0) | (state->a & 0x0F);
+    state->a = (state->a >> 4) | (mem_read(state->machine, state->hl) << 4);
+    mem_write(state->machine, state->hl, temp);
     break;
 
   case 0x68: // IN L,(C)
-    port = state->c;
-    state->l = input_port(state, port);
+    port = state->bc;
+    state->l = input_port(state->machine, port);
     break;
 
   case 0x69: // OUT (C),L
-    port = state->c;
-    output_port(state, port, state->l);
+    port = state->bc;
+    output_port(state->machine, port, state->l);
     break;
 
   case 0x6a: // ADC HL,HL
@@ -3656,28 +3939,31 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x6b: // LD HL,(nnnn)
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    state->hl = mem_read16(temp16);
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    state->hl = mem_read16(state->machine, temp16);
     break;
 
-  case 0x6e: // IM 0
+  case 0x46: // IM 0
+  case 0x4e: // IM 0 (undocumented)
+  case 0x66: // IM 0 (undocumented)
+  case 0x6e: // IM 0 (undocumented)
     state->imode = 0;
     break;
 
   case 0x6f: // RLD
-    temp = (mem_read(state->hl) & 0xF0) | (state->a & 0x0F);
-    state->a = (state->a >> 4) | (mem_read(state->hl) << 4);
-    mem_write(state->hl, temp);
+    temp = (mem_read(state->machine, state->hl) & 0xF0) | (state->a & 0x0F);
+    state->a = (state->a >> 4) | (mem_read(state->machine, state->hl) << 4);
+    mem_write(state->machine, state->hl, temp);
     break;
 
   case 0x70: // IN F,(C)
-    port = state->c;
-    state->f = input_port(state, port);
+    port = state->bc;
+    state->f = input_port(state->machine, port);
     break;
 
   case 0x71: // OUT (C),0
-    port = state->c;
-    output_port(state, port, 0);
+    port = state->bc;
+    output_port(state->machine, port, 0);
     break;
 
   case 0x72: // SBC HL,SP
@@ -3692,22 +3978,23 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x73: // LD (nnnn),SP
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    mem_write16(temp16, state->sp);
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    mem_write16(state->machine, temp16, state->sp);
     break;
 
-  case 0x76: // IM 1
+  case 0x56: // IM 1
+  case 0x76: // IM 1 (undocumented)
     state->imode = 1;
     break;
 
   case 0x78: // IN A,(C)
-    port = state->c;
-    state->a = input_port(state, port);
+    port = state->bc;
+    state->a = input_port(state->machine, port);
     break;
 
   case 0x79: // OUT (C),A
-    port = state->c;
-    output_port(state, port, state->a);
+    port = state->bc;
+    output_port(state->machine, port, state->a);
     break;
 
   case 0x7a: // ADC HL,SP
@@ -3722,8 +4009,8 @@ int decode_ed(Z80_State* state) {
     break;
 
   case 0x7b: // LD SP,(nnnn)
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    state->sp = mem_read16(temp16);
+    temp16 = (mem_read(state->machine, state->pc++) | (mem_read(state->machine, state->pc++) << 8));
+    state->sp = mem_read16(state->machine, temp16);
     break;
 
   case 0x7c: // NEG
@@ -3737,3027 +4024,780 @@ int decode_ed(Z80_State* state) {
     state->f |= FLAG_N;
     break;
 
-  case 0x7d: // RETN
-    temp16 = pop16(state);
-    state->pc = temp16;
+  case 0x45: // RETN
+  case 0x55: // RETN (undocumented)
+  case 0x5d: // RETN (undocumented)
+  case 0x65: // RETN (undocumented)
+  case 0x6d: // RETN (undocumented)
+  case 0x75: // RETN (undocumented)
+  case 0x7d: // RETN (undocumented)
+    z80_int_reti(state);
     break;
 
-  case 0x7e: // IM 2
+  case 0x5e: // IM 2
+  case 0x7e: // IM 2 (undocumented)
     state->imode = 2;
     break;
 
   case 0xa0: // LDI
-    temp = mem_read(state->de);
-    mem_write(state->hl, temp);
-    state->de++;
-    state->hl++;
-    state->bc--;
-    break;
-
   case 0xa1: // CPI
-    temp = mem_read(state->hl);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_S | FLAG_H | FLAG_PV | FLAG_N);
-    state->f |= (temp == state->a) ? FLAG_Z : 0;
-    state->f |= (temp < state->a) ? FLAG_C : 0;
-    state->f |= (temp & 0x80) ? FLAG_S : 0;
-    state->f |= (temp & 0x10) ? FLAG_H : 0;
-    state->f |= parity_table[(temp & 0x7F)] ? FLAG_PV : 0;
-    state->f |= FLAG_N; // N flag is always set
-    state->hl++;
-    state->bc--;
-    break;
-
   case 0xa2: // INI
-    temp = mem_read(state->de);
-    mem_write(state->hl, temp);
-    state->de++;
-    state->hl++;
-    state->bc--;
-    output_port(state, 0xfe, state->c);
-    break;
-
   case 0xa3: // OUTI
-    temp = mem_read(state->de);
-    output_port(state, 0xfe, state->c);
-    mem_write(state->hl, temp);
-    state->de++;
-    state->hl++;
-    state->bc--;
-    break;
-
   case 0xa8: // LDD
-    temp = mem_read(state->de);
-    mem_write(state->hl, temp);
-    state->de--;
-    state->hl--;
-    state->bc--;
-    break;
-
   case 0xa9: // CPD
-    temp = mem_read(state->hl);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_S | FLAG_H | FLAG_PV | FLAG_N);
-    state->f |= (temp == state->a) ? FLAG_Z : 0;
-    state->f |= (temp < state->a) ? FLAG_C : 0;
-    state->f |= (temp & 0x80) ? FLAG_S : 0;
-    state->f |= (temp & 0x10) ? FLAG_H : 0;
-    state->f |= parity_table[(temp & 0x7F)] ? FLAG_PV : 0;
-    state->f |= FLAG_N; // N flag is always set
-    state->hl--;
-    state->bc--;
-    break;
-
   case 0xaa: // IND
-    temp = mem_read(state->de);
-    mem_write(state->hl, temp);
-    state->de--;
-    state->hl--;
-    state->bc--;
-    output_port(state, 0xfe, state->c);
-    break;
-
   case 0xab: // OUTD
-    temp = mem_read(state->de);
-    output_port(state, 0xfe, state->c);
-    mem_write(state->hl, temp);
-    state->de--;
-    state->hl--;
-    state->bc--;
-    break;
-
   case 0xb0: // LDIR
-    temp = mem_read(state->de);
-    mem_write(state->hl, temp);
-    state->de++;
-    state->hl++;
-    state->bc--;
-    while (state->bc != 0) {
-      temp = mem_read(state->de);
-      mem_write(state->hl, temp);
-      state->de++;
-      state->hl++;
-      state->bc--;
-    }
-    break;
-
   case 0xb1: // CPIR
-    temp = mem_read(state->hl);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_S | FLAG_H | FLAG_PV | FLAG_N);
-    state->f |= (temp == state->a) ? FLAG_Z : 0;
-    state->f |= (temp < state->a) ? FLAG_C : 0;
-    state->f |= (temp & 0x80) ? FLAG_S : 0;
-    state->f |= (temp & 0x10) ? FLAG_H : 0;
-    state->f |= parity_table[(temp & 0x7F)] ? FLAG_PV : 0;
-    state->f |= FLAG_N; // N flag is always set
-    state->hl++;
-    state->bc--;
-    while (state->bc != 0) {
-      temp = mem_read(state->hl);
-      state->f &= ~(FLAG_C | FLAG_Z | FLAG_S | FLAG_H | FLAG_PV | FLAG_N);
-      state->f |= (temp == state->a) ? FLAG_Z : 0;
-      state->f |= (temp < state->a) ? FLAG_C : 0;
-      state->f |= (temp & 0x80) ? FLAG_S : 0;
-      state->f |= (temp & 0x10) ? FLAG_H : 0;
-      state->f |= parity_table[(temp & 0x7F)] ? FLAG_PV : 0;
-      state->f |= FLAG_N; // N flag is always set
-      state->hl++;
-      state->bc--;
-    }
-    break;
-
   case 0xb2: // INIR
-    temp = mem_read(state->de);
-    mem_write(state->hl, temp);
-    state->de++;
-    state->hl++;
-    state->bc--;
-    output_port(state, 0xfe, state->c);
-    while (state->bc != 0) {
-      temp = mem_read(state->de);
-      mem_write(state->hl, temp);
-      state->de++;
-      state->hl++;
-      state->bc--;
-      output_port(state, 0xfe, state->c);
-    }
-    break;
-
   case 0xb3: // OTIR
-    temp = mem_read(state->de);
-    output_port(state, 0xfe, state->c);
-    mem_write(state->hl, temp);
-    state->de++;
-    state->hl++;
-    state->bc--;
-    while (state->bc != 0) {
-      temp = mem_read(state->de);
-      output_port(state, 0xfe, state->c);
-      mem_write(state->hl, temp);
-      state->de++;
-      state->hl++;
-      state->bc--;
-    }
-    break;
-
   case 0xb8: // LDDR
-    temp = mem_read(state->de);
-    mem_write(state->hl, temp);
-    state->de--;
-    state->hl--;
-    state->bc--;
-    while (state->bc != 0) {
-      temp = mem_read(state->de);
-      mem_write(state->hl, temp);
-      state->de--;
-      state->hl--;
-      state->bc--;
-    }
-    break;
-
   case 0xb9: // CPDR
-    temp = mem_read(state->hl);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_S | FLAG_H | FLAG_PV | FLAG_N);
-    state->f |= (temp == state->a) ? FLAG_Z : 0;
-    state->f |= (temp < state->a) ? FLAG_C : 0;
-    state->f |= (temp & 0x80) ? FLAG_S : 0;
-    state->f |= (temp & 0x10) ? FLAG_H : 0;
-    state->f |= parity_table[(temp & 0x7F)] ? FLAG_PV : 0;
-    state->f |= FLAG_N; // N flag is always set
-    state->hl--;
-    state->bc--;
-    while (state->bc != 0) {
-      temp = mem_read(state->hl);
-      state->f &= ~(FLAG_C | FLAG_Z | FLAG_S | FLAG_H | FLAG_PV | FLAG_N);
-      state->f |= (temp == state->a) ? FLAG_Z : 0;
-      state->f |= (temp < state->a) ? FLAG_C : 0;
-      state->f |= (temp & 0x80) ? FLAG_S : 0;
-      state->f |= (temp & 0x10) ? FLAG_H : 0;
-      state->f |= parity_table[(temp & 0x7F)] ? FLAG_PV : 0;
-      state->f |= FLAG_N; // N flag is always set
-      state->hl--;
-      state->bc--;
-    }
-    break;
-
   case 0xba: // INDR
-    temp = mem_read(state->de);
-    mem_write(state->hl, temp);
-    state->de--;
-    state->hl--;
-    state->bc--;
-    output_port(state, 0xfe, state->c);
-    while (state->bc != 0) {
-      temp = mem_read(state->de);
-      mem_write(state->hl, temp);
-      state->de--;
-      state->hl--;
-      state->bc--;
-      output_port(state, 0xfe, state->c);
-    }
-    break;
-
   case 0xbb: // OTDR
-    temp = mem_read(state->de);
-    output_port(state, 0xfe, state->c);
-    mem_write(state->hl, temp);
-    state->de--;
-    state->hl--;
-    state->bc--;
-    while (state->bc != 0) {
-      temp = mem_read(state->de);
-      output_port(state, 0xfe, state->c);
-      mem_write(state->hl, temp);
-      state->de--;
-      state->hl--;
-      state->bc--;
-    }
+    cycles = block_instruction(state, opcode);
     break;
-    
+
   default:
     printf("Unknown ED opcode: %02X\n", opcode);
-    return 0;
+    return -1;
   }
+
+  return cycles;
 }
 
-int decode_fd(Z80_State* state) {
-  uint8_t opcode = mem_read(state->pc++);
+
+
+// Execute one instruction without touching the cycle counter. Shared by
+// z80_step and the z80_run loop so the latter can keep its budget local.
+static inline int z80_execute(Z80_State* state) {
+  state->access_cycles = 0;
+  uint8_t opcode = mem_fetch(state->machine, state->pc++);
+  int cycles = cycles_main[opcode];
   uint8_t temp;
   uint16_t temp16;
   uint8_t n;
   uint8_t carry;
   uint8_t res;
   uint8_t port;
+  uint8_t tempA;
+  uint8_t tempF;
 
+  SYNC_FLAGS_FOR(state, opcode);
   switch (opcode) {
+#define OPCODE(op) case op:
+#define NEXT break
+#include "z80_ops.inc"
+#undef OPCODE
+#undef NEXT
+  }
 
-  case 0x09: // ADD IY,BC
-    state->iy += state->bc;
-    break;
+  return cycles;
+}
 
-  case 0x19: // ADD IY,DE
-    state->iy += state->de;
-    break;
+// Fire every event that is due
+static void z80_run_events(Z80_State* state) {
+  while (scheduler_next(&state->scheduler) <= state->cycles) {
+    Z80_Event event = scheduler_pop(&state->scheduler);
+    event.handler(state, event.time, event.data);
+  }
+}
 
-  case 0x21: // LD IY,nnnn
-    state->iy = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    break;
+// HALT leaves the PC on itself; an interrupt returns to the instruction after
+static inline void z80_leave_halt(Z80_State* state) {
+  if (state->halted) {
+    state->halted = 0;
+    state->pc++;
+  }
+}
 
-  case 0x22: // LD (nnnn),IY
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    mem_write16(temp16, state->iy);
-    break;
+// Take a pending NMI or maskable interrupt at an instruction boundary and
+// return the T-states the acknowledge took, 0 if there was nothing to take.
+static int z80_interrupt(Z80_State* state) {
+  if (!state->nmi_pending && (!state->int_line || !state->iff1 || state->ei_delay))
+    return 0;
 
-  case 0x23: // INC IY
-    state->iy++;
-    break;
+  // A block instruction is taken again from the start after the handler
+  state->block_op = 0;
+  if (state->nmi_pending) {
+    state->nmi_pending = 0;
+    z80_leave_halt(state);
+    state->iff2 = state->iff1;
+    state->iff1 = 0;
+    // The PC goes on the stack after a 5 T-state fetch cycle
+    add_r(state, 1);
+    state->access_cycles = 5;
+    push16(state, state->pc);
+    state->pc = 0x0066;
+    return 11;
+  }
 
-  case 0x24: // INC IYH
-    state->iy = (state->iy & 0x00FF) | ((state->iy + 0x0100) & 0xFF00);
-    break;
+  state->iff1 = state->iff2 = 0;
+  z80_leave_halt(state);
+  // and after the 7 T-state acknowledge, an M1 cycle of its own
+  add_r(state, 1);
+  state->access_cycles = 7;
+  push16(state, state->pc);
+  if (state->imode == 2) {
+    // Nothing drives the data bus during the acknowledge, so the low byte
+    // of the vector address reads as 0xFF
+    uint16_t vector = (state->i << 8) | 0xFF;
+    state->pc = mem_read(state->machine, vector) | (mem_read(state->machine, (uint16_t)(vector + 1)) << 8);
+    return 19;
+  }
+  // IM 1, and IM 0 with 0xFF (RST 38h) on the floating bus
+  state->pc = 0x0038;
+  return 13;
+}
 
-  case 0x25: // DEC IYH
-    state->iy = (state->iy & 0x00FF) | ((state->iy - 0x0100) & 0xFF00);
-    break;
+int z80_step(Z80_State* state) {
+  z80_run_events(state);
+  state->pass_cycles = 0;
+  int cycles = z80_interrupt(state);
+  if (!cycles) {
+    state->ei_delay = 0;
+    cycles = z80_execute(state);
+  }
+  SYNC_FLAGS(state);
+  if (cycles < 0)
+    return cycles;
+
+  // Plus whatever contended accesses were held up for
+  cycles += state->pass_cycles;
+  state->pass_cycles = 0;
+  state->cycles += cycles;
+  return cycles;
+}
 
-  case 0x26: // LD IYH,nn
-    state->iy = (state->iy & 0x00FF) | (mem_read(state->pc++) << 8);
-    break;
+#if defined(__GNUC__) && !defined(Z80_NO_COMPUTED_GOTO)
+#define Z80_HAVE_COMPUTED_GOTO
+static int dispatch_mode = Z80_DISPATCH_THREADED;
+#else
+static int dispatch_mode = Z80_DISPATCH_SWITCH;
+#endif
+
+// Portable dispatcher: one switch per instruction.
+static void z80_run_switch(Z80_State* state, int cycle_budget) {
+  while (state->pass_cycles < cycle_budget && !state->run_exit) {
+    int cycles = z80_execute(state);
+    // Unimplemented opcodes are reported by the decoders, treat them as a NOP
+    state->pass_cycles += cycles > 0 ? cycles : 4;
+  }
+}
 
-  case 0x29: // ADD IY,IY
-    state->iy += state->iy;
-    break;
+#ifdef Z80_HAVE_COMPUTED_GOTO
+// Threaded dispatcher: every handler ends with its own budget check and
+// indirect jump to the next handler, so the branch predictor sees one
+// dispatch site per opcode instead of a single shared one.
+static void z80_run_threaded(Z80_State* state, int cycle_budget) {
+  static const void* const dispatch[256] = {
+    &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+    &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+    &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+    &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+    &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+    &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+    &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+    &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+    &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+    &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+    &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+    &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+    &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+    &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+    &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+    &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+    &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+    &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+    &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+    &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+    &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+    &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+    &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+    &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+    &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+    &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+    &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+    &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_0xDB, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+    &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_0xE3, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+    &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_0xEB, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+    &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+    &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_0xFF
+  };
+  uint8_t opcode;
+  int cycles;
+  uint8_t temp;
+  uint16_t temp16;
+  uint8_t n;
+  uint8_t carry;
+  uint8_t res;
+  uint8_t port;
+  uint8_t tempA;
+  uint8_t tempF;
 
-  case 0x2a: // LD IY,(nnnn)
-    temp16 = (mem_read(state->pc++) | (mem_read(state->pc++) << 8));
-    state->iy = mem_read16(temp16);
-    break;
+  if (state->pass_cycles >= cycle_budget || state->run_exit)
+    return;
+
+  state->access_cycles = 0;
+  opcode = mem_fetch(state->machine, state->pc++);
+  cycles = cycles_main[opcode];
+  SYNC_FLAGS_FOR(state, opcode);
+  goto *dispatch[opcode];
+
+#define OPCODE(op) op_##op:
+#define NEXT \
+  do { \
+    state->pass_cycles += cycles > 0 ? cycles : 4; \
+    if (state->pass_cycles >= cycle_budget || state->run_exit) \
+      return; \
+    state->access_cycles = 0; \
+    opcode = mem_fetch(state->machine, state->pc++); \
+    cycles = cycles_main[opcode]; \
+    SYNC_FLAGS_FOR(state, opcode); \
+    goto *dispatch[opcode]; \
+  } while (0)
+#include "z80_ops.inc"
+#undef OPCODE
+#undef NEXT
+}
+#endif
+
+#ifdef Z80_HAVE_JIT
+// For the code z80_jit.c generates
+const uint8_t* const jit_szp_table = szp_table;
+const uint8_t* const jit_szhv_inc = szhv_inc;
+const uint8_t* const jit_szhv_dec = szhv_dec;
+const uint8_t* const jit_szhvc_add = szhvc_add;
+const uint8_t* const jit_szhvc_sub = szhvc_sub;
+#endif
+
+// Block cache. A block is the run of main opcodes the interpreter actually
+// executed from a given PC, up to the first jump or call; replaying it skips the
+// opcode fetch and dispatch lookup, while the handlers still read their own
+// operands. Each entry stores the PC it was recorded at, and replay leaves the
+// block as soon as the PC disagrees, so a branch going the other way costs
+// nothing but a lookup.
+#define BLOCK_MAX_LENGTH 16
+#define BLOCK_MAX_BYTES (BLOCK_MAX_LENGTH * 4)
+#define BLOCK_CACHE_SIZE 16384
+
+typedef struct {
+  const void* handler;
+  uint16_t pc;
+  uint8_t opcode;
+} Z80_BlockEntry;
+
+typedef struct Z80_Block {
+  int length;
+  struct Z80_Block* next_free;
+#ifdef Z80_HAVE_JIT
+  // Translation of the first jit_length entries, made after JIT_THRESHOLD runs
+  Z80_JitCode jit;
+  int jit_length;
+  int jit_cycles;
+  int runs;
+#endif
+  Z80_BlockEntry entries[BLOCK_MAX_LENGTH];
+} Z80_Block;
+
+// One per machine (ZX_Machine.block_cache). Blocks are handed out in order,
+// then from the list of invalidated ones; the whole cache is flushed when
+// both run out.
+typedef struct Z80_BlockCache {
+  int block_count;
+  Z80_Block* free_blocks;
+  Z80_BlockCacheStats stats;
+  // Set when a write lands on a page with cached code, checked between
+  // instructions so a block that modifies itself is left straight away
+  uint8_t code_modified;
+#ifdef Z80_HAVE_JIT
+  Z80_Jit* jit;
+  bool jit_failed;
+#endif
+  Z80_Block* block_at[MEM_SIZE];
+  Z80_Block blocks[BLOCK_CACHE_SIZE];
+} Z80_BlockCache;
+
+void z80_flush_block_cache(Z80_State* state) {
+  Z80_BlockCache* cache = state->machine->block_cache;
+
+  mem_clear_code(state->machine);
+  if (!cache)
+    return;
+  memset(cache->block_at, 0, sizeof(cache->block_at));
+  cache->block_count = 0;
+  cache->free_blocks = NULL;
+  cache->code_modified = 1;
+  cache->stats.flushes++;
+#ifdef Z80_HAVE_JIT
+  if (cache->jit)
+    jit_flush(cache->jit);
+#endif
+}
 
-  case 0x2b: // DEC IY
-    state->iy--;
-    break;
+void z80_free_block_cache(Z80_State* state) {
+  Z80_BlockCache* cache = state->machine->block_cache;
+
+  if (!cache)
+    return;
+  mem_clear_code(state->machine);
+#ifdef Z80_HAVE_JIT
+  jit_destroy(cache->jit);
+#endif
+  free(cache);
+  state->machine->block_cache = NULL;
+}
 
-  case 0x2c: // INC IYL
-    state->iy = (state->iy & 0xFF00) | ((state->iy + 0x0100) & 0x00FF);
-    break;
+void z80_get_block_cache_stats(Z80_State* state, Z80_BlockCacheStats* stats) {
+  Z80_BlockCache* cache = state->machine->block_cache;
 
-  case 0x2d: // DEC IYL
-    state->iy = (state->iy & 0xFF00) | ((state->iy - 0x0100) & 0x00FF);
-    break;
+  if (cache)
+    *stats = cache->stats;
+  else
+    memset(stats, 0, sizeof(*stats));
+}
 
-  case 0x2e: // LD IYL,nn
-    state->iy = (state->iy & 0xFF00) | mem_read(state->pc++);
-    break;
+void z80_invalidate_code(Z80_State* state, uint32_t addr) {
+  Z80_BlockCache* cache = state->machine->block_cache;
+  // A block spans at most BLOCK_MAX_BYTES, so anything reaching into this
+  // page starts at most that far before it
+  uint32_t page = addr >> CODE_PAGE_SHIFT;
+  uint32_t first = (page << CODE_PAGE_SHIFT) >= BLOCK_MAX_BYTES ?
+    (page << CODE_PAGE_SHIFT) - BLOCK_MAX_BYTES : 0;
+  uint32_t last = (page + 1) << CODE_PAGE_SHIFT;
+
+  state->machine->memory.code_pages[page] = 0;
+  if (!cache)
+    return;
+  for (uint32_t pc = first; pc < last; pc++) {
+    Z80_Block* block = cache->block_at[pc];
+    if (block) {
+      cache->block_at[pc] = NULL;
+      block->next_free = cache->free_blocks;
+      cache->free_blocks = block;
+    }
+  }
+  cache->code_modified = 1;
+  cache->stats.invalidations++;
+}
 
-  case 0x34: // INC (IY+dd)
-    temp = mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), ++temp);
-    break;
+#ifdef Z80_HAVE_COMPUTED_GOTO
+
+// Main opcodes that can move the PC anywhere but on to the next instruction
+// (jumps, calls, returns, RST, HALT and the DD/ED/FD prefixes); a block ends
+// after the first of them
+static const uint8_t block_ends[256] = {
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    1,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,
+    1,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,
+    1,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    1,0,1,1,1,0,0,1,1,1,1,0,1,1,0,1,
+    1,0,1,0,1,0,0,1,1,0,1,0,1,1,0,1,
+    1,0,1,0,1,0,0,1,1,1,1,0,1,1,0,1,
+    1,0,1,0,1,0,0,1,1,0,1,0,1,1,0,1
+};
 
-  case 0x35: // DEC (IY+dd)
-    temp = mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), --temp);
-    break;
+static inline void mark_code(Z80_State* state, uint16_t pc) {
+  mem_mark_code(state->machine, pc);
+  mem_mark_code(state->machine, pc + 3);
+}
 
-  case 0x36: // LD (IY+dd),nn
-    temp = mem_read(state->pc++);
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), temp);
-    break;
+// Run instructions through the interpreter from state->pc, recording them as
+// a new block. The block is only published if no write hit its own code
+// while it was being recorded.
+static void record_block(Z80_State* state, Z80_BlockCache* cache, int cycle_budget,
+  Z80_Block** recorded) {
+  if (!cache->free_blocks && cache->block_count == BLOCK_CACHE_SIZE)
+    z80_flush_block_cache(state);
+
+  Z80_Block* block = cache->free_blocks ? cache->free_blocks : &cache->blocks[cache->block_count];
+  uint16_t start = state->pc;
+  block->length = 0;
+#ifdef Z80_HAVE_JIT
+  block->jit = NULL;
+  block->runs = 0;
+#endif
+  cache->code_modified = 0;
+  *recorded = NULL;
+
+  while (block->length < BLOCK_MAX_LENGTH && state->pass_cycles < cycle_budget &&
+    !state->run_exit) {
+    uint16_t pc = state->pc;
+    Z80_BlockEntry* entry = &block->entries[block->length];
+    entry->pc = pc;
+    entry->opcode = mem_peek(state->machine, pc);
+    mark_code(state, pc);
+
+    int cycles = z80_execute(state);
+    state->pass_cycles += cycles > 0 ? cycles : 4;
+    if (cache->code_modified)
+      return;
+    block->length++;
+
+    // Anything further than the longest instruction away was a jump too.
+    // Replay skips the opcode fetches, so blocks stay out of contended
+    // memory, where those are held up.
+    if (block_ends[entry->opcode] || (uint16_t)(state->pc - pc) > 4 ||
+      contended(state, state->pc))
+      break;
+  }
 
-  case 0x39: // ADD IY,SP
-    state->iy += state->sp;
-    break;
-
-  case 0x44: // LD B,IYH
-    state->b = state->iy >> 8;
-    break;
-
-  case 0x45: // LD B,IYL
-    state->b = state->iy & 0xFF;
-    break;
-
-  case 0x46: // LD B,(IY+dd)
-    state->b = mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    break;
-
-  case 0x4c: // LD C,IYH
-    state->c = state->iy >> 8;
-    break;
-
-  case 0x4d: // LD C,IYL
-    state->c = state->iy & 0xFF;
-    break;
-
-  case 0x4e: // LD C,(IY+dd)
-    state->c = mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    break;
-
-  case 0x54: // LD D,IYH
-    state->d = state->iy >> 8;
-    break;
-
-  case 0x55: // LD D,IYL
-    state->d = state->iy & 0xFF;
-    break;
-
-  case 0x56: // LD D,(IY+dd)
-    state->d = mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    break;
-
-  case 0x5c: // LD E,IYH
-    state->e = state->iy >> 8;
-    break;
-
-  case 0x5d: // LD E,IYL
-    state->e = state->iy & 0xFF;
-    break;
-
-  case 0x5e: // LD E,(IY+dd)
-    state->e = mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    break;
-
-  case 0x60: // LD IYH,B
-    state->iy = (state->iy & 0x00FF) | (state->b << 8);
-    break;
-
-  case 0x61: // LD IYH,C
-    state->iy = (state->iy & 0x00FF) | (state->c << 8);
-    break;
-
-  case 0x62: // LD IYH,D
-    state->iy = (state->iy & 0x00FF) | (state->d << 8);
-    break;
-
-  case 0x63: // LD IYH,E
-    state->iy = (state->iy & 0x00FF) | (state->e << 8);
-    break;
-
-  case 0x64: // LD IYH,IYH
-    break;
-
-  case 0x65: // LD IYH,IYL
-    state->iy = (state->iy & 0xFF00) | (state->iy & 0x00FF);
-    break;
-
-  case 0x66: // LD H,(IY+dd)
-    state->h = mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    break;
-
-  case 0x67: // LD IYH,A
-    state->iy = (state->iy & 0x00FF) | (state->a << 8);
-    break;
-
-  case 0x68: // LD IYL,B
-    state->iy = (state->iy & 0xFF00) | state->b;
-    break;
-
-  case 0x69: // LD IYL,C
-    state->iy = (state->iy & 0xFF00) | state->c;
-    break;
-
-  case 0x6a: // LD IYL,D
-    state->iy = (state->iy & 0xFF00) | state->d;
-    break;
-
-  case 0x6b: // LD IYL,E
-    state->iy = (state->iy & 0xFF00) | state->e;
-    break;
-
-  case 0x6c: // LD IYL,IYH
-    state->iy = (state->iy & 0x00FF) | (state->iy & 0xFF00);
-    break;
-
-  case 0x6d: // LD IYL,IYL
-    break;
-
-  case 0x6e: // LD L,(IY+dd)
-    state->l = mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    break;
-
-  case 0x6f: // LD IYL,A
-    state->iy = (state->iy & 0xFF00) | state->a;
-    break;
-
-  case 0x70: // LD (IY+dd),B
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), state->b);
-    break;
-
-  case 0x71: // LD (IY+dd),C
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), state->c);
-    break;
-
-  case 0x72: // LD (IY+dd),D
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), state->d);
-    break;
-
-  case 0x73: // LD (IY+dd),E
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), state->e);
-    break;
-
-  case 0x74: // LD (IY+dd),H
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), state->h);
-    break;
-
-  case 0x75: // LD (IY+dd),L
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), state->l);
-    break;
-
-  case 0x77: // LD (IY+dd),A
-    mem_write(state->iy + (int8_t)mem_read(state->pc++), state->a);
-    break;
-
-  case 0x7c: // LD A,IYH
-    state->a = state->iy >> 8;
-    break;
-
-  case 0x7d: // LD A,IYL
-    state->a = state->iy & 0xFF;
-    break;
-
-  case 0x7e: // LD A,(IY+dd)
-    state->a = mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    break;
-
-  case 0x84: // ADD A,IYH
-    state->a += state->iy >> 8;
-    UPDATE_FLAGS_ADD(state, state->a, state->iy >> 8);
-    break;
-
-  case 0x85: // ADD A,IYL
-    state->a += state->iy & 0xFF;
-    UPDATE_FLAGS_ADD(state, state->a, state->iy & 0xFF);    break;
-
-  case 0x86: // ADD A,(IY+dd)
-    state->a += mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    UPDATE_FLAGS_ADD(state, state->a, mem_read(state->iy + (int8_t)mem_read(state->pc++)));
-    break;
-
-  case 0x8c: // ADC A,IYH
-    state->a += (state->iy >> 8) + (state->f & FLAG_C);
-    UPDATE_FLAGS_ADD(state, state->a, state->iy >> 8);
-    break;
-
-  case 0x8d: // ADC A,IYL
-    state->a += state->iy & 0xFF + (state->f & FLAG_C);
-    UPDATE_FLAGS_ADD(state, state->a, state->iy & 0xFF);
-    break;
-
-  case 0x8e: // ADC A,(IY+dd)
-    state->a += mem_read(state->iy + (int8_t)mem_read(state->pc++)) + (state->f & FLAG_C);
-    UPDATE_FLAGS_ADD(state, state->a, mem_read(state->iy + (int8_t)mem_read(state->pc++)));
-    break;
-
-  case 0x94: // SUB A,IYH
-    state->a -= state->iy >> 8;
-    UPDATE_FLAGS_SUB(state, state->a, state->iy >> 8);
-    break;
-
-  case 0x95: // SUB A,IYL
-    state->a -= state->iy & 0xFF;
-    UPDATE_FLAGS_SUB(state, state->a, state->iy & 0xFF);
-    break;
-
-  case 0x96: // SUB A,(IY+dd)
-    state->a -= mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    UPDATE_FLAGS_SUB(state, state->a, mem_read(state->iy + (int8_t)mem_read(state->pc++)));
-    break;
-
-  case 0x9c: // SBC A,IYH
-    state->a -= state->iy >> 8 - (state->f & FLAG_C);
-    UPDATE_FLAGS_SUB(state, state->a, state->iy >> 8);
-    break;
-
-  case 0x9d: // SBC A,IYL
-    state->a -= state->iy & 0xFF - (state->f & FLAG_C);
-    UPDATE_FLAGS_SUB(state, state->a, state->iy & 0xFF);
-    break;
-
-  case 0x9e: // SBC A,(IY+dd)
-    state->a -= mem_read(state->iy + (int8_t)mem_read(state->pc++)) - (state->f & FLAG_C);
-    UPDATE_FLAGS_SUB(state, state->a, mem_read(state->iy + (int8_t)mem_read(state->pc++)));
-    break;
-
-  case 0xa4: // AND A,IYH
-    state->a &= state->iy >> 8;
-    UPDATE_FLAGS_LOGIC(state->a);
-    break;
-
-  case 0xa5: // AND A,IYL
-    state->a &= state->iy & 0xFF;
-    UPDATE_FLAGS_LOGIC(state->a);
-    break;
-
-  case 0xa6: // AND A,(IY+dd)
-    state->a &= mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    UPDATE_FLAGS_LOGIC(state->a);
-    break;
-
-  case 0xac: // XOR A,IYH
-    state->a ^= state->iy >> 8;
-    UPDATE_FLAGS_LOGIC(state->a);
-    break;
-
-  case 0xad: // XOR A,IYL
-    state->a ^= state->iy & 0xFF;
-    UPDATE_FLAGS_LOGIC(state->a);
-    break;
-
-  case 0xae: // XOR A,(IY+dd)
-    state->a ^= mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    UPDATE_FLAGS_LOGIC(state->a);
-    break;
-
-  case 0xb4: // OR A,IYH
-    state->a |= state->iy >> 8;
-    UPDATE_FLAGS_LOGIC(state->a);
-    break;
-
-  case 0xb5: // OR A,IYL
-    state->a |= state->iy & 0xFF;
-    UPDATE_FLAGS_LOGIC(state->a);
-    break;
-
-  case 0xb6: // OR A,(IY+dd)
-    state->a |= mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    UPDATE_FLAGS_LOGIC(state->a);
-    break;
+  if (block->length > 0) {
+    if (block == cache->free_blocks)
+      cache->free_blocks = block->next_free;
+    else
+      cache->block_count++;
+    cache->block_at[start] = block;
+    *recorded = block;
+  }
+  cache->stats.misses++;
+}
 
-  case 0xbc: // CP IYH
-    res = state->a - (state->iy >> 8);
-    UPDATE_FLAGS_SUB(state, state->a, state->iy >> 8);
-    state->a = res;
-    break;
+#ifdef Z80_HAVE_JIT
+// Blocks are translated once they have been replayed this often, and only if
+// they start with at least JIT_MIN_LENGTH instructions the translator knows
+#define JIT_THRESHOLD 16
+#define JIT_MIN_LENGTH 2
 
-  case 0xbd: // CP IYL
-    res = state->a - (state->iy & 0xFF);
-    UPDATE_FLAGS_SUB(state, state->a, state->iy & 0xFF);
-    state->a = res;
-    break;
+static bool jit_verify;
 
-  case 0xbe: // CP (IY+dd)
-    res = state->a - mem_read(state->iy + (int8_t)mem_read(state->pc++));
-    UPDATE_FLAGS_SUB(state, state->a, mem_read(state->iy + (int8_t)mem_read(state->pc++)));
-    state->a = res;
-    break;
+// Returns false if the code buffer was full and the cache had to be flushed
+static bool translate_block(Z80_State* state, Z80_BlockCache* cache, Z80_Block* block) {
+  int length = 0;
+  int cycles = 0;
 
-  case 0xCB:
-    return decode_fdcb(state);
+  // The code buffer is only mapped once there is something to put in it
+  if (!cache->jit && !cache->jit_failed) {
+    cache->jit = jit_create();
+    cache->jit_failed = !cache->jit;
+  }
+  if (!cache->jit)
+    return true;
 
-  case 0xe1: // POP IY
-    state->iy = pop16(state);
-    break;
+  while (length < block->length && jit_supported(block->entries[length].opcode))
+    cycles += cycles_main[block->entries[length++].opcode];
 
-  case 0xe3: // EX (SP),IY
-    temp16 = pop16(state);
-    push16(state, state->iy);
-    state->iy = temp16;
-    break;
+  if (length < JIT_MIN_LENGTH)
+    return true;
 
-  case 0xe5: // PUSH IY
-    push16(state, state->iy);
-    break;
+  block->jit = jit_translate(cache->jit, state->machine, block->entries[0].pc, length, cycles);
+  if (!block->jit) {
+    z80_flush_block_cache(state);
+    return false;
+  }
 
-  case 0xe9: // JP IY
-    state->pc = state->iy;
-    break;
+  block->jit_length = length;
+  block->jit_cycles = cycles;
+  cache->stats.jit_blocks++;
+  return true;
+}
 
-  case 0xf9: // LD SP,IY
-    state->sp = state->iy;
-    break;
+// Run the translated part of a block. In verify mode the same instructions
+// are first run through the interpreter on a copy of the state, and the
+// interpreter's result wins if the two disagree.
+static int run_jit_block(Z80_State* state, Z80_BlockCache* cache, Z80_Block* block) {
+  SYNC_FLAGS(state);
+  cache->stats.jit_runs++;
+  if (!jit_verify) {
+    // Translated instructions are all unprefixed: one M1 cycle each
+    add_r(state, block->jit_length);
+    return block->jit(state);
+  }
 
-  default:
-    printf("Unknown FD opcode: %02X\n", opcode);
-    return 0;
+  // The interpreter's fetches count up R in the live state
+  Z80_State expected = *state;
+  int expected_cycles = 0;
+  for (int i = 0; i < block->jit_length; i++)
+    expected_cycles += z80_execute(&expected);
+  SYNC_FLAGS(&expected);
+  expected.r = state->r;
+
+  int cycles = block->jit(state);
+  if (cycles != expected_cycles || state->pc != expected.pc || state->sp != expected.sp ||
+    state->af != expected.af || state->bc != expected.bc ||
+    state->de != expected.de || state->hl != expected.hl) {
+    printf("JIT mismatch in block at %04X: pc=%04X af=%04X bc=%04X de=%04X hl=%04X sp=%04X, "
+      "interpreter pc=%04X af=%04X bc=%04X de=%04X hl=%04X sp=%04X\n",
+      block->entries[0].pc, state->pc, state->af, state->bc, state->de, state->hl, state->sp,
+      expected.pc, expected.af, expected.bc, expected.de, expected.hl, expected.sp);
+    cache->stats.jit_mismatches++;
+    *state = expected;
+    return expected_cycles;
   }
+  return cycles;
 }
-
-int decode_fdcb(Z80_State* state) {
-  uint8_t opcode = mem_read(state->pc++);
+#endif
+
+static void z80_run_cached(Z80_State* state, int cycle_budget, bool use_jit) {
+  static const void* const dispatch[256] = {
+    &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+    &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+    &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+    &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+    &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+    &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+    &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+    &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+    &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+    &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+    &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+    &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+    &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+    &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+    &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+    &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+    &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+    &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+    &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+    &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+    &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+    &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+    &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+    &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+    &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+    &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+    &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+    &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_0xDB, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+    &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_0xE3, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+    &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_0xEB, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+    &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+    &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_0xFF
+  };
+  Z80_BlockCache* cache = state->machine->block_cache;
+  Z80_Block* block;
+  const Z80_BlockEntry* entry;
+  const Z80_BlockEntry* end;
+  uint8_t opcode;
+  int cycles;
   uint8_t temp;
-  uint8_t tempA;
-  uint8_t tempF;
   uint16_t temp16;
   uint8_t n;
   uint8_t carry;
   uint8_t res;
   uint8_t port;
+  uint8_t tempA;
+  uint8_t tempF;
 
-  switch (opcode) {
-
-  case 0x00: // LD B,RLC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 7) | (temp << 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->b = res;
-    break;
-
-  case 0x01: // LD C,RLC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 7) | (temp << 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->c = res;
-    break;
-
-  case 0x02: // LD D,RLC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 7) | (temp << 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->d = res;
-    break;
-
-  case 0x03: // LD E,RLC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 7) | (temp << 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->e = res;
-    break;
-
-  case 0x04: // LD H,RLC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 7) | (temp << 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->h = res;
-    break;
-
-  case 0x05: // LD L,RLC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 7) | (temp << 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->l = res;
-    break;
+next_block:
+  if (state->pass_cycles >= cycle_budget || state->run_exit)
+    return;
 
-  case 0x06: // RLC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 7) | (temp << 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
-    break;
+  // Code in contended memory is never cached, see record_block
+  if (contended(state, state->pc)) {
+    cycles = z80_execute(state);
+    state->pass_cycles += cycles > 0 ? cycles : 4;
+    goto next_block;
+  }
 
-  case 0x07: // LD A,RLC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 7) | (temp << 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->a = res;
-    break;
+  block = cache->block_at[state->pc];
+  if (!block) {
+    record_block(state, cache, cycle_budget, &block);
+    // Handlers are resolved here, the recorder runs outside this function
+    if (block) {
+      for (int i = 0; i < block->length; i++)
+        block->entries[i].handler = dispatch[block->entries[i].opcode];
+    }
+    goto next_block;
+  }
 
-  case 0x08: // LD B,RRC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 7) | (temp >> 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->b = res;
-    break;
+  cache->stats.hits++;
+  cache->code_modified = 0;
+  entry = block->entries;
+  end = entry + block->length;
 
-  case 0x09: // LD C,RRC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 7) | (temp >> 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->c = res;
-    break;
+#ifdef Z80_HAVE_JIT
+  if (use_jit) {
+    if (!block->jit && block->runs < JIT_THRESHOLD && ++block->runs == JIT_THRESHOLD) {
+      if (!translate_block(state, cache, block))
+        goto next_block;
+    }
+    // Only when the interpreter would have run the whole translated part
+    // too, so both stop at the same instruction
+    if (block->jit && state->pass_cycles + block->jit_cycles < cycle_budget) {
+      state->pass_cycles += run_jit_block(state, cache, block);
+      entry += block->jit_length;
+      if (entry == end || state->pc != entry->pc)
+        goto next_block;
+    }
+  }
+#else
+  (void)use_jit;
+#endif
+
+  // The opcode comes from the block instead of a fetch: R and the accesses
+  // that follow go on as if it had been fetched
+  add_r(state, 1);
+  state->access_cycles = 4;
+  opcode = entry->opcode;
+  cycles = cycles_main[opcode];
+  SYNC_FLAGS_FOR(state, opcode);
+  state->pc++;
+  goto *entry->handler;
+
+#define OPCODE(op) op_##op:
+#define NEXT \
+  do { \
+    state->pass_cycles += cycles > 0 ? cycles : 4; \
+    if (++entry == end || state->pc != entry->pc || cache->code_modified || \
+      state->pass_cycles >= cycle_budget || state->run_exit) \
+      goto next_block; \
+    add_r(state, 1); \
+    state->access_cycles = 4; \
+    opcode = entry->opcode; \
+    cycles = cycles_main[opcode]; \
+    SYNC_FLAGS_FOR(state, opcode); \
+    state->pc++; \
+    goto *entry->handler; \
+  } while (0)
+#include "z80_ops.inc"
+#undef OPCODE
+#undef NEXT
+}
+#endif
+
+#ifdef Z80_HAVE_COMPUTED_GOTO
+// The cache is several megabytes, so machines only get one when they run
+// with it; without it they fall back to the threaded dispatcher
+static bool alloc_block_cache(Z80_State* state) {
+  if (state->machine->block_cache)
+    return true;
+
+  Z80_BlockCache* cache = calloc(1, sizeof(Z80_BlockCache));
+  if (!cache) {
+    printf("Error: Unable to allocate block cache\n");
+    return false;
+  }
+  state->machine->block_cache = cache;
+  return true;
+}
+#endif
 
-  case 0x0a: // LD D,RRC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 7) | (temp >> 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->d = res;
-    break;
+static void z80_run_dispatch(Z80_State* state, int cycle_budget) {
+#ifdef Z80_HAVE_COMPUTED_GOTO
+  if (dispatch_mode == Z80_DISPATCH_THREADED) {
+    z80_run_threaded(state, cycle_budget);
+    return;
+  }
+  if ((dispatch_mode == Z80_DISPATCH_CACHED || dispatch_mode == Z80_DISPATCH_JIT) &&
+    alloc_block_cache(state)) {
+    z80_run_cached(state, cycle_budget, dispatch_mode == Z80_DISPATCH_JIT);
+    return;
+  }
+#endif
+  z80_run_switch(state, cycle_budget);
+}
 
-  case 0x0b: // LD E,RRC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 7) | (temp >> 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->e = res;
-    break;
+// The dispatchers never look at the scheduler or the interrupt inputs. Each
+// pass runs them up to the next event only, then fires what is due and
+// takes any interrupt at that instruction boundary.
+int z80_run(Z80_State* state, int cycle_budget) {
+  int used = 0;
+
+  state->exit_requested = 0;
+  while (used < cycle_budget && !state->exit_requested) {
+    z80_run_events(state);
+    if (state->exit_requested)
+      break;
+    state->run_exit = 0;
+    state->pass_cycles = 0;
+
+    int cycles = z80_interrupt(state);
+    if (cycles) {
+      state->pass_cycles += cycles;
+    } else if (state->ei_delay) {
+      // EI stopped the dispatcher; run the instruction after it on its own
+      // so an interrupt is only taken once that has finished
+      state->ei_delay = 0;
+      cycles = z80_execute(state);
+      state->pass_cycles += cycles > 0 ? cycles : 4;
+    } else if (state->block_op) {
+      int limit = cycle_budget - used;
+      uint64_t until_event = scheduler_next(&state->scheduler) - state->cycles;
+      if (until_event < (uint64_t)limit)
+        limit = (int)until_event;
+      z80_block_run(state, limit);
+    } else if (state->halted) {
+      // Nothing but HALT's internal NOPs until an interrupt: skip straight
+      // to the next event (or the end of the budget) in whole 4 T-state
+      // steps, advancing R as the NOPs would have
+      uint64_t skip = cycle_budget - used;
+      uint64_t until_event = scheduler_next(&state->scheduler) - state->cycles;
+      if (until_event < skip)
+        skip = until_event;
+      int steps = (int)((skip + 3) / 4);
+      add_r(state, steps);
+      state->pass_cycles += steps * 4;
+    } else {
+      int slice = cycle_budget - used;
+      uint64_t until_event = scheduler_next(&state->scheduler) - state->cycles;
+      if (until_event < (uint64_t)slice)
+        slice = (int)until_event;
+      z80_run_dispatch(state, slice);
+    }
 
-  case 0x0c: // LD H,RRC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 7) | (temp >> 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->h = res;
-    break;
+    state->cycles += state->pass_cycles;
+    used += state->pass_cycles;
+    state->pass_cycles = 0;
+  }
 
-  case 0x0d: // LD L,RRC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 7) | (temp >> 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->l = res;
-    break;
+  SYNC_FLAGS(state);
+  return used;
+}
 
-  case 0x0e: // RRC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 7) | (temp >> 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
-    break;
+bool z80_set_dispatch(int mode) {
+#ifndef Z80_HAVE_COMPUTED_GOTO
+  if (mode == Z80_DISPATCH_THREADED || mode == Z80_DISPATCH_CACHED)
+    return false;
+#endif
+#if !defined(Z80_HAVE_COMPUTED_GOTO) || !defined(Z80_HAVE_JIT)
+  if (mode == Z80_DISPATCH_JIT)
+    return false;
+#endif
+  dispatch_mode = mode;
+  return true;
+}
 
-  case 0x0f: // LD A,RRC (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 7) | (temp >> 1);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->a = res;
-    break;
+int z80_get_dispatch(void) {
+  return dispatch_mode;
+}
 
-  case 0x10: // LD B,RL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) | (temp >> 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->b = res;
-    break;
+void z80_set_jit_verify(bool verify) {
+#if defined(Z80_HAVE_COMPUTED_GOTO) && defined(Z80_HAVE_JIT)
+  jit_verify = verify;
+#else
+  (void)verify;
+#endif
+}
 
-  case 0x11: // LD C,RL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) | (temp >> 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->c = res;
-    break;
+void z80_request_exit(Z80_State* state) {
+  state->exit_requested = 1;
+  state->run_exit = 1;
+}
 
-  case 0x12: // LD D,RL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) | (temp >> 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->d = res;
-    break;
-
-  case 0x13: // LD E,RL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) | (temp >> 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->e = res;
-    break;
-
-  case 0x14: // LD H,RL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) | (temp >> 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->h = res;
-    break;
-
-  case 0x15: // LD L,RL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) | (temp >> 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->l = res;
-    break;
-
-  case 0x16: // RL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) | (temp >> 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
-    break;
-
-  case 0x17: // LD A,RL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) | (temp >> 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->a = res;
-    break;
-
-  case 0x18: // LD B,RR (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp << 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->b = res;
-    break;
-
-  case 0x19: // LD C,RR (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp << 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->c = res;
-    break;
-
-  case 0x1a: // LD D,RR (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp << 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->d = res;
-    break;
-
-  case 0x1b: // LD E,RR (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp << 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->e = res;
-    break;
-
-  case 0x1c: // LD H,RR (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp << 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->h = res;
-    break;
-
-  case 0x1d: // LD L,RR (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp << 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->l = res;
-    break;
-
-  case 0x1e: // RR (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp << 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
-    break;
-
-  case 0x1f: // LD A,RR (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp << 7);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->a = res;
-    break;
-
-  case 0x20: // LD B,SLA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->b = res;
-    break;
-
-  case 0x21: // LD C,SLA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->c = res;
-    break;
-
-  case 0x22: // LD D,SLA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->d = res;
-    break;
-
-  case 0x23: // LD E,SLA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->e = res;
-    break;
-
-  case 0x24: // LD H,SLA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->h = res;
-    break;
-
-  case 0x25: // LD L,SLA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->l = res;
-    break;
-
-  case 0x26: // SLA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
-    break;
-
-  case 0x27: // LD A,SLA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->a = res;
-    break;
-
-  case 0x28: // LD B,SRA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->b = res;
-    break;
-
-  case 0x29: // LD C,SRA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->c = res;
-    break;
-
-  case 0x2a: // LD D,SRA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->d = res;
-    break;
-
-  case 0x2b: // LD E,SRA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->e = res;
-    break;
-
-  case 0x2c: // LD H,SRA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->h = res;
-    break;
-
-  case 0x2d: // LD L,SRA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->l = res;
-    break;
-
-  case 0x2e: // SRA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
-    break;
-
-  case 0x2f: // LD A,SRA (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->a = res;
-    break;
-
-  case 0x30: // LD B,SLL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->b = res;
-    break;
-
-  case 0x31: // LD C,SLL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->c = res;
-    break;
-
-  case 0x32: // LD D,SLL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->d = res;
-    break;
-
-  case 0x33: // LD E,SLL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->e = res;
-    break;
-
-  case 0x34: // LD H,SLL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->h = res;
-    break;
-
-  case 0x35: // LD L,SLL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->l = res;
-    break;
-
-  case 0x36: // SLL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
-    break;
-
-  case 0x37: // LD A,SLL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp << 1) & 0xFF;
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->a = res;
-    break;
-
-  case 0x38: // LD B,SRL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->b = res;
-    break;
-
-  case 0x39: // LD C,SRL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->c = res;
-    break;
-
-  case 0x3a: // LD D,SRL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->d = res;
-    break;
-
-  case 0x3b: // LD E,SRL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->e = res;
-    break;
-
-  case 0x3c: // LD H,SRL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->h = res;
-    break;
-
-  case 0x3d: // LD L,SRL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->l = res;
-    break;
-
-  case 0x3e: // SRL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    mem_write(temp16, res);
-    break;
-
-  case 0x3f: // LD A,SRL (IY+dd)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    res = (temp >> 1) | (temp & 0x80);
-    state->f &= ~(FLAG_C | FLAG_Z | FLAG_N | FLAG_H | FLAG_PV);
-    state->f |= (res & FLAG_C) | (res ? 0 : FLAG_Z);
-    state->a = res;
-    break;
-
-  case 0x40: // BIT 0, (IY+d)
-  case 0x41: // BIT 0, (IY+d)
-  case 0x42: // BIT 0, (IY+d)
-  case 0x43: // BIT 0, (IY+d)
-  case 0x44: // BIT 0, (IY+d)
-  case 0x45: // BIT 0, (IY+d)
-  case 0x46: // BIT 0, (IY+d)
-  case 0x47: // BIT 0, (IY+d)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= FLAG_H;
-    if (!(temp & 0x01)) SET_FLAG(state, FLAG_Z);
-    break;
-
-  case 0x48: // BIT 1, (IY+d)
-  case 0x49: // BIT 1, (IY+d)
-  case 0x4A: // BIT 1, (IY+d)
-  case 0x4B: // BIT 1, (IY+d)
-  case 0x4C: // BIT 1, (IY+d)
-  case 0x4D: // BIT 1, (IY+d)
-  case 0x4E: // BIT 1, (IY+d)
-  case 0x4F: // BIT 1, (IY+d)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= FLAG_H;
-    if (!(temp & 0x02)) SET_FLAG(state, FLAG_Z);
-    break;
-
-  case 0x50: // BIT 2, (IY+d)
-  case 0x51: // BIT 2, (IY+d)
-  case 0x52: // BIT 2, (IY+d)
-  case 0x53: // BIT 2, (IY+d)
-  case 0x54: // BIT 2, (IY+d)
-  case 0x55: // BIT 2, (IY+d)
-  case 0x56: // BIT 2, (IY+d)
-  case 0x57: // BIT 2, (IY+d)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= FLAG_H;
-    if (!(temp & 0x04)) SET_FLAG(state, FLAG_Z);
-    break;
-
-  case 0x58: // BIT 3, (IY+d)
-  case 0x59: // BIT 3, (IY+d)
-  case 0x5A: // BIT 3, (IY+d)
-  case 0x5B: // BIT 3, (IY+d)
-  case 0x5C: // BIT 3, (IY+d)
-  case 0x5D: // BIT 3, (IY+d)
-  case 0x5E: // BIT 3, (IY+d)
-  case 0x5F: // BIT 3, (IY+d)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= FLAG_H;
-    if (!(temp & 0x08)) SET_FLAG(state, FLAG_Z);
-    break;
-
-  case 0x60: // BIT 4, (IY+d)
-  case 0x61: // BIT 4, (IY+d)
-  case 0x62: // BIT 4, (IY+d)
-  case 0x63: // BIT 4, (IY+d)
-  case 0x64: // BIT 4, (IY+d)
-  case 0x65: // BIT 4, (IY+d)
-  case 0x66: // BIT 4, (IY+d)
-  case 0x67: // BIT 4, (IY+d)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= FLAG_H;
-    if (!(temp & 0x10)) SET_FLAG(state, FLAG_Z);
-    break;
-
-  case 0x68: // BIT 5, (IY+d)
-  case 0x69: // BIT 5, (IY+d)
-  case 0x6A: // BIT 5, (IY+d)
-  case 0x6B: // BIT 5, (IY+d)
-  case 0x6C: // BIT 5, (IY+d)
-  case 0x6D: // BIT 5, (IY+d)
-  case 0x6E: // BIT 5, (IY+d)
-  case 0x6F: // BIT 5, (IY+d)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= FLAG_H;
-    if (!(temp & 0x20)) SET_FLAG(state, FLAG_Z);
-    break;
-
-  case 0x70: // BIT 6, (IY+d)
-  case 0x71: // BIT 6, (IY+d)
-  case 0x72: // BIT 6, (IY+d)
-  case 0x73: // BIT 6, (IY+d)
-  case 0x74: // BIT 6, (IY+d)
-  case 0x75: // BIT 6, (IY+d)
-  case 0x76: // BIT 6, (IY+d)
-  case 0x77: // BIT 6, (IY+d)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= FLAG_H;
-    if (!(temp & 0x40)) SET_FLAG(state, FLAG_Z);
-    break;
-
-  case 0x78: // BIT 7, (IY+d)
-  case 0x79: // BIT 7, (IY+d)
-  case 0x7A: // BIT 7, (IY+d)
-  case 0x7B: // BIT 7, (IY+d)
-  case 0x7C: // BIT 7, (IY+d)
-  case 0x7D: // BIT 7, (IY+d)
-    temp16 = state->iy + (int8_t)mem_read(state->pc++);
-    temp = mem_read(temp16);
-    state->f &= ~(FLAG_Z | FLAG_N | FLAG_H);
-    state->f |= FLAG_H;
-    if (!(temp & 0x80)) SET_FLAG(state, FLAG_Z);
-    break;
-
-  default:
-    printf("Unknown FD CB opcode: %02X\n", opcode);
-    return 0;
-  }
-}
-
-int z80_step(Z80_State* state) {
-  uint8_t opcode = mem_read(state->pc++);
-  uint8_t temp;
-  uint16_t temp16;
-  uint8_t n;
-  uint8_t carry;
-  uint8_t res;
-  uint8_t port;
-  uint8_t tempA;
-  uint8_t tempF;
-
-  switch (opcode) {
-
-  case 0x00: // NOP
-    break;
-
-  case 0x01: // LD BC,nn
-    state->bc = (mem_read(state->pc++) << 8) | mem_read(state->pc++);
-    break;
-
-  case 0x02: // LD (BC),A
-    mem_write(state->bc, state->a);
-    break;
-
-  case 0x03: // INC BC
-    state->bc++;
-    break;
-
-  case 0x04: // INC B
-    state->b++;
-    UPDATE_SZ(state, state->b);
-    break;
-
-  case 0x05: // DEC B
-    state->b--;
-    UPDATE_SZ(state, state->b);
-    SET_FLAG(state, FLAG_N);
-    break;
-
-  case 0x06: // LD B,n
-    state->b = mem_read(state->pc++);
-    break;
-
-  case 0x07: // RLCA
-    state->a = (state->a << 1) | (state->a >> 7);
-    UPDATE_SZ(state, state->a);
-    break;
-
-  case 0x08: // EX AF, AF'
-    tempA = state->a;
-    tempF = state->f;
-    state->a = state->a_;
-    state->f = state->f_;
-    state->a_ = tempA;
-    state->f_ = tempF;
-    break;
-
-  case 0x09: // ADD HL,BC
-    temp16 = state->hl + state->bc;
-    CLR_FLAG(state, FLAG_N | FLAG_H | FLAG_C);
-    if (((state->hl & 0x0FFF) + (state->bc & 0x0FFF)) > 0x0FFF) SET_FLAG(state, FLAG_H);
-    if (temp16 < state->hl) SET_FLAG(state, FLAG_C);
-    state->hl = temp16;
-    break;
-
-  case 0x0A: // LD A,(BC)
-    state->a = mem_read(state->bc);
-    break;
-
-  case 0x0B: // DEC BC
-    state->bc--;
-    break;
-
-  case 0x0C: // INC C
-    state->c++;
-    UPDATE_SZ(state, state->c);
-    break;
-
-  case 0x0D: // DEC C
-    state->c--;
-    UPDATE_SZ(state, state->c);
-    SET_FLAG(state, FLAG_N);
-    break;
-
-  case 0x0E: // LD C,n
-    state->c = mem_read(state->pc++);
-    break;
-
-  case 0x0F: // RRCA
-    state->a = (state->a >> 1) | (state->a << 7);
-    UPDATE_SZ(state, state->a);
-    break;
-
-  case 0x10: // DJNZ n
-    temp = mem_read(state->pc + 1);
-    state->b--;
-    if (state->b != 0) {
-      state->pc += temp;
-    }
-    break;
-
-  case 0x11: // LD DE,nn
-    state->de = (mem_read(state->pc++) << 8) | mem_read(state->pc++);
-    break;
-
-  case 0x12: // LD (DE),A
-    mem_write(state->de, state->a);
-    break;
-
-  case 0x13: // INC DE
-    state->de++;
-    break;
-
-  case 0x14: // INC D
-    state->d++;
-    UPDATE_SZ(state, state->d);
-    break;
-
-  case 0x15: // DEC D
-    state->d--;
-    UPDATE_SZ(state, state->d);
-    SET_FLAG(state, FLAG_N);
-    break;
-
-  case 0x16: // LD D,n
-    state->d = mem_read(state->pc++);
-    break;
-
-  case 0x17: // RLA
-    temp = (state->a >> 7) & 1;
-    state->a = (state->a << 1) | (state->f & FLAG_C);
-    UPDATE_SZ(state, state->a);
-    state->f = (state->f & ~FLAG_C) | (temp << 4);
-    break;
-
-  case 0x18: // JR n
-    temp = mem_read(state->pc + 1);
-    state->pc += temp;
-    break;
-
-  case 0x19: // ADD HL,DE
-    temp16 = state->hl + state->de;
-    CLR_FLAG(state, FLAG_N | FLAG_H | FLAG_C);
-    if (((state->hl & 0x0FFF) + (state->de & 0x0FFF)) > 0x0FFF) SET_FLAG(state, FLAG_H);
-    if (temp16 < state->hl) SET_FLAG(state, FLAG_C);
-    state->hl = temp16;
-    break;
-
-  case 0x1A: // LD A,(DE)
-    state->a = mem_read(state->de);
-    break;
-
-  case 0x1B: // DEC DE
-    state->de--;
-    break;
-
-  case 0x1C: // INC E
-    state->e++;
-    UPDATE_SZ(state, state->e);
-    break;
-
-  case 0x1D: // DEC E
-    state->e--;
-    UPDATE_SZ(state, state->e);
-    SET_FLAG(state, FLAG_N);
-    break;
-
-  case 0x1E: // LD E,n
-    state->e = mem_read(state->pc++);
-    break;
-
-  case 0x1F: // RRA
-    temp = (state->a & 1);
-    state->a = (state->a >> 1) | ((state->f & FLAG_C) << 7);
-    UPDATE_SZ(state, state->a);
-    state->f = (state->f & ~FLAG_C) | (temp << 4);
-    break;
-
-  case 0x20: // JR NZ, n
-    temp = mem_read(state->pc + 1);
-    if ((state->f & FLAG_Z) == 0) {
-      state->pc += temp;
-    }
-    break;
-
-  case 0x21: // LD HL,nn
-    state->hl = (mem_read(state->pc++) << 8) | mem_read(state->pc++);
-    break;
-
-  case 0x22: // LD (nn),HL
-    mem_write((mem_read(state->pc++) << 8) | mem_read(state->pc++), state->l);
-    mem_write((mem_read(state->pc++) << 8) | mem_read(state->pc++), state->h);
-    break;
-
-  case 0x23: // INC HL
-    state->hl++;
-    break;
-
-  case 0x24: // INC H
-    state->h++;
-    UPDATE_SZ(state, state->h);
-    break;
-
-  case 0x25: // DEC H
-    state->h--;
-    UPDATE_SZ(state, state->h);
-    SET_FLAG(state, FLAG_N);
-    break;
-
-  case 0x26: // LD H,n
-    state->h = mem_read(state->pc++);
-    break;
-
-  case 0x27: // DAA
-    temp = state->a;
-    if ((state->f & FLAG_C) || (state->a > 0x99)) {
-      state->a += 0x60;
-      SET_FLAG(state, FLAG_C);
-    }
-    if ((state->f & FLAG_H) || (state->a & 0x0F) > 0x09) {
-      state->a += 0x06;
-      SET_FLAG(state, FLAG_H);
-    }
-    UPDATE_SZ(state, state->a);
-    break;
-
-  case 0x28: // JR Z, n
-    temp = mem_read(state->pc + 1);
-    if ((state->f & FLAG_Z) != 0) {
-      state->pc += temp;
-    }
-    break;
-
-  case 0x29: // ADD HL,HL
-    temp16 = state->hl + state->hl;
-    CLR_FLAG(state, FLAG_N | FLAG_H | FLAG_C);
-    if (((state->hl & 0x0FFF) + (state->hl & 0x0FFF)) > 0x0FFF) SET_FLAG(state, FLAG_H);
-    if (temp16 < state->hl) SET_FLAG(state, FLAG_C);
-    state->hl = temp16;
-    break;
-
-  case 0x2A: // LD HL,(nn)
-    temp16 = mem_read(state->pc++);
-    temp16 |= mem_read(state->pc++) << 8;
-    state->l = mem_read(temp16);
-    state->h = mem_read(temp16 + 1);
-    break;
-
-  case 0x2B: // LD HL,nn
-    state->l = mem_read(state->pc++);
-    state->h = mem_read(state->pc++);
-    break;
-
-  case 0x2C: // LD (HL),A
-    mem_write(state->hl, state->a);
-    break;
-
-  case 0x2D: // DEC HL
-    state->hl--;
-    break;
-
-  case 0x2E: // LD L,n
-    state->l = mem_read(state->pc++);
-    break;
-
-  case 0x2F: // CPL
-    state->a = ~state->a;
-    SET_FLAG(state, FLAG_N | FLAG_H);
-    break;
-
-  case 0x30: // JR NC, n
-    temp = mem_read(state->pc + 1);
-    if ((state->f & FLAG_C) == 0) {
-      state->pc += temp;
-    }
-    break;
-
-  case 0x31: // LD SP,nn
-    state->sp = (mem_read(state->pc++) << 8) | mem_read(state->pc++);
-    break;
-
-  case 0x32: // LD (nn),A
-    mem_write((mem_read(state->pc++) << 8) | mem_read(state->pc++), state->a);
-    break;
-
-  case 0x33: // INC SP
-    state->sp++;
-    break;
-
-  case 0x34: // INC (HL)
-    temp = mem_read(state->hl);
-    temp++;
-    mem_write(state->hl, temp);
-    UPDATE_SZ(state, temp);
-    break;
-
-  case 0x35: // DEC (HL)
-    temp = mem_read(state->hl);
-    temp--;
-    mem_write(state->hl, temp);
-    UPDATE_SZ(state, temp);
-    SET_FLAG(state, FLAG_N);
-    break;
-
-  case 0x36: // LD (HL),n
-    mem_write(state->hl, mem_read(state->pc++));
-    break;
-
-  case 0x37: // SCF
-    CLR_FLAG(state, FLAG_N | FLAG_H);
-    SET_FLAG(state, FLAG_C);
-    break;
-
-  case 0x38: // JR C, n
-    temp = mem_read(state->pc + 1);
-    if ((state->f & FLAG_C) != 0) {
-      state->pc += temp;
-    }
-    break;
-
-  case 0x39: // ADD HL,SP
-    temp = state->sp + state->hl;
-    CLR_FLAG(state, FLAG_N);
-    if (temp & 0x10000) SET_FLAG(state, FLAG_C);
-    if (((state->hl ^ state->sp ^ temp) & 0x1000) == 0x1000) SET_FLAG(state, FLAG_H);
-    state->hl = temp & 0xFFFF;
-    break;
-
-  case 0x3A: // LD A,(nn)
-    temp16 = mem_read(state->pc++);
-    temp16 |= mem_read(state->pc++) << 8;
-    state->a = mem_read(temp16);
-    break;
-
-  case 0x3B: // DEC SP
-    state->sp--;
-    break;
-
-  case 0x3C: // INC A
-    state->a++;
-    UPDATE_SZ(state, state->a);
-    break;
-
-  case 0x3D: // DEC A
-    state->a--;
-    UPDATE_SZ(state, state->a);
-    SET_FLAG(state, FLAG_N);
-    break;
-
-  case 0x3E: // LD A,n
-    state->a = mem_read(state->pc++);
-    break;
-
-  case 0x3F: // CCF
-    state->f ^= FLAG_C; // Toggle carry flag
-    CLR_FLAG(state, FLAG_N | FLAG_H); // Clear N and H flags
-    if (state->f & FLAG_C) SET_FLAG(state, FLAG_H); // Set H if carry is set
-    break;
-
-  case 0x40: // LD B,B
-    state->b = state->b;
-    break;
-
-  case 0x41: // LD B,C
-    state->b = state->c;
-    break;
-
-  case 0x42: // LD B,D
-    state->b = state->d;
-    break;
-
-  case 0x43: // LD B,E
-    state->b = state->e;
-    break;
-
-  case 0x44: // LD B,H
-    state->b = state->h;
-    break;
-
-  case 0x45: // LD B,L
-    state->b = state->l;
-    break;
-
-  case 0x46: // LD B,(HL)
-    state->b = mem_read(state->hl);
-    break;
-
-  case 0x47: // LD B,A
-    state->b = state->a;
-    break;
-
-  case 0x48: // LD C,B
-    state->c = state->b;
-    break;
-
-  case 0x49: // LD C,C
-    state->c = state->c;
-    break;
-
-  case 0x4A: // LD C,D
-    state->c = state->d;
-    break;
-
-  case 0x4B: // LD C,E
-    state->c = state->e;
-    break;
-
-  case 0x4C: // LD C,H
-    state->c = state->h;
-    break;
-
-  case 0x4D: // LD C,L
-    state->c = state->l;
-    break;
-
-  case 0x4E: // LD C,(HL)
-    state->c = mem_read(state->hl);
-    break;
-
-  case 0x4F: // LD C,A
-    state->c = state->a;
-    break;
-
-  case 0x50: // LD D,B
-    state->d = state->b;
-    break;
-
-  case 0x51: // LD D,C
-    state->d = state->c;
-    break;
-
-  case 0x52: // LD D,D
-    state->d = state->d;
-    break;
-
-  case 0x53: // LD D,E
-    state->d = state->e;
-    break;
-
-  case 0x54: // LD D,H
-    state->d = state->h;
-    break;
-
-  case 0x55: // LD D,L
-    state->d = state->l;
-    break;
-
-  case 0x56: // LD D,(HL)
-    state->d = mem_read(state->hl);
-    break;
-
-  case 0x57: // LD D,A
-    state->d = state->a;
-    break;
-
-  case 0x58: // LD E,B
-    state->e = state->b;
-    break;
-
-  case 0x59: // LD E,C
-    state->e = state->c;
-    break;
-
-  case 0x5A: // LD E,D
-    state->e = state->d;
-    break;
-
-  case 0x5B: // LD E,E
-    state->e = state->e;
-    break;
-
-  case 0x5C: // LD E,H
-    state->e = state->h;
-    break;
-
-  case 0x5D: // LD E,L
-    state->e = state->l;
-    break;
-
-  case 0x5E: // LD E,(HL)
-    state->e = mem_read(state->hl);
-    break;
-
-  case 0x5F: // LD E,A
-    state->e = state->a;
-    break;
-
-  case 0x60: // LD H,B
-    state->h = state->b;
-    break;
-
-  case 0x61: // LD H,C
-    state->h = state->c;
-    break;
-
-  case 0x62: // LD H,D
-    state->h = state->d;
-    break;
-
-  case 0x63: // LD H,E
-    state->h = state->e;
-    break;
-
-  case 0x64: // LD H,H
-    state->h = state->h;
-    break;
-
-  case 0x65: // LD H,L
-    state->h = state->l;
-    break;
-
-  case 0x66: // LD H,(HL)
-    state->h = mem_read(state->hl);
-    break;
-
-  case 0x67: // LD H,A
-    state->h = state->a;
-    break;
-
-  case 0x68: // LD L,B
-    state->l = state->b;
-    break;
-
-  case 0x69: // LD L,C
-    state->l = state->c;
-    break;
-
-  case 0x6A: // LD L,D
-    state->l = state->d;
-    break;
-
-  case 0x6B: // LD L,E
-    state->l = state->e;
-    break;
-
-  case 0x6C: // LD L,H
-    state->l = state->h;
-    break;
-
-  case 0x6D: // LD L,L
-    state->l = state->l;
-    break;
-
-  case 0x6E: // LD L,(HL)
-    state->l = mem_read(state->hl);
-    break;
-
-  case 0x6F: // LD L,A
-    state->l = state->a;
-    break;
-
-  case 0x70: // LD (HL),B
-    mem_write(state->hl, state->b);
-    break;
-
-  case 0x71: // LD (HL),C
-    mem_write(state->hl, state->c);
-    break;
-
-  case 0x72: // LD (HL),D
-    mem_write(state->hl, state->d);
-    break;
-
-  case 0x73: // LD (HL),E
-    mem_write(state->hl, state->e);
-    break;
-
-  case 0x74: // LD (HL),H
-    mem_write(state->hl, state->h);
-    break;
-
-  case 0x75: // LD (HL),L
-    mem_write(state->hl, state->l);
-    break;
-
-  case 0x76: // HALT
-    // TODO: Implement HALT instruction
-    break;
-
-  case 0x77: // LD (HL),A
-    mem_write(state->hl, state->a);
-    break;
-
-  case 0x78: // LD A,B
-    state->a = state->b;
-    break;
-
-  case 0x79: // LD A,C
-    state->a = state->c;
-    break;
-
-  case 0x7A: // LD A,D
-    state->a = state->d;
-    break;
-
-  case 0x7B: // LD A,E
-    state->a = state->e;
-    break;
-
-  case 0x7C: // LD A,H
-    state->a = state->h;
-    break;
-
-  case 0x7D: // LD A,L
-    state->a = state->l;
-    break;
-
-  case 0x7E: // LD A,(HL)
-    state->a = mem_read(state->hl);
-    break;
-
-  case 0x7F: // LD A,A
-    state->a = state->a;
-    break;
-
-  case 0x80: // ADD A, B
-    temp = state->a + state->b;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->b & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->b ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x81: // ADD A, C
-    temp = state->a + state->c;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->c & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->c ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x82: // ADD A, D
-    temp = state->a + state->d;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->d & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->d ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x83: // ADD A, E
-    temp = state->a + state->e;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->e & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->e ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x84: // ADD A, H
-    temp = state->a + state->h;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->h & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->h ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x85: // ADD A, L
-    temp = state->a + state->l;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->l & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->l ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x86: // ADD A, (HL)
-    temp = state->a + mem_read(state->hl);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (mem_read(state->hl) & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ mem_read(state->hl) ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x87: // ADD A, A
-    temp = state->a + state->a;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->a & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->a ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x88: // ADC A, B
-    temp = state->a + state->b + (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->b & 0x0F) + (state->f & FLAG_C) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->b ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x89: // ADC A, C
-    temp = state->a + state->c + (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->c & 0x0F) + (state->f & FLAG_C) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->c ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x8A: // ADC A, D
-    temp = state->a + state->d + (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->d & 0x0F) + (state->f & FLAG_C) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->d ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x8B: // ADC A, E
-    temp = state->a + state->e + (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->e & 0x0F) + (state->f & FLAG_C) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->e ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x8C: // ADC A, H
-    temp = state->a + state->h + (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->h & 0x0F) + (state->f & FLAG_C) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->h ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x8D: // ADC A, L
-    temp = state->a + state->l + (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->l & 0x0F) + (state->f & FLAG_C) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->l ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x8E: // ADC A, (HL)
-    temp = state->a + mem_read(state->hl) + (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (mem_read(state->hl) & 0x0F) + (state->f & FLAG_C) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ mem_read(state->hl) ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x8F: // ADC A, A
-    temp = state->a + state->a + (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (state->a & 0x0F) + (state->f & FLAG_C) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    state->f |= (state->a ^ state->a ^ temp) & FLAG_C;
-    state->a = temp;
-    break;
-
-  case 0x90: // SUB B
-    temp = state->a - state->b;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->b & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->b) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x91: // SUB C
-    temp = state->a - state->c;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->c & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->c) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x92: // SUB D
-    temp = state->a - state->d;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->d & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->d) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x93: // SUB E
-    temp = state->a - state->e;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->e & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->e) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x94: // SUB H
-    temp = state->a - state->h;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->h & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->h) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x95: // SUB L
-    temp = state->a - state->l;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->l & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->l) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x96: // SUB (HL)
-    temp = state->a - mem_read(state->hl);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (mem_read(state->hl) & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < mem_read(state->hl)) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x97: // SUB A
-    temp = state->a - state->a;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->a & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->a) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x98: // SBC A, B
-    temp = state->a - state->b - (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->b & 0x0F) + (state->f & FLAG_C) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->b + (state->f & FLAG_C)) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x99: // SBC A, C
-    temp = state->a - state->c - (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->c & 0x0F) + (state->f & FLAG_C) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->c + (state->f & FLAG_C)) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x9A: // SBC A, D
-    temp = state->a - state->d - (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->d & 0x0F) + (state->f & FLAG_C) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->d + (state->f & FLAG_C)) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x9B: // SBC A, E
-    temp = state->a - state->e - (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->e & 0x0F) + (state->f & FLAG_C) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->e + (state->f & FLAG_C)) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x9C: // SBC A, H
-    temp = state->a - state->h - (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->h & 0x0F) + (state->f & FLAG_C) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->h + (state->f & FLAG_C)) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x9D: // SBC A, L
-    temp = state->a - state->l - (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->l & 0x0F) + (state->f & FLAG_C) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->l + (state->f & FLAG_C)) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x9E: // SBC A, (HL)
-    temp = state->a - mem_read(state->hl) - (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (mem_read(state->hl) & 0x0F) + (state->f & FLAG_C) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < mem_read(state->hl) + (state->f & FLAG_C)) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0x9F: // SBC A, A
-    temp = state->a - state->a - (state->f & FLAG_C);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->a & 0x0F) + (state->f & FLAG_C) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->f |= (state->a < state->a + (state->f & FLAG_C)) ? FLAG_C : 0;
-    state->a = temp;
-    break;
-
-  case 0xA0: // AND B
-    state->a = state->a & state->b;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xA1: // AND C
-    state->a = state->a & state->c;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xA2: // AND D
-    state->a = state->a & state->d;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xA3: // AND E
-    state->a = state->a & state->e;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xA4: // AND H
-    state->a = state->a & state->h;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xA5: // AND L
-    state->a = state->a & state->l;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xA6: // AND (HL)
-    state->a = state->a & mem_read(state->hl);
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xA7: // AND A
-    state->a = state->a & state->a;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xA8: // XOR B
-    state->a = state->a ^ state->b;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xA9: // XOR C
-    state->a = state->a ^ state->c;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xAA: // XOR D
-    state->a = state->a ^ state->d;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xAB: // XOR E
-    state->a = state->a ^ state->e;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xAC: // XOR H
-    state->a = state->a ^ state->h;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xAD: // XOR L
-    state->a = state->a ^ state->l;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xAE: // XOR (HL)
-    state->a = state->a ^ mem_read(state->hl);
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xAF: // XOR A
-    state->a = state->a ^ state->a;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xB0: // OR B
-    state->a = state->a | state->b;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xB1: // OR C
-    state->a = state->a | state->c;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xB2: // OR D
-    state->a = state->a | state->d;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xB3: // OR E
-    state->a = state->a | state->e;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xB4: // OR H
-    state->a = state->a | state->h;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xB5: // OR L
-    state->a = state->a | state->l;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xB6: // OR (HL)
-    state->a = state->a | mem_read(state->hl);
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xB7: // OR A
-    state->a = state->a | state->a;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    break;
-
-  case 0xB8: // CP B
-    temp = state->a - state->b;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->b & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < state->b) ? FLAG_N : 0;
-    break;
-
-  case 0xB9: // CP C
-    temp = state->a - state->c;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->c & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < state->c) ? FLAG_N : 0;
-    break;
-
-  case 0xBA: // CP D
-    temp = state->a - state->d;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->d & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < state->d) ? FLAG_N : 0;
-    break;
-
-  case 0xBB: // CP E
-    temp = state->a - state->e;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->e & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < state->e) ? FLAG_N : 0;
-    break;
-
-  case 0xBC: // CP H
-    temp = state->a - state->h;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->h & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < state->h) ? FLAG_N : 0;
-    break;
-
-  case 0xBD: // CP L
-    temp = state->a - state->l;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->l & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < state->l) ? FLAG_N : 0;
-    break;
-
-  case 0xBE: // CP (HL)
-    temp = state->a - mem_read(state->hl);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (mem_read(state->hl) & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < mem_read(state->hl)) ? FLAG_N : 0;
-    break;
-
-  case 0xBF: // CP A
-    temp = state->a - state->a;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (state->a & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < state->a) ? FLAG_N : 0;
-    break;
-
-  case 0xC0:
-    if ((state->f & FLAG_Z) == 0) {
-      state->pc = mem_read16(state->sp);
-      state->sp += 2;
-    }
-    else {
-      state->pc += 2;
-    }
-    break;
-
-  case 0xC1: // POP BC
-    state->bc = pop16(state);
-    break;
-
-  case 0xC2: // JP NZ, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_Z) == 0) {
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xC3: // JP nn
-    state->pc = mem_read16(state->pc + 1);
-    break;
-
-  case 0xC4: // CALL NZ, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_Z) == 0) {
-      push16(state, state->pc + 3);
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xC5: // PUSH BC
-    push16(state, state->bc);
-    break;
-
-  case 0xC6: // ADD A, n
-    temp = state->a + mem_read(state->pc + 1);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (mem_read(state->pc + 1) & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < mem_read(state->pc + 1)) ? FLAG_N : 0;
-    state->a = temp;
-    state->pc += 2;
-    break;
-
-  case 0xC7: // RST 0
-    push16(state, state->pc + 1);
-    state->pc = 0x0000;
-    break;
-
-  case 0xC8: // RET Z
-    if ((state->f & FLAG_Z) != 0) {
-      state->pc = mem_read16(state->sp);
-      state->sp += 2;
-    }
-    break;
-
-  case 0xC9: // RET
-    state->pc = mem_read16(state->sp);
-    state->sp += 2;
-    break;
-
-  case 0xCA: // JP Z, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_Z) != 0) {
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xCB: // CB prefixed instructions
-    return decode_cb(state);
-  case 0xCC: // CALL Z, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_Z) != 0) {
-      push16(state, state->pc + 3);
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xCD: // CALL nn
-    temp16 = mem_read16(state->pc + 1);
-    push16(state, state->pc + 3);
-    state->pc = temp16;
-    break;
-
-  case 0xCE: // ADC A, n
-    temp = state->a + mem_read(state->pc + 1);
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) + (mem_read(state->pc + 1) & 0x0F) > 0x0F ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < mem_read(state->pc + 1)) ? FLAG_N : 0;
-    state->f |= (state->a & 0x0F) < (mem_read(state->pc + 1) & 0x0F) ? FLAG_C : 0;
-    state->a = temp;
-    state->pc += 2;
-    break;
-
-  case 0xCF: // RST 8
-    push16(state, state->pc + 1);
-    state->pc = 0x0038;
-    break;
-
-  case 0xD0: // RET NC
-    if ((state->f & FLAG_C) == 0) {
-      state->pc = mem_read16(state->sp);
-      state->sp += 2;
-    }
-    break;
-
-  case 0xD1: // POP DE
-    state->de = pop16(state);
-    break;
-
-  case 0xD2: // JP NC, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_C) == 0) {
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xD3: // OUT (n), A
-    n = mem_read(state->pc + 1);
-    output_port(state, n, state->a);
-    state->pc += 2;
-    break;
-
-  case 0xD4: // CALL NC, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_C) == 0) {
-      push16(state, state->pc + 3);
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xD5: // PUSH DE
-    push16(state, state->de);
-    break;
-
-  case 0xD6: // SUB n
-    n = mem_read(state->pc + 1);
-    temp = state->a - n;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (n & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->a = temp;
-    break;
-
-  case 0xD7: // RST 10
-    push16(state, state->pc + 1);
-    state->pc = 0x0010;
-    break;
-
-  case 0xD8: // RET C
-    if ((state->f & FLAG_C) != 0) {
-      state->pc = mem_read16(state->sp);
-      state->sp += 2;
-    }
-    break;
-
-  case 0xD9: // EXX
-    temp16 = state->bc;
-    state->bc = state->bc_;
-    state->bc_ = temp16;
-    temp16 = state->de;
-    state->de = state->de_;
-    state->de_ = temp16;
-    temp16 = state->hl;
-    state->hl = state->hl_;
-    state->hl_ = temp16;
-    state->pc += 1;
-    break;
-
-  case 0xDA: // JP C, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_C) != 0) {
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xDB: // IN A, (n)
-    n = mem_read(state->pc + 1);
-    state->a = input_port(state, n);
-    state->pc += 2;
-    break;
-
-  case 0xDC: // CALL C, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_C) != 0) {
-      push16(state, state->pc + 3);
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xDD: // DD prefix
-    return decode_dd(state);
-    break;
-
-  case 0xDE: // SBC A, n
-    n = mem_read(state->pc + 1);
-    carry = (state->f & FLAG_C) != 0 ? 1 : 0;
-    temp = state->a - n - carry;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (n & 0x0F) + carry ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= FLAG_N;
-    state->a = temp;
-    break;
-
-  case 0xDF: // RST 30H
-    push16(state, state->pc + 1);
-    state->pc = 0x30;
-    break;
-
-  case 0xE0: // RET PO
-    if ((state->f & FLAG_PV) == 0) {
-      state->pc = mem_read16(state->sp);
-      state->sp += 2;
-    }
-    break;
-
-  case 0xE1: // POP HL
-    state->hl = mem_read16(state->sp);
-    state->sp += 2;
-    break;
-
-  case 0xE2: // JP PO, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_PV) == 0) {
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xE3: // EX (SP), HL
-    temp16 = mem_read16(state->sp);
-    mem_write16(state->sp, state->hl);
-    state->hl = temp16;
-    break;
-
-  case 0xE4: // CALL PO, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_PV) == 0) {
-      push16(state, state->pc + 3);
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xE5: // PUSH HL
-    push16(state, state->hl);
-    break;
-
-  case 0xE6: // AND n
-    n = mem_read(state->pc + 1);
-    state->a &= n;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f &= ~FLAG_PV;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    break;
-
-  case 0xE7: // RST 20H
-    push16(state, state->pc + 1);
-    state->pc = 0x20;
-    break;
-
-  case 0xE8: // RET PE
-    if ((state->f & FLAG_PV) != 0) {
-      state->pc = mem_read16(state->sp);
-      state->sp += 2;
-    }
-    break;
-
-  case 0xE9: // JP PE, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_PV) != 0) {
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xEA: // JP C, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_C) != 0) {
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xEB: // EX DE, HL
-    temp16 = state->de;
-    state->de = state->hl;
-    state->hl = temp16;
-    break;
-
-  case 0xEC: // CALL C, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_C) != 0) {
-      push16(state, state->pc + 3);
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xED: // ED-prefixed opcodes
-    return decode_ed(state);
-  case 0xEE: // XOR n
-    n = mem_read(state->pc + 1);
-    state->a ^= n;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f &= ~FLAG_PV;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    break;
-
-  case 0xEF: // RST 28H
-    temp16 = state->pc;
-    state->sp -= 2;
-    mem_write(state->sp, (temp >> 8) & 0xFF);
-    mem_write(state->sp + 1, temp & 0xFF);
-    state->pc = 0x28;
-    break;
-
-  case 0xF0: // RET P
-    if ((state->f & FLAG_S) == 0) {
-      state->pc = mem_read16(state->sp);
-      state->sp += 2;
-    }
-    break;
-
-  case 0xF1: // POP AF
-    state->af = mem_read16(state->sp);
-    state->sp += 2;
-    break;
-
-  case 0xF2: // JP P, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_S) == 0) {
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xF3: // DI
-    state->iff1 = 0;
-    state->iff2 = 0;
-    break;
-
-  case 0xF4: // CALL P, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_S) == 0) {
-      push16(state, state->pc + 3);
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xF5: // PUSH AF
-    state->sp -= 2;
-    mem_write(state->sp, (state->af >> 8) & 0xFF);
-    mem_write(state->sp + 1, state->af & 0xFF);
-    break;
-
-  case 0xF6: // OR n
-    n = mem_read(state->pc + 1);
-    state->a |= n;
-    state->f = (state->a & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f &= ~FLAG_PV;
-    state->f |= (state->a & 0x08) != 0 ? FLAG_PV : 0;
-    state->f &= ~FLAG_H;
-    state->f |= (state->a == 0) ? FLAG_Z : 0;
-    state->f &= ~FLAG_N;
-    break;
-
-  case 0xF7: // RST 30H
-    push16(state, state->pc + 1);
-    state->pc = 0x30;
-    break;
-
-  case 0xF8: // RET M
-    if ((state->f & FLAG_S) != 0) {
-      state->pc = mem_read16(state->sp);
-      state->sp += 2;
-    }
-    break;
-
-  case 0xF9: // LD SP, HL
-    state->sp = state->hl;
-    break;
-
-  case 0xFA: // JP M, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_S) != 0) {
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xFB: // EI
-    state->iff1 = state->iff2 = 1;
-    break;
-
-  case 0xFC: // CALL M, nn
-    temp16 = mem_read16(state->pc + 1);
-    if ((state->f & FLAG_S) != 0) {
-      push16(state, state->pc + 3);
-      state->pc = temp16;
-    }
-    break;
-
-  case 0xFD: // FD prefix
-    return decode_fd(state);
-  case 0xFE: // CP n
-    n = mem_read(state->pc + 1);
-    temp = state->a - n;
-    state->f = (temp & FLAG_S) != 0 ? FLAG_S : 0;
-    state->f |= (temp & 0x08) != 0 ? FLAG_PV : 0;
-    state->f |= (state->a & 0x0F) < (n & 0x0F) ? FLAG_H : 0;
-    state->f |= (temp == 0) ? FLAG_Z : 0;
-    state->f |= (state->a < n) ? FLAG_N : 0;
-    break;
-
-  case 0xFF: // RST 38H
-    push16(state, state->pc + 1);
-    state->pc = 0x38;
-    break;
-
-  default:
-    fprintf(stderr, "Unimplemented opcode: 0x%02X at 0x%04X\n",
-      opcode, state->pc - 1);
-    return -1;
-  }
+void z80_set_int(Z80_State* state, bool asserted) {
+  state->int_line = asserted;
+}
 
-  return 0;
+void z80_nmi(Z80_State* state) {
+  state->nmi_pending = 1;
+  state->run_exit = 1;
 }
 
 void push16(Z80_State* state, uint16_t val) {
-  mem_write(--state->sp, (val >> 8) & 0xFF);
-  mem_write(--state->sp, val & 0xFF);
+  mem_write(state->machine, --state->sp, (val >> 8) & 0xFF);
+  mem_write(state->machine, --state->sp, val & 0xFF);
 }
 
 uint16_t pop16(Z80_State* state) {
-  uint16_t lo = mem_read(state->sp++);
-  uint16_t hi = mem_read(state->sp++);
+  uint16_t lo = mem_read(state->machine, state->sp++);
+  uint16_t hi = mem_read(state->machine, state->sp++);
   return (hi << 8) | lo;
 }
\ No newline at end of file
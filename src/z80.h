@@ -1,33 +1,15 @@
 #pragma once 
 
+#include <stdbool.h>
 #include "zx_spectrum.h"
 
-// Flag update macros
-#define UPDATE_FLAGS_ADD(state, result, operand) \
-    CLR_FLAG(state, FLAG_Z | FLAG_S | FLAG_H | FLAG_C); \
-    if((result) == 0) SET_FLAG(state, FLAG_Z); \
-    if((result) & 0x80) SET_FLAG(state, FLAG_S); \
-    if(((operand) & 0x0F) + ((result) & 0x0F) > 0x0F) SET_FLAG(state, FLAG_H); \
-    if((uint16_t)(operand) + (uint16_t)(result) > 0xFF) SET_FLAG(state, FLAG_C);
-
-#define UPDATE_FLAGS_SUB(state, result, operand) \
-    CLR_FLAG(state, FLAG_Z | FLAG_S | FLAG_H | FLAG_C); \
-    if((result) == 0) SET_FLAG(state, FLAG_Z); \
-    if((result) & 0x80) SET_FLAG(state, FLAG_S); \
-    if(((operand) & 0x0F) > (state->a & 0x0F)) SET_FLAG(state, FLAG_H); \
-    if((operand) > state->a) SET_FLAG(state, FLAG_C);
-
-#define UPDATE_FLAGS_LOGIC(result) \
-    CLR_FLAG(state, FLAG_Z | FLAG_S | FLAG_H | FLAG_C); \
-    if((result) == 0) SET_FLAG(state, FLAG_Z); \
-    if((result) & 0x80) SET_FLAG(state, FLAG_S);
-
-
 // Flag bit positions
 #define FLAG_C  0x01
 #define FLAG_N  0x02
 #define FLAG_PV 0x04
+#define FLAG_3  0x08  // undocumented, copy of bit 3 of the result
 #define FLAG_H  0x10
+#define FLAG_5  0x20  // undocumented, copy of bit 5 of the result
 #define FLAG_Z  0x40
 #define FLAG_S  0x80
 
@@ -36,20 +18,53 @@
 #define CLR_FLAG(state, flag)  ((state)->f &= ~(flag))
 #define TST_FLAG(state, flag)  ((state)->f & (flag))
 
+// Flag update macros. These are single loads from the lookup tables that
+// gen_flag_tables generates at build time (z80_flag_tables.h):
+//   sz_table/szp_table[val]                S, Z, (P/V), bits 3 and 5 of val
+//   szhv_inc/szhv_dec[result]              everything but C for INC/DEC
+//   szhvc_add/szhvc_sub[(c << 16) | (a << 8) | operand]
+//                                          the full F of ADD/ADC, SUB/SBC/CP
+// The result and operand are enough to recover A for the ADD/SUB macros.
+#define UPDATE_FLAGS_ADD(state, result, operand) do { \
+    uint8_t flags_operand_ = (operand); \
+    (state)->f = szhvc_add[((uint8_t)((result) - flags_operand_) << 8) | flags_operand_]; \
+} while(0)
+
+#define UPDATE_FLAGS_SUB(state, result, operand) do { \
+    uint8_t flags_operand_ = (operand); \
+    (state)->f = szhvc_sub[((uint8_t)((result) + flags_operand_) << 8) | flags_operand_]; \
+} while(0)
+
+#define UPDATE_FLAGS_LOGIC(result) \
+    state->f = (state->f & ~(FLAG_Z | FLAG_S | FLAG_H | FLAG_C | FLAG_5 | FLAG_3)) | sz_table[(uint8_t)(result)];
+
 // Helper macros
 #define UPDATE_SZ(state, val) do { \
-    CLR_FLAG(state, FLAG_Z | FLAG_S); \
-    if(!(val)) SET_FLAG(state, FLAG_Z); \
-    if((val) & 0x80) SET_FLAG(state, FLAG_S); \
+    (state)->f = ((state)->f & ~(FLAG_Z | FLAG_S | FLAG_5 | FLAG_3)) | sz_table[(uint8_t)(val)]; \
 } while(0)
 
 #define UPDATE_SZP(state, val) do { \
-    UPDATE_SZ(state, val); \
-    CLR_FLAG(state, FLAG_PV); \
-    if(parity_table[(val)]) SET_FLAG(state, FLAG_PV); \
+    (state)->f = ((state)->f & ~(FLAG_Z | FLAG_S | FLAG_PV | FLAG_5 | FLAG_3)) | szp_table[(uint8_t)(val)]; \
 } while(0)
 
+// Operations the ALU helpers can leave F pending on in the lazy flags build
+// (Z80_LAZY_FLAGS). Outside z80_step/z80_run F is always up to date.
+enum Z80_FLAG_OPS
+{
+    FLAGS_VALID = 0,
+    FLAGS_ADD,      // szhvc_add[flag_arg]
+    FLAGS_SUB,      // szhvc_sub[flag_arg]
+    FLAGS_CP,       // szhvc_sub[flag_arg], bits 3 and 5 from the operand
+    FLAGS_AND,      // szp_table[flag_arg] | H
+    FLAGS_LOGIC,    // szp_table[flag_arg]
+    FLAGS_INC,      // szhv_inc[flag_arg], C kept
+    FLAGS_DEC       // szhv_dec[flag_arg], C kept
+};
+
 // Core functions
+// The decoders and z80_step return the T-states taken by the instruction
+// (prefixes included), or -1 for an unimplemented opcode. z80_step first
+// fires due events and, if an interrupt is taken, runs only its acknowledge.
 void z80_init(Z80_State* state);
 int decode_cb(Z80_State* state);
 int decode_dd(Z80_State* state);
@@ -59,6 +74,64 @@ int decode_fd(Z80_State* state);
 int decode_fdcb(Z80_State* state);
 int z80_step(Z80_State* state);
 
+// Run until at least cycle_budget T-states have elapsed or z80_request_exit
+// is called, and return the T-states actually used. The last instruction may
+// overshoot the budget; state->cycles is brought up to date on return.
+int z80_run(Z80_State* state, int cycle_budget);
+void z80_request_exit(Z80_State* state);
+
+// Interrupt inputs. /INT is level triggered and taken between instructions
+// while IFF1 is set (IM 0 and IM 1 go to 0038h, IM 2 through the table at
+// I * 256 + 0xFF); an NMI is taken once, at the next instruction boundary.
+// Devices drive them from scheduler events (state->scheduler).
+void z80_set_int(Z80_State* state, bool asserted);
+void z80_nmi(Z80_State* state);
+
+// Opcode dispatch used by z80_run. Threaded (computed goto) dispatch is the
+// default where the compiler supports it; z80_set_dispatch returns false if
+// the requested mode isn't available in this build. The mode is shared by
+// every machine in the process, set it before starting any.
+enum Z80_DISPATCH
+{
+    Z80_DISPATCH_SWITCH = 0,
+    Z80_DISPATCH_THREADED,
+    Z80_DISPATCH_CACHED,    // threaded handlers fed from the block cache
+    Z80_DISPATCH_JIT        // block cache with hot blocks translated to x86-64
+};
+
+bool z80_set_dispatch(int mode);
+int z80_get_dispatch(void);
+
+// Block cache used by Z80_DISPATCH_CACHED, one per machine. Runs of main
+// opcodes are recorded the first time they execute and replayed from then on
+// without fetching or decoding the opcodes again. mem_write drops the blocks
+// on any page it writes to; anything that changes memory behind its back
+// (loading a snapshot) must call z80_flush_block_cache.
+//
+// Replay saves the fetch but checks each instruction against its block, so
+// on its own it is not always ahead of THREADED: code that runs many short
+// blocks, or leaves them early, can be slower. The cache is what
+// Z80_DISPATCH_JIT finds and counts hot blocks with.
+typedef struct {
+    uint64_t hits;          // blocks replayed from the cache
+    uint64_t misses;        // blocks recorded by the interpreter
+    uint64_t invalidations; // writes to pages holding cached code
+    uint64_t flushes;       // whole cache dropped (full or on request)
+    uint64_t jit_blocks;    // blocks translated by the JIT
+    uint64_t jit_runs;      // runs of translated code
+    uint64_t jit_mismatches; // verify mode: JIT and interpreter disagreed
+} Z80_BlockCacheStats;
+
+void z80_flush_block_cache(Z80_State* state);
+// Release the cache and its JIT code; it is allocated again if needed
+void z80_free_block_cache(Z80_State* state);
+void z80_get_block_cache_stats(Z80_State* state, Z80_BlockCacheStats* stats);
+void z80_invalidate_code(Z80_State* state, uint32_t addr);
+
+// Differential test mode for Z80_DISPATCH_JIT: every run of translated code
+// is checked against the interpreter, mismatches are printed and counted.
+void z80_set_jit_verify(bool verify);
+
 // Stack operations
 void push16(Z80_State* state, uint16_t val);
 uint16_t pop16(Z80_State* state);
\ No newline at end of file
@@ -0,0 +1,170 @@
+/* z80_bench.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zx_spectrum.h"
+#include "z80.h"
+#include "loader.h"
+#include "memory.h"
+#include "machine.h"
+#include "ula.h"
+
+#define DEFAULT_FRAMES 500
+
+static const char* dispatch_names[] = { "switch", "threaded", "cached", "jit" };
+
+#ifdef Z80_LAZY_FLAGS
+static const char* flags_mode = "lazy";
+#else
+static const char* flags_mode = "eager";
+#endif
+
+static uint32_t memory_hash(ZX_Machine* machine) {
+  uint32_t hash = 2166136261u;
+  const uint8_t* ram = &machine->memory.ram[0][0];
+  for (int i = 0; i < RAM_BANKS * MEM_SLOT_SIZE; i++) {
+    hash ^= ram[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void print_usage(const char* program_name) {
+  printf("Z80 core benchmark\n");
+  printf("Usage: %s <snapshot> [frames] [--verify-jit]\n\n", program_name);
+  printf("Runs the snapshot for the given number of frames with every dispatch\n");
+  printf("mode available in this build and reports the emulated speed.\n");
+  printf("--verify-jit checks every run of JIT code against the interpreter.\n");
+}
+
+static bool load_snapshot(const char* name, ZX_Machine* machine) {
+  const char* ext = strrchr(name, '.');
+  if (ext && strcmp(ext, ".sna") == 0)
+    return load_sna(name, machine);
+  return load_z80_snapshot(name, machine);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    print_usage(argv[0]);
+    return RETCODE_INVALID_ARGUMENTS;
+  }
+
+  int frames = DEFAULT_FRAMES;
+  bool verify_jit = false;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--verify-jit") == 0)
+      verify_jit = true;
+    else if (atoi(argv[i]) > 0)
+      frames = atoi(argv[i]);
+  }
+  z80_set_jit_verify(verify_jit);
+
+  ZX_Machine* machine = machine_create();
+  if (!machine)
+    return 1;
+
+  if (!load_rom("48.rom", machine)) {
+    printf("Error: Unable to load ROM\n");
+    return RETCODE_ROM_LOADING_FAILED;
+  }
+  if (!load_snapshot(argv[1], machine)) {
+    printf("Error: Unable to load snapshot\n");
+    return RETCODE_Z80_SNAPSHOT_LOADING_FAILED;
+  }
+
+  // Every mode starts again from the snapshot
+  Z80_State initial = machine->cpu;
+  static uint8_t initial_memory[RAM_BANKS][MEM_SLOT_SIZE];
+  memcpy(initial_memory, machine->memory.ram, sizeof(initial_memory));
+
+  bool have_reference = false;
+  Z80_State reference;
+  uint32_t reference_hash = 0;
+  int status = RETCODE_NO_ERROR;
+
+  printf("Flags: %s\n", flags_mode);
+
+  for (int mode = Z80_DISPATCH_SWITCH; mode <= Z80_DISPATCH_JIT; mode++) {
+    if (!z80_set_dispatch(mode)) {
+      printf("%-9s not available in this build\n", dispatch_names[mode]);
+      continue;
+    }
+
+    Z80_State* state = &machine->cpu;
+    *state = initial;
+    memcpy(machine->memory.ram, initial_memory, sizeof(initial_memory));
+    mem_set_model(machine, mem_get_model(machine));
+    // The ULA keeps its place in the frame outside the CPU state
+    ula_init(state);
+    z80_flush_block_cache(state);
+    Z80_BlockCacheStats before;
+    z80_get_block_cache_stats(state, &before);
+
+    int tstates = 0;
+    clock_t start = clock();
+    for (int frame = 0; frame < frames; frame++) {
+      tstates += z80_run(state, FRAME_TSTATES - tstates);
+      tstates -= FRAME_TSTATES;
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (seconds <= 0)
+      seconds = 1e-9;
+
+    double mhz = state->cycles / seconds / 1e6;
+    printf("%-9s %d frames in %.3f s: %.1f MHz, %.1fx real time\n",
+      dispatch_names[mode], frames, seconds, mhz,
+      frames / seconds / FRAMES_PER_SECOND);
+    // HALT with interrupts off never ends, and z80_run skips the wait in
+    // one go, so the speed is meaningless
+    if (state->halted && !state->iff1)
+      printf("          halted with interrupts off: not a measure of the dispatcher\n");
+
+    if (mode >= Z80_DISPATCH_CACHED) {
+      Z80_BlockCacheStats after;
+      z80_get_block_cache_stats(state, &after);
+      uint64_t hits = after.hits - before.hits;
+      uint64_t misses = after.misses - before.misses;
+      printf("          blocks: %llu hits, %llu misses (%.2f%% hit rate), %llu invalidations, %llu flushes\n",
+        (unsigned long long)hits, (unsigned long long)misses,
+        hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+        (unsigned long long)(after.invalidations - before.invalidations),
+        (unsigned long long)(after.flushes - before.flushes));
+    }
+    if (mode == Z80_DISPATCH_JIT) {
+      Z80_BlockCacheStats after;
+      z80_get_block_cache_stats(state, &after);
+      printf("          jit: %llu blocks translated, %llu runs, %llu mismatches\n",
+        (unsigned long long)(after.jit_blocks - before.jit_blocks),
+        (unsigned long long)(after.jit_runs - before.jit_runs),
+        (unsigned long long)(after.jit_mismatches - before.jit_mismatches));
+      if (after.jit_mismatches != before.jit_mismatches)
+        status = 1;
+    }
+
+    // All dispatchers share the handlers, so they must end in the same state
+    uint32_t hash = memory_hash(machine);
+    if (!have_reference) {
+      reference = *state;
+      reference_hash = hash;
+      have_reference = true;
+    } else if (state->pc != reference.pc || state->af != reference.af || state->r != reference.r ||
+      state->cycles != reference.cycles || hash != reference_hash) {
+      printf("Error: %s dispatch diverged from %s\n", dispatch_names[mode],
+        dispatch_names[Z80_DISPATCH_SWITCH]);
+      status = 1;
+    }
+  }
+
+  // Final state of the first mode run, for comparing builds: the eager
+  // and lazy flag builds must print the same line (tools/compare_flags.sh)
+  if (have_reference)
+    printf("State: pc=%04X sp=%04X af=%04X bc=%04X de=%04X hl=%04X ix=%04X iy=%04X r=%02X cycles=%llu memory=%08X\n",
+      reference.pc, reference.sp, reference.af, reference.bc, reference.de, reference.hl,
+      reference.ix, reference.iy, reference.r, (unsigned long long)reference.cycles, reference_hash);
+
+  machine_destroy(machine);
+  return status;
+}
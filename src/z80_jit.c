@@ -0,0 +1,334 @@
+/* z80_jit.c */
+// x86-64 code generator for hot blocks of simple Z80 instructions.
+//
+// The generated functions take the Z80_State pointer in rdi and keep every
+// register in the state structure, so the interpreter can pick up from any
+// block boundary. Only rax, rcx, rdx, rsi and r8 are used, all of which are
+// caller-saved in the System V ABI.
+#ifdef __linux__
+#define _GNU_SOURCE   // memfd_create
+#endif
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "z80_jit.h"
+#include "z80.h"
+#include "memory.h"
+
+#ifdef Z80_HAVE_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_BUFFER_SIZE (4 * 1024 * 1024)
+// Longest translation of a single instruction is well under this
+#define JIT_MAX_OP_BYTES 64
+
+enum JIT_REGS { RAX = 0, RCX = 1, RDX = 2, RSI = 6 };
+
+// No page is ever writable and executable at once (W^X). On Linux the
+// buffer is one memfd mapped twice, read-write to emit into (buffer) and
+// read-execute to run from (code), so nothing needs flipping. Elsewhere, or
+// if that fails, code == buffer: pages are written while read-write and
+// made read-execute once the code in them is complete, and translation
+// flips the pages it writes to back for a moment. That is safe because a
+// machine's code only runs between translations.
+struct Z80_Jit {
+  uint8_t* buffer;
+  uint8_t* code;
+  size_t used;
+  size_t page_size;
+  // Where the instruction being translated goes
+  uint8_t* out;
+};
+
+// Offsets of B, C, D, E, H, L, (HL), A as encoded in the opcode
+static const int reg_offset[8] = {
+  offsetof(Z80_State, b), offsetof(Z80_State, c),
+  offsetof(Z80_State, d), offsetof(Z80_State, e),
+  offsetof(Z80_State, h), offsetof(Z80_State, l),
+  -1, offsetof(Z80_State, a)
+};
+
+static const int pair_offset[4] = {
+  offsetof(Z80_State, bc), offsetof(Z80_State, de),
+  offsetof(Z80_State, hl), offsetof(Z80_State, sp)
+};
+
+#define OFF_A offsetof(Z80_State, a)
+#define OFF_F offsetof(Z80_State, f)
+#define OFF_PC offsetof(Z80_State, pc)
+
+static void emit8(Z80_Jit* jit, uint8_t val) {
+  *jit->out++ = val;
+}
+
+static void emit32(Z80_Jit* jit, uint32_t val) {
+  memcpy(jit->out, &val, 4);
+  jit->out += 4;
+}
+
+static void emit64(Z80_Jit* jit, uint64_t val) {
+  memcpy(jit->out, &val, 8);
+  jit->out += 8;
+}
+
+// movzx reg32, byte [rdi + offset]
+static void load_byte(Z80_Jit* jit, int reg, int offset) {
+  emit8(jit, 0x0F); emit8(jit, 0xB6); emit8(jit, 0x47 | (reg << 3)); emit8(jit, offset);
+}
+
+// mov byte [rdi + offset], reg8 (al, cl or dl)
+static void store_byte(Z80_Jit* jit, int reg, int offset) {
+  emit8(jit, 0x88); emit8(jit, 0x47 | (reg << 3)); emit8(jit, offset);
+}
+
+// movabs r8, table; movzx reg32, byte [r8 + index]
+static void load_table(Z80_Jit* jit, int reg, const uint8_t* table, int index) {
+  emit8(jit, 0x49); emit8(jit, 0xB8); emit64(jit, (uint64_t)(uintptr_t)table);
+  emit8(jit, 0x41); emit8(jit, 0x0F); emit8(jit, 0xB6); emit8(jit, 0x04 | (reg << 3)); emit8(jit, index << 3);
+}
+
+// op r/m32, r32 between two of the scratch registers
+static void alu_reg(Z80_Jit* jit, uint8_t op, int dst, int src) {
+  emit8(jit, op); emit8(jit, 0xC0 | (src << 3) | dst);
+}
+
+#define X86_ADD 0x01
+#define X86_OR  0x09
+#define X86_AND 0x21
+#define X86_SUB 0x29
+#define X86_XOR 0x31
+#define X86_MOV 0x89
+
+// ALU r: A in eax, the operand in ecx, F built in edx
+static void emit_alu(Z80_Jit* jit, int op, int src) {
+  load_byte(jit, RAX, OFF_A);
+  load_byte(jit, RCX, reg_offset[src]);
+
+  switch (op) {
+  case 0: // ADD
+  case 1: // ADC
+  case 2: // SUB
+  case 3: // SBC
+  case 7: // CP
+    // edx = (carry << 16) | (a << 8) | operand
+    if (op == 1 || op == 3) {
+      load_byte(jit, RSI, OFF_F);
+      emit8(jit, 0x83); emit8(jit, 0xE6); emit8(jit, 0x01);   // and esi, 1
+      alu_reg(jit, X86_MOV, RDX, RSI);
+      emit8(jit, 0xC1); emit8(jit, 0xE2); emit8(jit, 0x08);   // shl edx, 8
+      alu_reg(jit, X86_OR, RDX, RAX);
+    } else {
+      alu_reg(jit, X86_MOV, RDX, RAX);
+    }
+    emit8(jit, 0xC1); emit8(jit, 0xE2); emit8(jit, 0x08);     // shl edx, 8
+    alu_reg(jit, X86_OR, RDX, RCX);
+    load_table(jit, RDX, op <= 1 ? jit_szhvc_add : jit_szhvc_sub, RDX);
+
+    if (op == 7) {
+      // CP takes bits 3 and 5 from the operand
+      emit8(jit, 0x83); emit8(jit, 0xE2); emit8(jit, (uint8_t)~(FLAG_5 | FLAG_3)); // and edx, ~0x28
+      emit8(jit, 0x83); emit8(jit, 0xE1); emit8(jit, FLAG_5 | FLAG_3); // and ecx, 0x28
+      alu_reg(jit, X86_OR, RDX, RCX);
+      store_byte(jit, RDX, OFF_F);
+      return;
+    }
+
+    alu_reg(jit, op <= 1 ? X86_ADD : X86_SUB, RAX, RCX);
+    if (op == 1 || op == 3)
+      alu_reg(jit, op == 1 ? X86_ADD : X86_SUB, RAX, RSI);
+    store_byte(jit, RAX, OFF_A);
+    store_byte(jit, RDX, OFF_F);
+    return;
+
+  case 4: // AND
+  case 5: // XOR
+  case 6: // OR
+    alu_reg(jit, op == 4 ? X86_AND : op == 5 ? X86_XOR : X86_OR, RAX, RCX);
+    store_byte(jit, RAX, OFF_A);
+    load_table(jit, RDX, jit_szp_table, RAX);
+    if (op == 4) {
+      emit8(jit, 0x83); emit8(jit, 0xCA); emit8(jit, FLAG_H); // or edx, H
+    }
+    store_byte(jit, RDX, OFF_F);
+    return;
+  }
+}
+
+// INC r / DEC r, carry kept
+static void emit_inc_dec(Z80_Jit* jit, int reg, bool dec) {
+  load_byte(jit, RAX, reg_offset[reg]);
+  emit8(jit, 0x83); emit8(jit, dec ? 0xE8 : 0xC0); emit8(jit, 0x01); // sub/add eax, 1
+  emit8(jit, 0x0F); emit8(jit, 0xB6); emit8(jit, 0xC0);       // movzx eax, al
+  store_byte(jit, RAX, reg_offset[reg]);
+  load_table(jit, RDX, dec ? jit_szhv_dec : jit_szhv_inc, RAX);
+  load_byte(jit, RCX, OFF_F);
+  emit8(jit, 0x83); emit8(jit, 0xE1); emit8(jit, FLAG_C);     // and ecx, C
+  alu_reg(jit, X86_OR, RDX, RCX);
+  store_byte(jit, RDX, OFF_F);
+}
+
+// Translations must do what the interpreter's handlers do, so 0x2B, 0x2C
+// and 0x2D (DEC HL, INC L and DEC L on a Z80) are left out: z80_ops.inc
+// runs them as LD HL,nn, LD (HL),A and DEC HL, which read and write memory
+bool jit_supported(uint8_t opcode) {
+  // LD r,r' and ALU A,r, leaving out the (HL) forms and HALT
+  if (opcode >= 0x40 && opcode <= 0x7F)
+    return (opcode & 7) != 6 && ((opcode >> 3) & 7) != 6;
+  if (opcode >= 0x80 && opcode <= 0xBF)
+    return (opcode & 7) != 6;
+
+  switch (opcode) {
+  case 0x00:                                            // NOP
+  case 0x03: case 0x13: case 0x23: case 0x33:           // INC rr
+  case 0x0B: case 0x1B: case 0x3B:                      // DEC rr
+  case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x3C: // INC r
+  case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x3D: // DEC r
+  case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // LD r,n
+    return true;
+  }
+  return false;
+}
+
+// Set the protection of the pages covering [start, end) of a single mapping
+static bool protect(Z80_Jit* jit, size_t start, size_t end, int prot) {
+  if (jit->code != jit->buffer)
+    return true;
+  start &= ~(jit->page_size - 1);
+  end = (end + jit->page_size - 1) & ~(jit->page_size - 1);
+  if (end > JIT_BUFFER_SIZE)
+    end = JIT_BUFFER_SIZE;
+  return end <= start || mprotect(jit->buffer + start, end - start, prot) == 0;
+}
+
+// The read-write and read-execute views of one memfd, false if there is no
+// memfd_create here or the policy forbids executable shared mappings
+static bool map_dual(Z80_Jit* jit) {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  int fd = memfd_create("z80_jit", MFD_CLOEXEC);
+  if (fd < 0)
+    return false;
+  void* buffer = MAP_FAILED;
+  void* code = MAP_FAILED;
+  if (ftruncate(fd, JIT_BUFFER_SIZE) == 0) {
+    buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    code = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (buffer == MAP_FAILED || code == MAP_FAILED) {
+    if (buffer != MAP_FAILED)
+      munmap(buffer, JIT_BUFFER_SIZE);
+    if (code != MAP_FAILED)
+      munmap(code, JIT_BUFFER_SIZE);
+    return false;
+  }
+  jit->buffer = buffer;
+  jit->code = code;
+  return true;
+#else
+  (void)jit;
+  return false;
+#endif
+}
+
+Z80_Jit* jit_create(void) {
+  Z80_Jit* jit = malloc(sizeof(Z80_Jit));
+  if (!jit) {
+    printf("Error: Unable to allocate JIT buffer\n");
+    return NULL;
+  }
+  jit->used = 0;
+  jit->page_size = (size_t)sysconf(_SC_PAGESIZE);
+  if (map_dual(jit))
+    return jit;
+
+  void* buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED) {
+    printf("Error: Unable to allocate JIT buffer\n");
+    free(jit);
+    return NULL;
+  }
+  jit->buffer = jit->code = buffer;
+
+  // Policies that forbid making written memory executable (SELinux execmem
+  // and the like) show up here rather than on the first translation
+  if (!protect(jit, 0, 1, PROT_READ | PROT_EXEC) || !protect(jit, 0, 1, PROT_READ | PROT_WRITE)) {
+    printf("Error: Unable to make JIT code executable\n");
+    jit_destroy(jit);
+    return NULL;
+  }
+  return jit;
+}
+
+void jit_destroy(Z80_Jit* jit) {
+  if (!jit)
+    return;
+  if (jit->code != jit->buffer)
+    munmap(jit->code, JIT_BUFFER_SIZE);
+  munmap(jit->buffer, JIT_BUFFER_SIZE);
+  free(jit);
+}
+
+// Nothing in the buffer may run again, so it goes back to read-write
+void jit_flush(Z80_Jit* jit) {
+  protect(jit, 0, jit->used, PROT_READ | PROT_WRITE);
+  jit->used = 0;
+}
+
+Z80_JitCode jit_translate(Z80_Jit* jit, ZX_Machine* machine, uint16_t pc, int length, int cycles) {
+  if (JIT_BUFFER_SIZE - jit->used < (size_t)(length + 1) * JIT_MAX_OP_BYTES)
+    return NULL;
+
+  // The first page may hold the end of the last translation, sealed
+  size_t room = (size_t)(length + 1) * JIT_MAX_OP_BYTES;
+  if (!protect(jit, jit->used, jit->used + room, PROT_READ | PROT_WRITE))
+    return NULL;
+  uint8_t* start = jit->buffer + jit->used;
+  jit->out = start;
+
+  for (int i = 0; i < length; i++) {
+    uint8_t opcode = mem_peek(machine, pc);
+
+    if (opcode >= 0x80) {
+      emit_alu(jit, (opcode >> 3) & 7, opcode & 7);
+      pc += 1;
+    } else if (opcode >= 0x40) {
+      int dst = (opcode >> 3) & 7;
+      int src = opcode & 7;
+      if (dst != src) {
+        load_byte(jit, RAX, reg_offset[src]);
+        store_byte(jit, RAX, reg_offset[dst]);
+      }
+      pc += 1;
+    } else if ((opcode & 7) == 6) {
+      // LD r,n: the operand is baked in, writes to it invalidate the block
+      emit8(jit, 0xC6); emit8(jit, 0x47); emit8(jit, reg_offset[opcode >> 3]); emit8(jit, mem_peek(machine, pc + 1));
+      pc += 2;
+    } else if ((opcode & 7) == 4 || (opcode & 7) == 5) {
+      emit_inc_dec(jit, opcode >> 3, (opcode & 7) == 5);
+      pc += 1;
+    } else if ((opcode & 0x0F) == 0x03 || (opcode & 0x0F) == 0x0B) {
+      // inc/dec word [rdi + offset]
+      emit8(jit, 0x66); emit8(jit, 0xFF); emit8(jit, (opcode & 0x08) ? 0x4F : 0x47);
+      emit8(jit, pair_offset[opcode >> 4]);
+      pc += 1;
+    } else {
+      pc += 1; // NOP
+    }
+  }
+
+  // mov word [rdi + pc], pc; mov eax, cycles; ret
+  emit8(jit, 0x66); emit8(jit, 0xC7); emit8(jit, 0x47); emit8(jit, OFF_PC); emit8(jit, pc & 0xFF); emit8(jit, pc >> 8);
+  emit8(jit, 0xB8); emit32(jit, cycles);
+  emit8(jit, 0xC3);
+
+  size_t end = jit->used + (jit->out - start);
+  if (!protect(jit, jit->used, end, PROT_READ | PROT_EXEC))
+    return NULL;
+  jit->used = end;
+  return (Z80_JitCode)(void*)(jit->code + (start - jit->buffer));
+}
+#endif
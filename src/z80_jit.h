@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "zx_spectrum.h"
+
+// x86-64 translator for the block cache (Z80_DISPATCH_JIT). Only built for
+// x86-64 with mmap (System V calling convention); define Z80_NO_JIT to leave
+// it out.
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(Z80_NO_JIT)
+#define Z80_HAVE_JIT
+#endif
+
+// Translated code runs a fixed run of instructions, leaves state->pc after
+// the last one and returns the T-states they took.
+typedef int (*Z80_JitCode)(Z80_State* state);
+
+// Tables used by the translated ALU code, defined next to the interpreter's
+// copies in z80.c
+extern const uint8_t* const jit_szp_table;
+extern const uint8_t* const jit_szhv_inc;
+extern const uint8_t* const jit_szhv_dec;
+extern const uint8_t* const jit_szhvc_add;
+extern const uint8_t* const jit_szhvc_sub;
+
+// Code buffer of one machine's block cache. jit_create returns NULL if
+// executable memory can't be had.
+typedef struct Z80_Jit Z80_Jit;
+
+Z80_Jit* jit_create(void);
+void jit_destroy(Z80_Jit* jit);
+void jit_flush(Z80_Jit* jit);
+// Opcodes the translator handles: register loads, 8-bit ALU on registers,
+// INC/DEC r and rr, LD r,n and NOP
+bool jit_supported(uint8_t opcode);
+// Translate the length supported instructions starting at pc. Returns NULL
+// when the code buffer is full; jit_flush (and dropping every pointer into
+// the buffer) makes room again.
+Z80_JitCode jit_translate(Z80_Jit* jit, ZX_Machine* machine, uint16_t pc, int length, int cycles);
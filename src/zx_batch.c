@@ -0,0 +1,258 @@
+/* zx_batch.c */
+// Headless batch runner: runs every snapshot in a manifest for a number of
+// frames, spread over all cores, and reports the final state of each.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zx_spectrum.h"
+#include "z80.h"
+#include "loader.h"
+#include "memory.h"
+#include "machine.h"
+#include "ula.h"
+#include "thread_pool.h"
+
+#define DEFAULT_FRAMES 500
+#define MAX_PATH_LENGTH 1024
+
+typedef struct {
+    char snapshot[MAX_PATH_LENGTH];
+    int frames;
+
+    // Filled in by the worker that runs the job
+    bool ok;
+    uint32_t ram_hash;
+    uint16_t pc;
+    uint64_t cycles;
+} BatchJob;
+
+typedef struct {
+    BatchJob* jobs;
+    ZX_Machine** machines;  // one per worker, reset for every job
+    const char* screenshot_dir;
+} Batch;
+
+static void print_usage(const char* program_name) {
+  printf("ZX Spectrum batch runner\n");
+  printf("Usage: %s <manifest> <report> [-j threads] [-s screenshot_dir] [-r rom]\n\n", program_name);
+  printf("The manifest lists one snapshot per line, optionally followed by the\n");
+  printf("number of frames to run it for (default %d); blank lines and lines\n", DEFAULT_FRAMES);
+  printf("starting with # are skipped. The report has one line per job with its\n");
+  printf("status, a hash of RAM and the PC at the end.\n");
+}
+
+// FNV-1a over the RAM of the model, in address order for the 48K
+static uint32_t ram_hash(ZX_Machine* machine) {
+  static const int banks_48k[] = { 5, 2, 0 };
+  static const int banks_128k[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+  bool is_128k = mem_get_model(machine) == ZX_MODEL_128K;
+  const int* banks = is_128k ? banks_128k : banks_48k;
+  int count = is_128k ? 8 : 3;
+  uint32_t hash = 2166136261u;
+
+  for (int i = 0; i < count; i++) {
+    const uint8_t* bank = machine->memory.ram[banks[i]];
+    for (int j = 0; j < MEM_SLOT_SIZE; j++) {
+      hash ^= bank[j];
+      hash *= 16777619u;
+    }
+  }
+  return hash;
+}
+
+// Binary PPM of machine->frame
+static bool write_screenshot(ZX_Machine* machine, const char* path) {
+  size_t size = FRAME_WIDTH * FRAME_HEIGHT * 3;
+  uint8_t* rgb = malloc(size);
+  FILE* file = fopen(path, "wb");
+  if (!rgb || !file) {
+    perror("Screenshot save failed");
+    free(rgb);
+    if (file)
+      fclose(file);
+    return false;
+  }
+
+  for (int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; i++) {
+    uint32_t pixel = machine->frame[i];
+    rgb[i * 3] = (pixel >> 16) & 0xFF;
+    rgb[i * 3 + 1] = (pixel >> 8) & 0xFF;
+    rgb[i * 3 + 2] = pixel & 0xFF;
+  }
+
+  fprintf(file, "P6\n%d %d\n255\n", FRAME_WIDTH, FRAME_HEIGHT);
+  bool ok = fwrite(rgb, 1, size, file) == size;
+  fclose(file);
+  free(rgb);
+  return ok;
+}
+
+static void run_job(int worker, int index, void* data) {
+  Batch* batch = data;
+  BatchJob* job = &batch->jobs[index];
+  ZX_Machine* machine = batch->machines[worker];
+
+  machine_reset(machine);
+  const char* ext = strrchr(job->snapshot, '.');
+  if (ext && strcmp(ext, ".sna") == 0)
+    job->ok = load_sna(job->snapshot, machine);
+  else
+    job->ok = load_z80_snapshot(job->snapshot, machine);
+  if (!job->ok)
+    return;
+
+  // Overshoot from the last instruction of a frame is carried into the next
+  int tstates = 0;
+  for (int frame = 0; frame < job->frames; frame++) {
+    tstates += z80_run(&machine->cpu, FRAME_TSTATES - tstates);
+    tstates -= FRAME_TSTATES;
+  }
+
+  job->ram_hash = ram_hash(machine);
+  job->pc = machine->cpu.pc;
+  job->cycles = machine->cpu.cycles;
+
+  if (batch->screenshot_dir) {
+    char path[MAX_PATH_LENGTH + 32];
+    snprintf(path, sizeof(path), "%s/%05d.ppm", batch->screenshot_dir, index);
+    ula_render(machine);
+    job->ok = write_screenshot(machine, path);
+  }
+}
+
+// Returns the number of jobs read, -1 on error
+static int read_manifest(const char* path, BatchJob** jobs) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    perror("Manifest load failed");
+    return -1;
+  }
+
+  int count = 0;
+  int capacity = 0;
+  char line[MAX_PATH_LENGTH + 32];
+  *jobs = NULL;
+
+  while (fgets(line, sizeof(line), file)) {
+    char snapshot[MAX_PATH_LENGTH];
+    int frames = DEFAULT_FRAMES;
+    char* text = line + strspn(line, " \t");
+    if (*text == '#' || sscanf(text, "%1023s %d", snapshot, &frames) < 1)
+      continue;
+
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      BatchJob* grown = realloc(*jobs, capacity * sizeof(BatchJob));
+      if (!grown) {
+        printf("Error: Unable to allocate job list\n");
+        fclose(file);
+        return -1;
+      }
+      *jobs = grown;
+    }
+
+    BatchJob* job = &(*jobs)[count++];
+    memset(job, 0, sizeof(*job));
+    strcpy(job->snapshot, snapshot);
+    job->frames = frames > 0 ? frames : DEFAULT_FRAMES;
+  }
+
+  fclose(file);
+  return count;
+}
+
+static bool write_report(const char* path, const BatchJob* jobs, int count) {
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    perror("Report save failed");
+    return false;
+  }
+
+  fprintf(file, "# job frames status ram_hash pc snapshot\n");
+  for (int i = 0; i < count; i++) {
+    const BatchJob* job = &jobs[i];
+    fprintf(file, "%d %d %s %08X %04X %s\n", i, job->frames, job->ok ? "ok" : "failed",
+      job->ram_hash, job->pc, job->snapshot);
+  }
+
+  fclose(file);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    print_usage(argv[0]);
+    return RETCODE_INVALID_ARGUMENTS;
+  }
+
+  int workers = thread_pool_cpus();
+  const char* rom = "48.rom";
+  Batch batch = { NULL, NULL, NULL };
+  for (int i = 3; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-j") == 0 && atoi(argv[i + 1]) > 0)
+      workers = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-s") == 0)
+      batch.screenshot_dir = argv[i + 1];
+    else if (strcmp(argv[i], "-r") == 0)
+      rom = argv[i + 1];
+    else {
+      print_usage(argv[0]);
+      return RETCODE_INVALID_ARGUMENTS;
+    }
+  }
+
+  int count = read_manifest(argv[1], &batch.jobs);
+  if (count < 0)
+    return RETCODE_INVALID_ARGUMENTS;
+  if (workers > count)
+    workers = count > 0 ? count : 1;
+
+  // The ROM is read once and copied into every worker's machine
+  batch.machines = calloc(workers, sizeof(ZX_Machine*));
+  if (!batch.machines)
+    return 1;
+  for (int i = 0; i < workers; i++) {
+    ZX_Machine* machine = machine_create();
+    if (!machine)
+      return 1;
+    batch.machines[i] = machine;
+    if (i == 0) {
+      if (!load_rom(rom, machine)) {
+        printf("Error: Unable to load ROM\n");
+        return RETCODE_ROM_LOADING_FAILED;
+      }
+      continue;
+    }
+    memcpy(machine->memory.rom, batch.machines[0]->memory.rom, sizeof(machine->memory.rom));
+    mem_set_model(machine, mem_get_model(batch.machines[0]));
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  thread_pool_run(workers, count, run_job, &batch);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  if (seconds <= 0)
+    seconds = 1e-9;
+
+  int failed = 0;
+  uint64_t frames = 0;
+  uint64_t cycles = 0;
+  for (int i = 0; i < count; i++) {
+    failed += !batch.jobs[i].ok;
+    frames += batch.jobs[i].ok ? batch.jobs[i].frames : 0;
+    cycles += batch.jobs[i].cycles;
+  }
+  printf("%d jobs (%d failed) on %d threads in %.3f s: %.1f MHz, %.1fx real time\n",
+    count, failed, workers, seconds, cycles / seconds / 1e6,
+    frames / seconds / FRAMES_PER_SECOND);
+
+  bool reported = write_report(argv[2], batch.jobs, count);
+  for (int i = 0; i < workers; i++)
+    machine_destroy(batch.machines[i]);
+  free(batch.machines);
+  free(batch.jobs);
+  return reported && !failed ? RETCODE_NO_ERROR : 1;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include "scheduler.h"
 
 #define MEM_SIZE 65536
 #define ROM_START 0x0000
@@ -11,8 +12,22 @@
 #define RAM_SIZE 0xC000  // 48KB
 #define SCREEN_WIDTH 256
 #define SCREEN_HEIGHT 192
+// Picture with the visible border around the screen
+#define BORDER_LEFT 32
+#define BORDER_TOP 48
+#define FRAME_WIDTH (SCREEN_WIDTH + 2 * BORDER_LEFT)
+#define FRAME_HEIGHT (SCREEN_HEIGHT + 2 * BORDER_TOP)
 #define SCALE_FACTOR 2
 
+// 48K frame timing: 312 lines x 224 T-states at 3.5 MHz, 50 frames per second
+#define FRAME_TSTATES 69888
+#define LINE_TSTATES 224
+// Line of the first screen pixel row, counted from the frame interrupt
+#define FIRST_SCREEN_LINE 64
+#define FRAMES_PER_SECOND 50
+// The ULA holds /INT low for this long at the start of every frame
+#define INT_TSTATES 32
+
 enum RETURN_CODES
 {
     RETCODE_NO_ERROR = 0,
@@ -21,6 +36,12 @@ enum RETURN_CODES
     RETCODE_Z80_SNAPSHOT_LOADING_FAILED
 };
 
+enum ZX_MODEL
+{
+    ZX_MODEL_48K = 0,
+    ZX_MODEL_128K
+};
+
 enum Z80_VERSION
 {
     Z80_VERSION_1 = 1,
@@ -28,8 +49,11 @@ enum Z80_VERSION
     Z80_VERSION_3
 };
 
+// The machine a CPU belongs to (machine.h)
+typedef struct ZX_Machine ZX_Machine;
+
 // Zilog Z80 Register State
-typedef struct {
+typedef struct Z80_State {
     // Main registers
     union { struct { uint8_t f, a; }; uint16_t af; };
     union { struct { uint8_t c, b; }; uint16_t bc; };
@@ -55,4 +79,42 @@ typedef struct {
     // Control flags
     uint8_t iff1, iff2;
     uint8_t imode;
+
+    // Interrupt inputs: the level of /INT and a latched /NMI edge
+    uint8_t int_line;
+    uint8_t nmi_pending;
+    // Set by EI: no maskable interrupt until the next instruction is done
+    uint8_t ei_delay;
+    // Executing HALT, with the PC still on it
+    uint8_t halted;
+    // Repeating block instruction (ED opcode) part way through, PC on it
+    uint8_t block_op;
+
+    // Pending flag computation, only used by the lazy flags build
+    uint8_t flag_op;
+    uint32_t flag_arg;
+
+    // T-states executed since reset, brought up to date at the end of each
+    // pass of z80_run. During a pass the dispatchers count in pass_cycles
+    // instead, so a contended memory access can tell the time and add its
+    // delay (memory.c).
+    uint64_t cycles;
+    int pass_cycles;
+    // T-states from the start of the current instruction to its next memory
+    // or I/O cycle. The dispatchers zero it before each opcode fetch and
+    // every access moves it on by the length of its machine cycle, so a
+    // contended access is timed where it happens rather than where the
+    // instruction started.
+    int access_cycles;
+
+    // Timed events (ULA interrupt, audio, tape) in T-states since reset
+    Z80_Scheduler scheduler;
+
+    // Set to make the dispatchers return to z80_run after the current
+    // instruction; exit_requested (z80_request_exit) also leaves z80_run
+    uint8_t run_exit;
+    uint8_t exit_requested;
+
+    // Memory and ports are reached through the machine
+    ZX_Machine* machine;
 } Z80_State;
\ No newline at end of file
@@ -0,0 +1,78 @@
+#!/bin/sh
+# Compare the eager and lazy flag builds of the core (Z80_LAZY_FLAGS): both
+# are built in Release, then z80_bench runs every snapshot given with each.
+# The speeds of both are printed side by side, and the final state (the
+# registers, cycle count and RAM hash) must be the same in both builds.
+#
+# Usage: tools/compare_flags.sh [-f frames] [-n runs] snapshot...
+# Snapshots are found relative to bin/, where z80_bench finds 48.rom. Runs
+# alternate between the builds and the best of n is kept, which helps on a
+# noisy machine. Exits with 1 if any snapshot ends in a different state.
+#
+# A run that ends halted with interrupts off proves nothing about either
+# the flags or the speed, and is reported as such.
+
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+frames=2000
+runs=3
+while getopts f:n: opt; do
+  case $opt in
+    f) frames=$OPTARG ;;
+    n) runs=$OPTARG ;;
+    *) exit 2 ;;
+  esac
+done
+shift $((OPTIND - 1))
+if [ $# -eq 0 ]; then
+  echo "Usage: $0 [-f frames] [-n runs] snapshot..." >&2
+  exit 2
+fi
+
+build=${BUILD_DIR:-$root/build/compare_flags}
+for flags in eager lazy; do
+  lazy=OFF
+  [ $flags = lazy ] && lazy=ON
+  cmake -S "$root" -B "$build/$flags" -DCMAKE_BUILD_TYPE=Release \
+    -DZ80_LAZY_FLAGS=$lazy -DZX_BUILD_FRONTEND=OFF > /dev/null
+  cmake --build "$build/$flags" --target z80_bench > /dev/null
+done
+
+# Best MHz of one dispatch mode over the saved runs
+best() {
+  grep -h "^$2 " "$1".* | sed 's/.*: \([0-9.]*\) MHz.*/\1/' | sort -n | tail -1
+}
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+status=0
+cd "$root/bin"
+for snapshot in "$@"; do
+  i=0
+  while [ $i -lt "$runs" ]; do
+    for flags in eager lazy; do
+      "$build/$flags/src/z80_bench" "$snapshot" "$frames" > "$out/$flags.$i" || status=1
+    done
+    i=$((i + 1))
+  done
+
+  echo "$snapshot, $frames frames, best of $runs:"
+  for mode in switch threaded cached jit; do
+    eager=$(best "$out/eager" $mode)
+    lazy=$(best "$out/lazy" $mode)
+    [ -n "$eager" ] && printf '  %-9s eager %8s MHz  lazy %8s MHz\n' $mode "$eager" "$lazy"
+  done
+  if grep -q "halted with interrupts off" "$out/eager.0" "$out/lazy.0"; then
+    echo "  halted with interrupts off: not a comparison"
+  fi
+  if [ "$(grep '^State:' "$out/eager.0")" = "$(grep '^State:' "$out/lazy.0")" ]; then
+    echo "  same final state"
+  else
+    echo "  final state differs:"
+    grep -h '^State:' "$out/eager.0" "$out/lazy.0" | sed 's/^/    /'
+    status=1
+  fi
+  rm -f "$out"/*
+done
+exit $status